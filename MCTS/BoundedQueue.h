@@ -0,0 +1,88 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * スレッド間で要素を受け渡す、容量制限付きのFIFOキュー。
+ * 生産者はtryPush()を使えば決してブロックしない（満杯なら要素を捨ててfalseを返す）。
+ * close()した後は、残りの要素を取り出し終えるとpop()がfalseを返す。
+ */
+template<typename T>
+class BoundedQueue {
+private:
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	/**
+	 * 空きができるまで待ってから追加する。close()後はfalseを返す。
+	 */
+	bool push(const T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+		if (closed) return false;
+
+		items.push_back(item);
+		notEmpty.notify_one();
+		return true;
+	}
+
+	/**
+	 * 空きがあれば追加する。満杯またはclose()後なら、追加せずにfalseを返す。
+	 */
+	bool tryPush(const T& item) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed || items.size() >= capacity) return false;
+
+		items.push_back(item);
+		notEmpty.notify_one();
+		return true;
+	}
+
+	/**
+	 * 要素が来るまで待って取り出す。close()済みで空ならfalseを返す。
+	 */
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+		if (items.empty()) return false;
+
+		item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	/**
+	 * 要素があれば取り出す。空なら待たずにfalseを返す。
+	 */
+	bool tryPop(T& item) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty()) return false;
+
+		item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+};
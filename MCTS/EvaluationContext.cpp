@@ -0,0 +1,101 @@
+#include "EvaluationContext.h"
+#include <iostream>
+
+EvaluationContext::EvaluationContext() {
+}
+
+EvaluationContext::~EvaluationContext() {
+	// RenderManagerのデストラクタでGLのリソースを解放するので、contextをcurrentにしておく
+	if (context.isValid()) {
+		context.makeCurrent(&surface);
+	}
+}
+
+/**
+ * OpenGL contextを作成し、RenderManagerを初期化する。
+ * QOffscreenSurfaceを作成するので、GUIスレッドから呼び出すこと。
+ *
+ * @param width		描画する画像の幅
+ * @param height	描画する画像の高さ
+ * @return			OpenGL 4.2のcontextが作成できなければfalse
+ */
+bool EvaluationContext::init(int width, int height) {
+	if (!create()) return false;
+
+	initGL(width, height);
+	return true;
+}
+
+/**
+ * offscreen surfaceとOpenGL contextを作成する。
+ * QOffscreenSurfaceはGUIスレッドでしか作成できないので、GUIスレッドから呼び出すこと。
+ *
+ * @return			OpenGL 4.2のcontextが作成できなければfalse
+ */
+bool EvaluationContext::create() {
+	QSurfaceFormat format;
+	format.setVersion(4, 2);
+	format.setProfile(QSurfaceFormat::CompatibilityProfile);
+
+	surface.setFormat(format);
+	surface.create();
+
+	context.setFormat(format);
+	if (!context.create()) {
+		std::cout << "Error: failed to create an OpenGL context." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * contextを、それを使うスレッドに移す。create()の後、GUIスレッドから呼び出すこと。
+ */
+void EvaluationContext::moveToThread(QThread* thread) {
+	context.moveToThread(thread);
+}
+
+/**
+ * contextをcurrentにして、RenderManagerとカメラを初期化する。
+ * contextを使うスレッドから呼び出すこと。
+ *
+ * @param width		描画する画像の幅
+ * @param height	描画する画像の高さ
+ */
+void EvaluationContext::initGL(int width, int height) {
+	makeCurrent();
+	renderManager.init(false);
+	resetCamera(width, height);
+}
+
+/**
+ * カメラをGLWidget3Dの初期状態と同じ設定にする。GLは使わないので、どのスレッドから呼び出してもよい。
+ *
+ * @param width		描画する画像の幅
+ * @param height	描画する画像の高さ
+ */
+void EvaluationContext::resetCamera(int width, int height) {
+	camera.xrot = 0.0f;
+	camera.yrot = 0.0f;
+	camera.zrot = 0.0f;
+	camera.pos = glm::vec3(0, 4, 12);
+	camera.updatePMatrix(width, height);
+}
+
+/**
+ * contextを使い終わったら、そのスレッドから呼び出して、contextをGUIスレッドに戻す。
+ * GUIスレッドでこのオブジェクトを破棄できるようにするため。
+ */
+void EvaluationContext::release() {
+	doneCurrent();
+	context.moveToThread(surface.thread());
+}
+
+void EvaluationContext::makeCurrent() {
+	context.makeCurrent(&surface);
+}
+
+void EvaluationContext::doneCurrent() {
+	context.doneCurrent();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "glew.h"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QThread>
+#include "RenderManager.h"
+#include "Camera.h"
+
+/**
+ * GLWidget3Dなしで、MCTSの評価（描画）を行うためのオフスクリーンのOpenGL環境。
+ * 専用のOpenGL context、RenderManager、Cameraを持つ。
+ * カメラはGLWidget3Dの初期状態と同じ設定にするので、GUIと同じ条件で評価される。
+ *
+ * 別スレッドで使う場合は、GUIスレッドでcreate()した後、moveToThread()でcontextを移し、
+ * そのスレッドでinitGL()を呼ぶ。使い終わったら、そのスレッドでrelease()してGUIスレッドに戻す。
+ */
+class EvaluationContext {
+public:
+	QOffscreenSurface surface;
+	QOpenGLContext context;
+	RenderManager renderManager;
+	Camera camera;
+
+public:
+	EvaluationContext();
+	~EvaluationContext();
+
+	bool init(int width, int height);
+	bool create();
+	void moveToThread(QThread* thread);
+	void initGL(int width, int height);
+	void resetCamera(int width, int height);
+	void release();
+	void makeCurrent();
+	void doneCurrent();
+};
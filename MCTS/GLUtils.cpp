@@ -14,6 +14,16 @@
 #include <boost/geometry/geometries/ring.hpp>
 #include <cassert>
 #include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+
+// emitQuads2DでSSEを使う (使えなければスカラーで同じ計算をする)
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define GLUTILS_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 #ifndef M_PI
 #define M_PI	3.14159265359
@@ -346,6 +356,217 @@ glm::vec2 barycentricCoordinates(const glm::vec2& p1, const glm::vec2& p2, const
 	return glm::vec2(alpha, beta);
 }
 
+/**
+ * verticesの末尾にn個の頂点の領域を確保し、その先頭を返す。emit*の書き込み先として使う。
+ * 容量が足りなければ倍々で確保するので、少しずつ追加する呼び出しが続いても再確保の回数は増えない。
+ *
+ * @param vertices		頂点
+ * @param n				追加する頂点の数
+ * @return				追加した領域の先頭 (次にverticesの大きさを変えるまで有効)
+ */
+Vertex* appendSpan(std::vector<Vertex>& vertices, int n) {
+	size_t first = vertices.size();
+	if (vertices.capacity() < first + n) {
+		vertices.reserve((std::max)(first + n, vertices.capacity() * 2));
+	}
+	vertices.resize(first + n);
+	return vertices.data() + first;
+}
+
+glm::mat4 Rigid2D::toMat4() const {
+	glm::mat4 mat;
+	mat[0] = glm::vec4(c, s, 0, 0);
+	mat[1] = glm::vec4(-s, c, 0, 0);
+	mat[3] = glm::vec4(t, 0, 1);
+	return mat;
+}
+
+void Quads2D::clear() {
+	c.clear();
+	s.clear();
+	tx.clear();
+	ty.clear();
+	w.clear();
+	h.clear();
+	color.clear();
+}
+
+void Quads2D::push_back(const Rigid2D& xf, float w, float h, const glm::vec4& color) {
+	c.push_back(xf.c);
+	s.push_back(xf.s);
+	tx.push_back(xf.t.x);
+	ty.push_back(xf.t.y);
+	this->w.push_back(w);
+	this->h.push_back(h);
+	this->color.push_back(color);
+}
+
+namespace {
+
+// 座標変換の種類ごとの、z=0平面上の点と、法線 (0, 0, 1) の変換
+inline glm::vec3 transformPoint(const glm::mat4& mat, float x, float y) {
+	return glm::vec3(mat * glm::vec4(x, y, 0, 1));
+}
+
+inline glm::vec3 transformPoint(const Rigid2D& xf, float x, float y) {
+	return glm::vec3(xf.apply(x, y), 0);
+}
+
+inline glm::vec3 transformNormal(const glm::mat4& mat) {
+	return glm::vec3(mat * glm::vec4(0, 0, 1, 0));
+}
+
+inline glm::vec3 transformNormal(const Rigid2D& xf) {
+	return glm::vec3(0, 0, 1);
+}
+
+/**
+ * 下辺 (y1) の左右がx1、x2、上辺 (y2) の右左がx3、x4の四角形の頂点 (QUAD_VERTICES個) を書き込む。
+ * Transformごとに実体化されるので、Rigid2Dなら4x4行列の積と法線の変換はコンパイル時に消える。
+ */
+template<typename Transform>
+Vertex* emitQuadCorners(float x1, float x2, float x3, float x4, float y1, float y2, const glm::vec4& color, const Transform& xf, Vertex* out) {
+	glm::vec3 p1 = transformPoint(xf, x1, y1);
+	glm::vec3 p2 = transformPoint(xf, x2, y1);
+	glm::vec3 p3 = transformPoint(xf, x3, y2);
+	glm::vec3 p4 = transformPoint(xf, x4, y2);
+	glm::vec3 n = transformNormal(xf);
+
+	out[0] = Vertex(p1, n, color, glm::vec2(0, 0));
+	out[1] = Vertex(p2, n, color, glm::vec2(1, 0), 1);
+	out[2] = Vertex(p3, n, color, glm::vec2(1, 1));
+
+	out[3] = Vertex(p1, n, color, glm::vec2(0, 0));
+	out[4] = Vertex(p3, n, color, glm::vec2(1, 1));
+	out[5] = Vertex(p4, n, color, glm::vec2(0, 1), 1);
+
+	return out + QUAD_VERTICES;
+}
+
+}
+
+/**
+ * drawQuadと同じ四角形の頂点 (QUAD_VERTICES個) を、確保済みの領域に書き込む。
+ *
+ * @return		書き込んだ頂点の次の位置
+ */
+Vertex* emitQuad(float w, float h, const glm::vec4& color, const glm::mat4& mat, Vertex* out) {
+	return emitQuadCorners(-w * 0.5f, w * 0.5f, w * 0.5f, -w * 0.5f, -h * 0.5f, h * 0.5f, color, mat, out);
+}
+
+Vertex* emitQuad(float w, float h, const glm::vec4& color, const Rigid2D& xf, Vertex* out) {
+	return emitQuadCorners(-w * 0.5f, w * 0.5f, w * 0.5f, -w * 0.5f, -h * 0.5f, h * 0.5f, color, xf, out);
+}
+
+/**
+ * drawTrapezoidと同じ台形の頂点 (QUAD_VERTICES個) を、確保済みの領域に書き込む。
+ *
+ * @return		書き込んだ頂点の次の位置
+ */
+Vertex* emitTrapezoid(float w1, float w2, float h, const glm::vec4& color, const glm::mat4& mat, Vertex* out) {
+	return emitQuadCorners(-w1 * 0.5f, w1 * 0.5f, w2 * 0.5f, -w2 * 0.5f, 0.0f, h, color, mat, out);
+}
+
+Vertex* emitTrapezoid(float w1, float w2, float h, const glm::vec4& color, const Rigid2D& xf, Vertex* out) {
+	return emitQuadCorners(-w1 * 0.5f, w1 * 0.5f, w2 * 0.5f, -w2 * 0.5f, 0.0f, h, color, xf, out);
+}
+
+/**
+ * 全ての四角形の頂点 (quads.size() x QUAD_VERTICES個) を、確保済みの領域に書き込む。
+ * 頂点は、各四角形をemitQuad(w[i], h[i], color[i], Rigid2D, out)で書き込んだものと同じになる。
+ * SSEが使える場合は、四角形4つ分の角の座標をまとめて計算する。
+ *
+ * @param quads		四角形の列
+ * @param out		書き込み先
+ */
+void emitQuads2D(const Quads2D& quads, Vertex* out) {
+	const glm::vec3 n(0, 0, 1);
+	const glm::vec2 uv[4] = { glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1) };
+
+	int i = 0;
+#ifdef GLUTILS_USE_SSE
+	// 角k (左下、右下、右上、左上) の座標 = (c * x - s * y + tx, s * x + c * y + ty)、x = ±w/2、y = ±h/2
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	float x[4][4], y[4][4];
+	for (; i + 4 <= quads.size(); i += 4) {
+		__m128 c = _mm_loadu_ps(&quads.c[i]);
+		__m128 s = _mm_loadu_ps(&quads.s[i]);
+		__m128 tx = _mm_loadu_ps(&quads.tx[i]);
+		__m128 ty = _mm_loadu_ps(&quads.ty[i]);
+		__m128 hw = _mm_mul_ps(_mm_loadu_ps(&quads.w[i]), half);
+		__m128 hh = _mm_mul_ps(_mm_loadu_ps(&quads.h[i]), half);
+
+		__m128 cx = _mm_mul_ps(c, hw);
+		__m128 sx = _mm_mul_ps(s, hw);
+		__m128 cy = _mm_mul_ps(c, hh);
+		__m128 sy = _mm_mul_ps(s, hh);
+		__m128 ncx = _mm_xor_ps(cx, sign);
+		__m128 nsx = _mm_xor_ps(sx, sign);
+
+		_mm_storeu_ps(x[0], _mm_add_ps(_mm_add_ps(ncx, sy), tx));
+		_mm_storeu_ps(y[0], _mm_add_ps(_mm_sub_ps(nsx, cy), ty));
+		_mm_storeu_ps(x[1], _mm_add_ps(_mm_add_ps(cx, sy), tx));
+		_mm_storeu_ps(y[1], _mm_add_ps(_mm_sub_ps(sx, cy), ty));
+		_mm_storeu_ps(x[2], _mm_add_ps(_mm_sub_ps(cx, sy), tx));
+		_mm_storeu_ps(y[2], _mm_add_ps(_mm_add_ps(sx, cy), ty));
+		_mm_storeu_ps(x[3], _mm_add_ps(_mm_sub_ps(ncx, sy), tx));
+		_mm_storeu_ps(y[3], _mm_add_ps(_mm_add_ps(nsx, cy), ty));
+
+		for (int j = 0; j < 4; ++j) {
+			const glm::vec4& color = quads.color[i + j];
+			glm::vec3 p1(x[0][j], y[0][j], 0);
+			glm::vec3 p2(x[1][j], y[1][j], 0);
+			glm::vec3 p3(x[2][j], y[2][j], 0);
+			glm::vec3 p4(x[3][j], y[3][j], 0);
+
+			out[0] = Vertex(p1, n, color, uv[0]);
+			out[1] = Vertex(p2, n, color, uv[1], 1);
+			out[2] = Vertex(p3, n, color, uv[2]);
+
+			out[3] = Vertex(p1, n, color, uv[0]);
+			out[4] = Vertex(p3, n, color, uv[2]);
+			out[5] = Vertex(p4, n, color, uv[3], 1);
+			out += QUAD_VERTICES;
+		}
+	}
+#endif
+
+	// 残り (SSEが使えなければ全て)
+	for (; i < quads.size(); ++i) {
+		Rigid2D xf;
+		xf.c = quads.c[i];
+		xf.s = quads.s[i];
+		xf.t = glm::vec2(quads.tx[i], quads.ty[i]);
+		out = emitQuad(quads.w[i], quads.h[i], quads.color[i], xf, out);
+	}
+}
+
+/**
+ * drawPolygonと同じ凸多角形の頂点 (polygonVertexCount(numPoints)個) を、確保済みの領域に書き込む。
+ * 四角形なら、呼び出し側はglm::vec3[4]の配列を使い回せるので、セグメントごとにヒープを確保しなくてよい。
+ *
+ * @param points		多角形の頂点
+ * @param numPoints		多角形の頂点数 (3未満なら何も書き込まない)
+ * @param color			色
+ * @param out			書き込み先
+ * @return				書き込んだ頂点の次の位置
+ */
+Vertex* emitPolygon(const glm::vec3* points, int numPoints, const glm::vec4& color, Vertex* out) {
+	if (numPoints < 3) return out;
+
+	const glm::vec3& p1 = points[numPoints - 1];
+	glm::vec3 normal = glm::normalize(glm::cross(points[0] - p1, points[1] - p1));
+
+	for (int i = 0; i < numPoints - 2; ++i) {
+		*out++ = Vertex(p1, normal, color);
+		*out++ = Vertex(points[i], normal, color, i < numPoints - 3 ? 1.0f : 0.0f);
+		*out++ = Vertex(points[i + 1], normal, color, i > 0 ? 1.0f : 0.0f);
+	}
+
+	return out;
+}
+
 void drawCircle(float r1, float r2, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, int slices) {
 	glm::vec4 p1(0, 0, 0, 1);
 	glm::vec4 n(0, 0, 1, 0);
@@ -397,25 +618,11 @@ void drawCircle(float r1, float r2, float texWidth, float texHeight, const glm::
 }
 
 void drawQuad(float w, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices) {
-	glm::vec4 p1(-w * 0.5, -h * 0.5, 0, 1);
-	glm::vec4 p2(w * 0.5, -h * 0.5, 0, 1);
-	glm::vec4 p3(w * 0.5, h * 0.5, 0, 1);
-	glm::vec4 p4(-w * 0.5, h * 0.5, 0, 1);
-	glm::vec4 n(0, 0, 1, 0);
-
-	p1 = mat * p1;
-	p2 = mat * p2;
-	p3 = mat * p3;
-	p4 = mat * p4;
-	n = mat * n;
-
-	vertices.push_back(Vertex(glm::vec3(p1), glm::vec3(n), color, glm::vec2(0, 0)));
-	vertices.push_back(Vertex(glm::vec3(p2), glm::vec3(n), color, glm::vec2(1, 0), 1));
-	vertices.push_back(Vertex(glm::vec3(p3), glm::vec3(n), color, glm::vec2(1, 1)));
+	emitQuad(w, h, color, mat, appendSpan(vertices, QUAD_VERTICES));
+}
 
-	vertices.push_back(Vertex(glm::vec3(p1), glm::vec3(n), color, glm::vec2(0, 0)));
-	vertices.push_back(Vertex(glm::vec3(p3), glm::vec3(n), color, glm::vec2(1, 1)));
-	vertices.push_back(Vertex(glm::vec3(p4), glm::vec3(n), color, glm::vec2(0, 1), 1));
+void drawQuad(float w, float h, const glm::vec4& color, const Rigid2D& xf, std::vector<Vertex>& vertices) {
+	emitQuad(w, h, color, xf, appendSpan(vertices, QUAD_VERTICES));
 }
 
 void drawQuad(float w, float h, const glm::vec2& t1, const glm::vec2& t2, const glm::vec2& t3, const glm::vec2& t4, const glm::mat4& mat, std::vector<Vertex>& vertices) {
@@ -441,58 +648,16 @@ void drawQuad(float w, float h, const glm::vec2& t1, const glm::vec2& t2, const
 }
 
 void drawTrapezoid(float w1, float w2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices) {
-	glm::vec4 p1(-w1 * 0.5, 0, 0, 1);
-	glm::vec4 p2(w1 * 0.5, 0, 0, 1);
-	glm::vec4 p3(w2 * 0.5, h, 0, 1);
-	glm::vec4 p4(-w2 * 0.5, h, 0, 1);
-	glm::vec4 n(0, 0, 1, 0);
-
-	p1 = mat * p1;
-	p2 = mat * p2;
-	p3 = mat * p3;
-	p4 = mat * p4;
-	n = mat * n;
-
-	vertices.push_back(Vertex(glm::vec3(p1), glm::vec3(n), color, glm::vec2(0, 0)));
-	vertices.push_back(Vertex(glm::vec3(p2), glm::vec3(n), color, glm::vec2(1, 0), 1));
-	vertices.push_back(Vertex(glm::vec3(p3), glm::vec3(n), color, glm::vec2(1, 1)));
+	emitTrapezoid(w1, w2, h, color, mat, appendSpan(vertices, QUAD_VERTICES));
+}
 
-	vertices.push_back(Vertex(glm::vec3(p1), glm::vec3(n), color, glm::vec2(0, 0)));
-	vertices.push_back(Vertex(glm::vec3(p3), glm::vec3(n), color, glm::vec2(1, 1)));
-	vertices.push_back(Vertex(glm::vec3(p4), glm::vec3(n), color, glm::vec2(0, 1), 1));
+void drawTrapezoid(float w1, float w2, float h, const glm::vec4& color, const Rigid2D& xf, std::vector<Vertex>& vertices) {
+	emitTrapezoid(w1, w2, h, color, xf, appendSpan(vertices, QUAD_VERTICES));
 }
 
 void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, std::vector<Vertex>& vertices) {
-	glm::vec3 p1(points.back());
-	glm::vec3 p2(points[0]);
-
-	glm::vec3 normal;
-	bool normal_computed = false;
-
-	for (int i = 0; i < points.size() - 2; ++i) {
-		glm::vec3 p3(points[i + 1]);
-
-		if (!normal_computed) {
-			normal = glm::normalize(glm::cross(p2 - p1, p3 - p1));
-			normal_computed = true;
-		}
-
-		vertices.push_back(Vertex(glm::vec3(p1), normal, color));
-		if (i < points.size() - 3) {
-			vertices.push_back(Vertex(glm::vec3(p2), normal, color, 1));
-		}
-		else {
-			vertices.push_back(Vertex(glm::vec3(p2), normal, color));
-		}
-		if (i > 0) {
-			vertices.push_back(Vertex(glm::vec3(p3), normal, color, 1));
-		}
-		else {
-			vertices.push_back(Vertex(glm::vec3(p3), normal, color));
-		}
-
-		p2 = p3;
-	}
+	if (points.size() < 3) return;
+	emitPolygon(points.data(), points.size(), color, appendSpan(vertices, polygonVertexCount(points.size())));
 }
 
 void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const std::vector<glm::vec2>& texCoords, const glm::mat4& mat, std::vector<Vertex>& vertices) {
@@ -1065,45 +1230,136 @@ void drawAxes(float radius, float length, const glm::mat4& mat, std::vector<Vert
 	drawArrow(radius, length, glm::vec4(0, 0, 1, 1), mat, vertices);
 }
 
-void drawTube(std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, int slices) {
-	if (points.size() <= 1) return;
+namespace {
+
+std::mutex circleTableMutex;
+std::map<int, std::vector<glm::vec2> > circleTables;
+
+/**
+ * 円周をslices等分した各点の (cos(theta), -sin(theta)) を返す。
+ * テーブルはslicesごとに一度だけ計算し、以降は使い回す。
+ */
+const std::vector<glm::vec2>& circleTable(int slices) {
+	std::lock_guard<std::mutex> lock(circleTableMutex);
+
+	std::vector<glm::vec2>& table = circleTables[slices];
+	if (table.empty()) {
+		table.resize(slices);
+		for (int k = 0; k < slices; ++k) {
+			float theta = (float)k / slices * M_PI * 2.0f;
+			table[k] = glm::vec2(cosf(theta), -sinf(theta));
+		}
+	}
+
+	return table;
+}
 
-	glm::mat4 modelMat1, modelMat2;
-	glm::vec3 x_dir, y_dir, z_dir, x_dir2, y_dir2, z_dir2;
-	std::vector<glm::vec3> circle_points(slices);
-	std::vector<glm::vec3> circle_normals(slices);
+/**
+ * 末尾にn個追加できるよう、容量が足りなければ倍々で確保する。
+ * 少しずつ追加する呼び出しが続いても、再確保の回数が増えないようにする。
+ */
+template<typename T>
+void reserveAppend(std::vector<T>& values, size_t n) {
+	if (values.capacity() < values.size() + n) {
+		values.reserve((std::max)(values.size() + n, values.capacity() * 2));
+	}
+}
+
+/**
+ * 頂点の重複を除くためのhash。全ての属性のbit列が一致する頂点だけを同じ頂点とみなす。
+ */
+struct VertexBitsHash {
+	size_t operator()(const Vertex& v) const {
+		// FNV-1a
+		const unsigned char* p = (const unsigned char*)&v;
+		size_t h = 2166136261u;
+		for (int i = 0; i < sizeof(Vertex); ++i) {
+			h = (h ^ p[i]) * 16777619u;
+		}
+		return h;
+	}
+};
 
-	{
+struct VertexBitsEqual {
+	bool operator()(const Vertex& a, const Vertex& b) const {
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+/**
+ * draw*で作った三角形の頂点を、drawEdgeを0にしてから重複を除いて追加する。
+ * drawEdgeは三角形の角ごとの値なので、残すと隣り合う三角形で頂点を共有できない。
+ */
+void appendIndexed(std::vector<Vertex>& soup, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	for (int i = 0; i < soup.size(); ++i) {
+		soup[i].drawEdge = 0.0f;
+	}
+	indexVertices(soup, vertices, indices);
+}
+
+/**
+ * drawTubeの各断面（円周上の頂点と法線）を、根元から順に計算する。
+ * 直前の断面と現在の断面だけを保持し、バッファは使い回す。
+ */
+class TubeRings {
+private:
+	const std::vector<glm::vec3>& points;
+	float radius;
+	const std::vector<glm::vec2>& table;
+	glm::vec3 origin;	// 現在の円筒形のローカル座標系
+	glm::vec3 x_dir, y_dir, z_dir;
+	std::vector<glm::vec3> ringPoints[2];
+	std::vector<glm::vec3> ringNormals[2];
+	int current;
+
+public:
+	TubeRings(const std::vector<glm::vec3>& points, float radius, int slices) : points(points), radius(radius), table(circleTable(slices)), current(0) {
+		for (int i = 0; i < 2; ++i) {
+			ringPoints[i].resize(slices);
+			ringNormals[i].resize(slices);
+		}
+	}
+
+	const std::vector<glm::vec3>& previousPoints() const { return ringPoints[current ^ 1]; }
+	const std::vector<glm::vec3>& previousNormals() const { return ringNormals[current ^ 1]; }
+	const std::vector<glm::vec3>& currentPoints() const { return ringPoints[current]; }
+	const std::vector<glm::vec3>& currentNormals() const { return ringNormals[current]; }
+
+	/**
+	 * 最初の円筒形の、根元の断面を計算する。
+	 */
+	void first() {
 		// 最初の円筒形の、ローカル座標系を計算
-		modelMat1 = glm::translate(modelMat1, glm::vec3(points[0]));
+		origin = points[0];
 		y_dir = glm::normalize(points[1] - points[0]);
-		z_dir = glm::normalize(glm::cross(points[2] - points[1], y_dir));
+		glm::vec3 z = points.size() >= 3 ? glm::cross(points[2] - points[1], y_dir) : glm::vec3();
+		if (glm::length(z) < 1e-6f) {
+			// 曲がっていなければ、y_dirに垂直な適当な方向にする
+			z = glm::cross(fabs(y_dir.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0), y_dir);
+		}
+		z_dir = glm::normalize(z);
 		x_dir = glm::normalize(glm::cross(y_dir, z_dir));
 		z_dir = glm::normalize(glm::cross(x_dir, y_dir));
 
-		// ローカル座標系への変換行列を計算		
-		modelMat1[0].x = x_dir.x; modelMat1[0].y = x_dir.y; modelMat1[0].z = x_dir.z;
-		modelMat1[1].x = y_dir.x; modelMat1[1].y = y_dir.y; modelMat1[1].z = y_dir.z;
-		modelMat1[2].x = z_dir.x; modelMat1[2].y = z_dir.y; modelMat1[2].z = z_dir.z;
-	}
-
-	// 円周の頂点座標を計算
-	for (int k = 0; k < slices; ++k) {
-		float theta = (float)k / slices * M_PI * 2.0f;
-
-		glm::vec4 p(cosf(theta) * radius, 0, -sinf(theta) * radius, 1);
-		glm::vec4 n(cosf(theta), 0, -sinf(theta), 0);
-		p = modelMat1 * p;
-		n = modelMat1 * n;
-		circle_points[k] = glm::vec3(p);
-		circle_normals[k] = glm::vec3(n);
+		// 円周の頂点座標を計算
+		for (int k = 0; k < table.size(); ++k) {
+			glm::vec3 n = x_dir * table[k].x + z_dir * table[k].y;
+			ringNormals[current][k] = n;
+			ringPoints[current][k] = origin + n * radius;
+		}
 	}
 
-	for (int i = 0; i < points.size() - 1; ++i) {
-		modelMat2 = glm::translate(glm::mat4(), glm::vec3(points[i + 1]));
+	/**
+	 * i番目の円筒形の上端 (points[i + 1]) の断面を計算する。前の断面はprevious*()で参照できる。
+	 * 断面は、i番目とi+1番目の円筒形の円周を平均した向きにする。
+	 */
+	void next(int i) {
+		glm::vec3 dir = points[i + 1] - points[i];
+		glm::vec3 origin2, x_dir2, y_dir2, z_dir2;
 
 		if (i < points.size() - 2) {
-			// この円筒形の、ローカル座標系を計算
+			// 次の円筒形の、ローカル座標系を計算
+			origin2 = points[i + 1];
 			y_dir2 = glm::normalize(points[i + 2] - points[i + 1]);
 			if (i < points.size() - 3) {
 				z_dir2 = glm::normalize(glm::cross(y_dir2, points[i + 1] - points[i]));
@@ -1115,49 +1371,108 @@ void drawTube(std::vector<glm::vec3>& points, float radius, const glm::vec4& col
 			}
 			x_dir2 = glm::normalize(glm::cross(y_dir2, z_dir2));
 			z_dir2 = glm::normalize(glm::cross(x_dir2, y_dir2));
-
-			// ローカル座標系への変換行列を計算		
-			modelMat2[0].x = x_dir2.x; modelMat2[0].y = x_dir2.y; modelMat2[0].z = x_dir2.z;
-			modelMat2[1].x = y_dir2.x; modelMat2[1].y = y_dir2.y; modelMat2[1].z = y_dir2.z;
-			modelMat2[2].x = z_dir2.x; modelMat2[2].y = z_dir2.y; modelMat2[2].z = z_dir2.z;
 		} else {
-			modelMat2 = glm::translate(glm::mat4(), points[i + 1] - points[i]) * modelMat1;
-			//modelMat2 = glm::translate(modelMat1, points[i + 1] - points[i]);
+			// 最後の円筒形は、同じ向きのまま平行移動する
+			origin2 = origin + dir;
+			x_dir2 = x_dir;
+			y_dir2 = y_dir;
+			z_dir2 = z_dir;
+		}
+
+		current ^= 1;
+		for (int k = 0; k < table.size(); ++k) {
+			glm::vec3 p1 = origin + dir + (x_dir * table[k].x + z_dir * table[k].y) * radius;
+			glm::vec3 p2 = origin2 + (x_dir2 * table[k].x + z_dir2 * table[k].y) * radius;
+			glm::vec3 pp = (p1 + p2) * 0.5f;
+
+			ringNormals[current][k] = glm::normalize(pp - points[i + 1]);
+			ringPoints[current][k] = ringNormals[current][k] * radius + points[i + 1];
 		}
 
+		origin = origin2;
+		x_dir = x_dir2; y_dir = y_dir2; z_dir = z_dir2;
+	}
+};
+
+}
+
+/**
+ * 折れ線pointsに沿って、半径radiusのチューブを描画する。
+ * 各円筒形を6頂点x slicesの三角形として出力する（頂点は共有しない）。
+ */
+void drawTube(const std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, int slices) {
+	if (points.size() <= 1) return;
 
-		float h = glm::length(points[i + 1] - points[i]);
-		std::vector<glm::vec3> circle_points2(slices);
-		std::vector<glm::vec3> circle_normals2(slices);
+	reserveAppend(vertices, (points.size() - 1) * slices * 6);
 
+	TubeRings rings(points, radius, slices);
+	rings.first();
+	for (int i = 0; i < points.size() - 1; ++i) {
+		rings.next(i);
+
+		const std::vector<glm::vec3>& circle_points = rings.previousPoints();
+		const std::vector<glm::vec3>& circle_normals = rings.previousNormals();
+		const std::vector<glm::vec3>& circle_points2 = rings.currentPoints();
+		const std::vector<glm::vec3>& circle_normals2 = rings.currentNormals();
 		for (int k = 0; k < slices; ++k) {
-			float theta = (float)k / slices * M_PI * 2.0f;
+			int k2 = k + 1 < slices ? k + 1 : 0;
 
-			glm::vec4 p(cosf(theta) * radius, 0, -sinf(theta) * radius, 1);
+			vertices.push_back(Vertex(circle_points[k], circle_normals[k], color));
+			vertices.push_back(Vertex(circle_points[k2], circle_normals[k2], color, 1));
+			vertices.push_back(Vertex(circle_points2[k2], circle_normals2[k2], color));
 
-			glm::vec3 p1 = glm::vec3(modelMat1 * p) + points[i + 1] - points[i];
-			glm::vec3 p2 = glm::vec3(modelMat2 * p);
-			glm::vec3 pp = (p1 + p2) * 0.5f;
-			
-			circle_normals2[k] = glm::normalize(pp - points[i + 1]);
-			circle_points2[k] = circle_normals2[k] * radius + points[i + 1];
+			vertices.push_back(Vertex(circle_points[k], circle_normals[k], color));
+			vertices.push_back(Vertex(circle_points2[k2], circle_normals2[k2], color));
+			vertices.push_back(Vertex(circle_points2[k], circle_normals2[k], color, 1));
 		}
+	}
+}
 
-		for (int k = 0; k < slices; ++k) {
-			vertices.push_back(Vertex(glm::vec3(circle_points[k]), glm::vec3(circle_normals[k]), color));
-			vertices.push_back(Vertex(glm::vec3(circle_points[(k+1)%slices]), glm::vec3(circle_normals[(k+1)%slices]), color, 1));
-			vertices.push_back(Vertex(glm::vec3(circle_points2[(k+1)%slices]), glm::vec3(circle_normals2[(k+1)%slices]), color));
+/**
+ * 折れ線pointsに沿って、半径radiusのチューブを、インデックス付きの三角形として描画する。
+ * 各断面のslices個の頂点を隣り合う円筒形で共有するので、頂点数は (points.size() x slices) になる。
+ * 頂点を共有するため、drawEdgeは全て0になる。
+ *
+ * @param points			折れ線
+ * @param radius			半径
+ * @param color				色
+ * @param vertices [OUT]	頂点 (末尾に追加される)
+ * @param indices [OUT]		三角形の頂点のインデックス (末尾に追加される。verticesの先頭からの番号)
+ * @param slices			円周の分割数
+ */
+void drawTube(const std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices) {
+	if (points.size() <= 1) return;
+
+	unsigned int base = vertices.size();
+	reserveAppend(vertices, points.size() * slices);
+	reserveAppend(indices, (points.size() - 1) * slices * 6);
 
-			vertices.push_back(Vertex(glm::vec3(circle_points[k]), glm::vec3(circle_normals[k]), color));
-			vertices.push_back(Vertex(glm::vec3(circle_points2[(k+1)%slices]), glm::vec3(circle_normals2[(k+1)%slices]), color));
-			vertices.push_back(Vertex(glm::vec3(circle_points2[k]), glm::vec3(circle_normals2[k]), color, 1));
+	TubeRings rings(points, radius, slices);
+	rings.first();
+	for (int i = 0; ; ++i) {
+		const std::vector<glm::vec3>& circle_points = rings.currentPoints();
+		const std::vector<glm::vec3>& circle_normals = rings.currentNormals();
+		for (int k = 0; k < slices; ++k) {
+			vertices.push_back(Vertex(circle_points[k], circle_normals[k], color));
 		}
 
+		if (i >= points.size() - 1) break;
+		rings.next(i);
 
-		modelMat1 = modelMat2;
-		circle_points = circle_points2;
-		circle_normals = circle_normals2;
-		x_dir = x_dir2; y_dir = y_dir2; z_dir = z_dir2;
+		// i番目の断面とi+1番目の断面の間の四角形
+		unsigned int ring1 = base + i * slices;
+		unsigned int ring2 = ring1 + slices;
+		for (int k = 0; k < slices; ++k) {
+			int k2 = k + 1 < slices ? k + 1 : 0;
+
+			indices.push_back(ring1 + k);
+			indices.push_back(ring1 + k2);
+			indices.push_back(ring2 + k2);
+
+			indices.push_back(ring1 + k);
+			indices.push_back(ring2 + k2);
+			indices.push_back(ring2 + k);
+		}
 	}
 }
 
@@ -1182,6 +1497,93 @@ void drawCurvilinearMesh(int numX, int numY, std::vector<glm::vec3>& points, con
 	}
 }
 
+/**
+ * 三角形の頂点の列 (3頂点ずつ1つの三角形) から、重複する頂点を1つにまとめて、頂点とインデックスを追加する。
+ * 全ての属性が (bit単位で) 一致する頂点だけをまとめるので、描画結果は元の三角形と同じになる。
+ * 重複を調べるのは1回の呼び出しで渡された頂点の中だけで、既にverticesにある頂点とはまとめない。
+ *
+ * @param soup				三角形の頂点の列
+ * @param vertices [OUT]	頂点 (末尾に追加される)
+ * @param indices [OUT]		三角形の頂点のインデックス (末尾に追加される。verticesの先頭からの番号)
+ */
+void indexVertices(const std::vector<Vertex>& soup, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	unsigned int base = vertices.size();
+	reserveAppend(indices, soup.size());
+
+	std::unordered_map<Vertex, unsigned int, VertexBitsHash, VertexBitsEqual> unique(soup.size());
+	for (int i = 0; i < soup.size(); ++i) {
+		// まだない頂点なら、次の番号を割り当てて追加する
+		auto result = unique.insert(std::make_pair(soup[i], base + (unsigned int)unique.size()));
+		if (result.second) {
+			vertices.push_back(soup[i]);
+		}
+		indices.push_back(result.first->second);
+	}
+}
+
+// 以下のdraw*は、インデックス付きの三角形として描画する版。
+// 形状は対応するdraw*と同じで、重複する頂点を共有する。頂点を共有するため、drawEdgeは全て0になる。
+
+void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	if (points.size() < 3) return;
+
+	std::vector<Vertex> soup;
+	soup.reserve((points.size() - 2) * 3);
+	drawPolygon(points, color, mat, soup);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const std::vector<glm::vec2>& texCoords, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	if (points.size() < 3) return;
+
+	std::vector<Vertex> soup;
+	soup.reserve((points.size() - 2) * 3);
+	drawPolygon(points, color, texCoords, mat, soup);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawBox(float length_x, float length_y, float length_z, glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	std::vector<Vertex> soup;
+	soup.reserve(36);
+	drawBox(length_x, length_y, length_z, color, mat, soup);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawSphere(float radius, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	std::vector<Vertex> soup;
+	soup.reserve(12 * 6 * 6);
+	drawSphere(radius, color, mat, soup);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawCylinderX(float radius1, float radius2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices) {
+	std::vector<Vertex> soup;
+	soup.reserve(slices * 6);
+	drawCylinderX(radius1, radius2, h, color, mat, soup, slices);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawCylinderY(float radius1, float radius2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices) {
+	std::vector<Vertex> soup;
+	soup.reserve(slices * 6);
+	drawCylinderY(radius1, radius2, h, color, mat, soup, slices);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawCylinderZ(float radius1, float radius2, float radius3, float radius4, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices) {
+	std::vector<Vertex> soup;
+	soup.reserve(slices * 6);
+	drawCylinderZ(radius1, radius2, radius3, radius4, h, color, mat, soup, slices);
+	appendIndexed(soup, vertices, indices);
+}
+
+void drawCurvilinearMesh(int numX, int numY, std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	std::vector<Vertex> soup;
+	soup.reserve((numX - 1) * (numY - 1) * 6);
+	drawCurvilinearMesh(numX, numY, points, color, mat, soup);
+	appendIndexed(soup, vertices, indices);
+}
+
 float deg2rad(float degree) {
 	return degree * M_PI / 180.0;
 }
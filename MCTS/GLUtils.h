@@ -56,6 +56,52 @@ public:
 	Face rotate(float rad, const glm::vec3& axis);
 };
 
+/**
+ * z=0平面内の回転と平行移動。MCTSやPMTree2Dの枝の座標系は常にこの形なので、glm::mat4の代わりに使うと
+ * 4x4行列の積と法線の変換 (常に+Z) を省ける。
+ */
+struct Rigid2D {
+	float c;		// cos(回転角)
+	float s;		// sin(回転角)
+	glm::vec2 t;	// 平行移動
+
+	Rigid2D() : c(1.0f), s(0.0f) {}
+	Rigid2D(float angle, const glm::vec2& t) : c(cosf(angle)), s(sinf(angle)), t(t) {}
+
+	glm::vec2 apply(float x, float y) const { return glm::vec2(c * x - s * y + t.x, s * x + c * y + t.y); }
+	/** glm::rotate(mat, angle, (0, 0, 1)) に相当する */
+	Rigid2D rotate(float angle) const {
+		Rigid2D r(angle, t);
+		float c2 = c * r.c - s * r.s;
+		r.s = s * r.c + c * r.s;
+		r.c = c2;
+		return r;
+	}
+	/** glm::translate(mat, (x, y, 0)) に相当する */
+	Rigid2D translate(float x, float y) const { Rigid2D r = *this; r.t = apply(x, y); return r; }
+	glm::mat4 toMat4() const;
+};
+
+/**
+ * emitQuads2Dでまとめて書き込む、z=0平面内の四角形の列。
+ * SIMDで4つずつ処理できるよう、要素ごとの配列で持つ。
+ */
+class Quads2D {
+public:
+	std::vector<float> c;	// 四角形の中心の座標系 (Rigid2D)
+	std::vector<float> s;
+	std::vector<float> tx;
+	std::vector<float> ty;
+	std::vector<float> w;
+	std::vector<float> h;
+	std::vector<glm::vec4> color;
+
+public:
+	int size() const { return c.size(); }
+	void clear();
+	void push_back(const Rigid2D& xf, float w, float h, const glm::vec4& color);
+};
+
 // geometry computation
 bool isWithinPolygon(const glm::vec2& p, const std::vector<glm::vec2>& points);
 float area(const std::vector<glm::vec2>& points);
@@ -67,12 +113,27 @@ glm::vec3 rayPlaneIntersection(const glm::vec3& a, const glm::vec3& v, const glm
 bool rayTriangleIntersection(const glm::vec3& a, const glm::vec3& v, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, glm::vec3& intPt);
 glm::vec2 barycentricCoordinates(const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, const glm::vec2& p);
 
+// mesh emitters (呼び出し側で確保した領域に、頂点を書き込んで次の位置を返す)
+const int QUAD_VERTICES = 6;
+inline int polygonVertexCount(int numPoints) { return numPoints >= 3 ? (numPoints - 2) * 3 : 0; }
+Vertex* appendSpan(std::vector<Vertex>& vertices, int n);
+Vertex* emitQuad(float w, float h, const glm::vec4& color, const glm::mat4& mat, Vertex* out);
+Vertex* emitTrapezoid(float w1, float w2, float h, const glm::vec4& color, const glm::mat4& mat, Vertex* out);
+Vertex* emitQuad(float w, float h, const glm::vec4& color, const Rigid2D& xf, Vertex* out);
+Vertex* emitTrapezoid(float w1, float w2, float h, const glm::vec4& color, const Rigid2D& xf, Vertex* out);
+void emitQuads2D(const Quads2D& quads, Vertex* out);
+Vertex* emitPolygon(const glm::vec3* points, int numPoints, const glm::vec4& color, Vertex* out);
+template<int N>
+Vertex* emitPolygon(const glm::vec3 (&points)[N], const glm::vec4& color, Vertex* out) { return emitPolygon(points, N, color, out); }
+
 // mesh generation
 void drawCircle(float r1, float r2, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, int slices = 12);
 void drawCircle(float r1, float r2, float texWidth, float texHeight, const glm::mat4& mat, std::vector<Vertex>& vertices, int slices = 12);
 void drawQuad(float w, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices);
 void drawQuad(float w, float h, const glm::vec2& t1, const glm::vec2& t2, const glm::vec2& t3, const glm::vec2& t4, const glm::mat4& mat, std::vector<Vertex>& vertices);
+void drawQuad(float w, float h, const glm::vec4& color, const Rigid2D& xf, std::vector<Vertex>& vertices);
 void drawTrapezoid(float w1, float w2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices);
+void drawTrapezoid(float w1, float w2, float h, const glm::vec4& color, const Rigid2D& xf, std::vector<Vertex>& vertices);
 void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, std::vector<Vertex>& vertices);
 void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const std::vector<glm::vec2>& texCoords, const glm::mat4& mat, std::vector<Vertex>& vertices);
 void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices);
@@ -89,9 +150,21 @@ void drawCylinderY(float radius1, float radius2, float h, const glm::vec4& color
 void drawCylinderZ(float radius1, float radius2, float radius3, float radius4, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, int slices = 12);
 void drawArrow(float radius, float length, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices);
 void drawAxes(float radius, float length, const glm::mat4& mat, std::vector<Vertex>& vertices);
-void drawTube(std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, int slices = 12);
+void drawTube(const std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, int slices = 12);
+void drawTube(const std::vector<glm::vec3>& points, float radius, const glm::vec4& color, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices = 12);
 void drawCurvilinearMesh(int numX, int numY, std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices);
 
+// indexed mesh generation (頂点を共有して、verticesとindicesの末尾に追加する)
+void indexVertices(const std::vector<Vertex>& soup, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+void drawPolygon(const std::vector<glm::vec3>& points, const glm::vec4& color, const std::vector<glm::vec2>& texCoords, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+void drawBox(float length_x, float length_y, float length_z, glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+void drawSphere(float radius, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+void drawCylinderX(float radius1, float radius2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices = 12);
+void drawCylinderY(float radius1, float radius2, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices = 12);
+void drawCylinderZ(float radius1, float radius2, float radius3, float radius4, float h, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, int slices = 12);
+void drawCurvilinearMesh(int numX, int numY, std::vector<glm::vec3>& points, const glm::vec4& color, const glm::mat4& mat, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
 float deg2rad(float degree);
 
 }
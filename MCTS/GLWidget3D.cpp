@@ -11,14 +11,17 @@
 #include <QMessageBox>
 #include <QTextStream>
 #include "MCTS.h"
+#include "MCTSWorker.h"
+#include "TrainingDataPipeline.h"
 #include "GLUtils.h"
-#include <time.h>
+#include <QStatusBar>
 
 GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuffers), (QWidget*)mainWin) {
 	this->mainWin = mainWin;
 	ctrlPressed = false;
 	shiftPressed = false;
 	altPressed = false;
+	mctsWorker = NULL;
 
 	// This is necessary to prevent the screen overdrawn by OpenGL
 	setAutoFillBackground(false);
@@ -34,10 +37,28 @@ GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuf
 	light_mvpMatrix = light_pMatrix * light_mvMatrix;
 }
 
-void GLWidget3D::render() {
+GLWidget3D::~GLWidget3D() {
+	// 探索中なら、キャンセルして終了を待つ
+	delete mctsWorker;
+}
+
+/**
+ * Render the scene.
+ *
+ * @param shadow		falseなら、shadow mapの更新・参照を行わない
+ */
+void GLWidget3D::render(bool shadow) {
+	// geometryが変更されていれば、shadow mapを更新
+	if (shadow) {
+		renderManager.updateShadowMap(light_dir, light_mvpMatrix);
+	}
+
+	// 行列と光源方向は、全passで共有するuniform bufferに一度だけ転送する
+	renderManager.updateFrameUniforms(camera.mvpMatrix, camera.pMatrix, light_mvpMatrix, light_dir);
+
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// PASS 1: Render to texture
-	glUseProgram(renderManager.programs["pass1"]);
+	glUseProgram(renderManager.pass1Program.id);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, renderManager.fragDataFB);
 	glClearColor(0.95, 0.95, 0.95, 1);
@@ -58,22 +79,17 @@ void GLWidget3D::render() {
 		exit(0);
 	}
 
-	glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["pass1"], "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
-	glUniform3f(glGetUniformLocation(renderManager.programs["pass1"], "lightDir"), light_dir.x, light_dir.y, light_dir.z);
-	glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["pass1"], "light_mvpMatrix"), 1, false, &light_mvpMatrix[0][0]);
-
-	glUniform1i(glGetUniformLocation(renderManager.programs["pass1"], "shadowMap"), 6);
 	glActiveTexture(GL_TEXTURE6);
 	glBindTexture(GL_TEXTURE_2D, renderManager.shadow.textureDepth);
 
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
-	drawScene();
+	drawScene(shadow);
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	// PASS 2: Create AO
 	if (renderManager.renderingMode == RenderManager::RENDERING_MODE_SSAO) {
-		glUseProgram(renderManager.programs["ssao"]);
+		glUseProgram(renderManager.ssaoProgram.id);
 		glBindFramebuffer(GL_FRAMEBUFFER, renderManager.fragDataFB_AO);
 
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderManager.fragAOTex, 0);
@@ -93,42 +109,32 @@ void GLWidget3D::render() {
 		glDisable(GL_DEPTH_TEST);
 		glDepthFunc(GL_ALWAYS);
 
-		glUniform2f(glGetUniformLocation(renderManager.programs["ssao"], "pixelSize"), 2.0f / this->width(), 2.0f / this->height());
+		glUniform2f(renderManager.ssaoProgram.pixelSize, 2.0f / this->width(), 2.0f / this->height());
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex0"), 1);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex1"), 2);
 		glActiveTexture(GL_TEXTURE2);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex2"), 3);
 		glActiveTexture(GL_TEXTURE3);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "depthTex"), 8);
 		glActiveTexture(GL_TEXTURE8);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "noiseTex"), 7);
 		glActiveTexture(GL_TEXTURE7);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragNoiseTex);
 
-		{
-			glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["ssao"], "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
-			glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["ssao"], "pMatrix"), 1, false, &camera.pMatrix[0][0]);
-		}
+		// カーネルはuniform buffer (SsaoKernel) に転送済み
+		glUniform1i(renderManager.ssaoProgram.uKernelSize, renderManager.uKernelOffsets.size());
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "uKernelSize"), renderManager.uKernelSize);
-		glUniform3fv(glGetUniformLocation(renderManager.programs["ssao"], "uKernelOffsets"), renderManager.uKernelOffsets.size(), (const GLfloat*)renderManager.uKernelOffsets.data());
-
-		glUniform1f(glGetUniformLocation(renderManager.programs["ssao"], "uPower"), renderManager.uPower);
-		glUniform1f(glGetUniformLocation(renderManager.programs["ssao"], "uRadius"), renderManager.uRadius);
+		glUniform1f(renderManager.ssaoProgram.uPower, renderManager.uPower);
+		glUniform1f(renderManager.ssaoProgram.uRadius, renderManager.uRadius);
 
 		glBindVertexArray(renderManager.secondPassVAO);
 
@@ -137,7 +143,7 @@ void GLWidget3D::render() {
 		glDepthFunc(GL_LEQUAL);
 	}
 	else if (renderManager.renderingMode == RenderManager::RENDERING_MODE_LINE || renderManager.renderingMode == RenderManager::RENDERING_MODE_HATCHING) {
-		glUseProgram(renderManager.programs["line"]);
+		glUseProgram(renderManager.lineProgram.id);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glClearColor(1, 1, 1, 1);
@@ -146,40 +152,33 @@ void GLWidget3D::render() {
 		glDisable(GL_DEPTH_TEST);
 		glDepthFunc(GL_ALWAYS);
 
-		glUniform2f(glGetUniformLocation(renderManager.programs["line"], "pixelSize"), 1.0f / this->width(), 1.0f / this->height());
-		glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["line"], "pMatrix"), 1, false, &camera.pMatrix[0][0]);
+		glUniform2f(renderManager.lineProgram.pixelSize, 1.0f / this->width(), 1.0f / this->height());
 		if (renderManager.renderingMode == RenderManager::RENDERING_MODE_LINE) {
-			glUniform1i(glGetUniformLocation(renderManager.programs["line"], "useHatching"), 0);
+			glUniform1i(renderManager.lineProgram.useHatching, 0);
 		}
 		else {
-			glUniform1i(glGetUniformLocation(renderManager.programs["line"], "useHatching"), 1);
+			glUniform1i(renderManager.lineProgram.useHatching, 1);
 		}
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex0"), 1);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex1"), 2);
 		glActiveTexture(GL_TEXTURE2);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex2"), 3);
 		glActiveTexture(GL_TEXTURE3);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex3"), 4);
 		glActiveTexture(GL_TEXTURE4);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[3]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "depthTex"), 8);
 		glActiveTexture(GL_TEXTURE8);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "hatchingTexture"), 5);
 		glActiveTexture(GL_TEXTURE5);
 		glBindTexture(GL_TEXTURE_3D, renderManager.hatchingTextures);
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -207,39 +206,33 @@ void GLWidget3D::render() {
 		glDisable(GL_DEPTH_TEST);
 		glDepthFunc(GL_ALWAYS);
 
-		glUseProgram(renderManager.programs["blur"]);
-		glUniform2f(glGetUniformLocation(renderManager.programs["blur"], "pixelSize"), 2.0f / this->width(), 2.0f / this->height());
-		//printf("pixelSize loc %d\n", glGetUniformLocation(vboRenderManager.programs["blur"], "pixelSize"));
+		glUseProgram(renderManager.blurProgram.id);
+		glUniform2f(renderManager.blurProgram.pixelSize, 2.0f / this->width(), 2.0f / this->height());
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex0"), 1);//COLOR
-		glActiveTexture(GL_TEXTURE1);
+		glActiveTexture(GL_TEXTURE1);//COLOR
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex1"), 2);//NORMAL
-		glActiveTexture(GL_TEXTURE2);
+		glActiveTexture(GL_TEXTURE2);//NORMAL
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
 
-		/*glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex2"), 3);
-		glActiveTexture(GL_TEXTURE3);
+		/*glActiveTexture(GL_TEXTURE3);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);*/
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "depthTex"), 8);
 		glActiveTexture(GL_TEXTURE8);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
 
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex3"), 4);//AO
-		glActiveTexture(GL_TEXTURE4);
+		glActiveTexture(GL_TEXTURE4);//AO
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, renderManager.fragAOTex);
 
 		if (renderManager.renderingMode == RenderManager::RENDERING_MODE_SSAO) {
-			glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "ssao_used"), 1); // ssao used
+			glUniform1i(renderManager.blurProgram.ssao_used, 1); // ssao used
 		}
 		else {
-			glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "ssao_used"), 0); // no ssao
+			glUniform1i(renderManager.blurProgram.ssao_used, 0); // no ssao
 		}
 
 		glBindVertexArray(renderManager.secondPassVAO);
@@ -258,13 +251,13 @@ void GLWidget3D::render() {
 /**
 * Draw the scene.
 */
-void GLWidget3D::drawScene() {
+void GLWidget3D::drawScene(bool shadow) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
 	glDepthMask(true);
 
-	renderManager.renderAll();
+	renderManager.renderAll(shadow);
 }
 
 void GLWidget3D::clearImage() {
@@ -300,24 +293,96 @@ void GLWidget3D::drawLine(const QPoint& startPoint, const QPoint& endPoint) {
 	painter.drawLine(pt1, pt2);
 }
 
+/**
+ * スケッチをターゲットとして、MCTSによるinverse proceduralを別スレッドで開始する。
+ * derivationが1ステップ進むたびに、その時点の結果を表示する。
+ * 探索中は、GUIはそのまま操作できる。既に探索中なら何もしない。
+ */
 void GLWidget3D::runMCTS() {
-	time_t start = clock();
+	if (mctsWorker != NULL) return;
 
 	QImage swapped = sketch.rgbSwapped();
 	cv::Mat sketchMat(swapped.height(), swapped.width(), CV_8UC3, const_cast<uchar*>(swapped.bits()), swapped.bytesPerLine());
 
-	mcts::MCTS mcts(sketchMat, this);
-	mcts.inverse(10, 100);
+	mctsWorker = new MCTSWorker(sketchMat, camera.mvpMatrix, 10, 100);
+
+	// シグナルはworkerスレッドから送られるので、queued connectionでこのwidgetのスレッドで処理される
+	connect(mctsWorker, &MCTSWorker::progress, this, [this](int step, const mcts::DerivationTree& derivationTree) {
+		showDerivationTree(derivationTree);
+		mainWin->statusBar()->showMessage(QString("MCTS: step %1 done").arg(step + 1));
+	});
+	connect(mctsWorker, &MCTSWorker::finished, this, [this](const mcts::DerivationTree& derivationTree, bool cancelled) {
+		showDerivationTree(derivationTree);
+		mainWin->statusBar()->showMessage(cancelled ? "MCTS: cancelled" : "MCTS: finished");
+
+		if (mctsWorker != NULL) {
+			mctsWorker->deleteLater();
+			mctsWorker = NULL;
+		}
+	});
+
+	if (!mctsWorker->start()) {
+		delete mctsWorker;
+		mctsWorker = NULL;
+		QMessageBox::warning(this, "MCTS", "Failed to create an OpenGL context for the evaluation.");
+		return;
+	}
 
-	time_t end = clock();
-	std::cout << "Elapsed time: " << (double)(end - start) / CLOCKS_PER_SEC << "sec" << std::endl;
+	mainWin->statusBar()->showMessage("MCTS: running...");
+}
+
+/**
+ * 探索中なら、キャンセルを要求する。
+ * 探索は現在のiterationを終えたところで止まり、その時点の結果が表示される。
+ */
+void GLWidget3D::stopMCTS() {
+	if (mctsWorker == NULL) return;
+
+	mctsWorker->cancel();
+}
+
+/**
+ * derivation treeのジオメトリを生成して表示する。
+ */
+void GLWidget3D::showDerivationTree(const mcts::DerivationTree& derivationTree) {
+	if (derivationTree.root == NULL) return;
+
+	makeCurrent();
+	renderManager.removeObjects();
+	std::vector<Vertex> vertices;
+	mcts::MCTS::generateGeometry(&renderManager, glm::mat4(), derivationTree.root, vertices);
+	renderManager.addObject("tree", "", vertices, true, VertexLayout::FORMAT_COMPACT);
+	update();
+}
+
+/**
+ * PMTree2Dのランダムな木から学習データを生成し、training_data/にシャードファイルとして書き出す。
+ * 木の生成・描画・パッチの切り出し・書き出しは、TrainingDataPipelineが別スレッドで並列に行う（全て書き出すまで戻らない）。
+ * 描画はこのウィジェットと同じサイズ、同じカメラの初期設定で行う。
+ */
+void GLWidget3D::generateTrainingData() {
+	TrainingDataPipeline::Options options;
+	options.numTrees = 10000;
+	options.width = width();
+	options.height = height();
+
+	TrainingDataPipeline pipeline(options);
+	if (!pipeline.run()) {
+		QMessageBox::warning(this, "Training data", "Failed to create an OpenGL context for rendering.");
+		return;
+	}
+
+	std::cout << pipeline.samples() << " samples (" << pipeline.bytes() / 1024 / 1024 << " MB) were written to " << pipeline.shards() << " shards in " << options.outDir;
+	if (pipeline.dropped() > 0) std::cout << " (" << pipeline.dropped() << " trees were dropped)";
+	std::cout << std::endl;
 }
 
 void GLWidget3D::randomGeneration() {
 	QImage swapped = sketch.rgbSwapped();
 	cv::Mat sketchMat(swapped.height(), swapped.width(), CV_8UC3, const_cast<uchar*>(swapped.bits()), swapped.bytesPerLine());
 
-	mcts::MCTS mcts(sketchMat, this);
+	mcts::MCTS mcts(sketchMat, &renderManager, camera.mvpMatrix);
+	mcts.setSeed(rand());
 	mcts.randomGeneration(&renderManager);
 	update();
 }
@@ -431,12 +496,10 @@ void GLWidget3D::initializeGL() {
 	glDisable(GL_TEXTURE_2D_ARRAY);
 
 	////////////////////////////////
-	renderManager.init(true, 8192);
+	renderManager.init(true);
 	renderManager.resize(this->width(), this->height());
 	renderManager.renderingMode = RenderManager::RENDERING_MODE_BASIC;
 
-	glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex0"), 0);//tex0: 0
-
 	sketch = QImage(this->width(), this->height(), QImage::Format_RGB888);
 	sketch.fill(qRgba(255, 255, 255, 255));
 
@@ -462,7 +525,6 @@ void GLWidget3D::resizeGL(int width, int height) {
 	glViewport(0, 0, (GLint)width, (GLint)height);
 	camera.updatePMatrix(width, height);
 	renderManager.resize(width, height);
-	renderManager.updateShadowMap(this, light_dir, light_mvpMatrix);
 
 	QImage newImage(width, height, QImage::Format_RGB888);
 	newImage.fill(qRgba(255, 255, 255, 255));
@@ -10,6 +10,11 @@
 #include <vector>
 
 class MainWindow;
+class MCTSWorker;
+
+namespace mcts {
+	class DerivationTree;
+}
 
 class GLWidget3D : public QGLWidget {
 public:
@@ -23,22 +28,26 @@ public:
 	bool ctrlPressed;
 	bool shiftPressed;
 	bool altPressed;
+	MCTSWorker* mctsWorker;
 
 public:
 	GLWidget3D(MainWindow *parent);
+	~GLWidget3D();
 	void generateTrainingData();
 	void generateTrainingDataTrunk();
 	void generateLocalTrainingData();
 	void generatePredictedData();
 	void generatePredictedDataTrunk();
-	void render();
-	void drawScene();
+	void render(bool shadow = true);
+	void drawScene(bool shadow = true);
 	void clearImage();
 	void loadImage(const QString& filename);
 	void saveImage(const QString& filename);
 	void save3DMesh(const QString& filename);
 	void drawLine(const QPoint& startPoint, const QPoint& endPoint);
 	void runMCTS();
+	void stopMCTS();
+	void showDerivationTree(const mcts::DerivationTree& derivationTree);
 	void randomGeneration();
 
 	void keyPressEvent(QKeyEvent* e);
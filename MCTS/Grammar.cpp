@@ -0,0 +1,379 @@
+#include "Grammar.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <cstdlib>
+
+namespace mcts {
+
+	const char* Grammar::DEFAULT_GRAMMAR = R"GRAMMAR(
+# 幹から枝を伸ばしていく木
+const MAX_LEVEL 3		# 枝分かれの最大レベル
+const MAX_DIST 20		# 根元からのセグメント数の最大値
+const BASE_PART 3		# 根元から何セグメントまでは枝分かれしないか
+
+symbol X segment
+symbol F segment
+symbol / rotate
+symbol \ rotate
+
+axiom X
+
+# 末端はストップ、根元は延伸のみ、中間部分は延伸または枝分かれ
+rule X when dist >= MAX_DIST-1 : F
+rule X when dist < MAX_DIST-1 : F [/ X]
+rule X when dist >= BASE_PART dist < MAX_DIST-1 level < MAX_LEVEL-1 : F [/ X] +[\ X]
+
+rule / angle -20
+rule / angle -10
+rule / angle 0
+rule / angle 10
+rule / angle 20
+
+rule \ angle -90
+rule \ angle -70
+rule \ angle -50
+rule \ angle -30
+rule \ angle 30
+rule \ angle 50
+rule \ angle 70
+rule \ angle 90
+)GRAMMAR";
+
+	namespace {
+
+		// 読み込み中の1つのrule (左辺ごとに並べ替えてから表に詰める)
+		struct ParsedRule {
+			int lhs;
+			Grammar::Rule rule;
+			std::vector<Grammar::Condition> conditions;
+			std::vector<Grammar::Branch> branches;
+			std::vector<int> branchSymbols;
+		};
+
+		/**
+		 * 1行をトークンに分ける。"[", "]", "+[" は空白がなくても1つのトークンにする。
+		 */
+		std::vector<std::string> tokenize(const std::string& line) {
+			std::vector<std::string> tokens;
+			std::string token;
+			for (int i = 0; i < line.size(); ++i) {
+				char c = line[i];
+				if (c == '#') break;
+
+				if (c == ' ' || c == '\t' || c == '\r' || c == '[' || c == ']' || (c == '+' && i + 1 < line.size() && line[i + 1] == '[')) {
+					if (!token.empty()) tokens.push_back(token);
+					token.clear();
+
+					if (c == '[' || c == ']') {
+						tokens.push_back(std::string(1, c));
+					}
+					else if (c == '+') {
+						tokens.push_back("+[");
+						i++;
+					}
+				}
+				else {
+					token += c;
+				}
+			}
+			if (!token.empty()) tokens.push_back(token);
+
+			return tokens;
+		}
+
+		bool parseInt(const std::string& str, int& value) {
+			if (str.empty()) return false;
+			char* end;
+			value = strtol(str.c_str(), &end, 10);
+			return *end == '\0';
+		}
+
+		/**
+		 * 整数、定数、または "定数-1" のような定数±整数を値にする。
+		 */
+		bool parseValue(const std::string& str, const std::map<std::string, int>& constants, int& value) {
+			if (parseInt(str, value)) return true;
+
+			size_t pos = str.find_last_of("+-");
+			std::string name = pos != std::string::npos && pos > 0 ? str.substr(0, pos) : str;
+			int offset = 0;
+			if (name.size() < str.size() && !parseInt(str.substr(pos), offset)) return false;
+
+			std::map<std::string, int>::const_iterator it = constants.find(name);
+			if (it == constants.end()) return false;
+
+			value = it->second + offset;
+			return true;
+		}
+
+	}
+
+	// 最初からデフォルトのgrammarを使えるよう、静的初期化時に読み込んでおく
+	// (function-local staticの初期化はVS2013ではスレッドセーフでないため)
+	static boost::shared_ptr<Grammar> createDefaultGrammar() {
+		boost::shared_ptr<Grammar> grammar = boost::shared_ptr<Grammar>(new Grammar());
+		grammar->parse(Grammar::DEFAULT_GRAMMAR);
+		return grammar;
+	}
+
+	static boost::shared_ptr<Grammar> currentGrammar = createDefaultGrammar();
+
+	Grammar::Grammar() {
+		axiom = -1;
+	}
+
+	/**
+	 * ファイルからgrammarを読み込む。
+	 *
+	 * @param filename		ファイル名
+	 * @param error [OUT]	失敗した場合のエラーメッセージ (NULLなら返さない)
+	 * @return				成功したらtrue
+	 */
+	bool Grammar::load(const std::string& filename, std::string* error) {
+		std::ifstream in(filename.c_str());
+		if (!in.is_open()) {
+			if (error != NULL) *error = filename + ": could not be opened";
+			return false;
+		}
+
+		std::stringstream ss;
+		ss << in.rdbuf();
+		if (!parse(ss.str(), error)) {
+			if (error != NULL) *error = filename + ": " + *error;
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * grammarのテキストを解析して、表にコンパイルする。失敗した場合、このgrammarは変更しない。
+	 *
+	 * @param text			grammarのテキスト
+	 * @param error [OUT]	失敗した場合のエラーメッセージ ("line N: ...")
+	 * @return				成功したらtrue
+	 */
+	bool Grammar::parse(const std::string& text, std::string* error) {
+		Grammar grammar;
+		std::map<std::string, int> constants;
+		std::vector<ParsedRule> parsedRules;
+
+		std::istringstream in(text);
+		std::string line;
+		int lineNo = 0;
+		std::string message;
+		while (message.empty() && std::getline(in, line)) {
+			lineNo++;
+			std::vector<std::string> tokens = tokenize(line);
+			if (tokens.empty()) continue;
+
+			if (tokens[0] == "const") {
+				int value;
+				if (tokens.size() != 3 || !parseInt(tokens[2], value)) {
+					message = "usage: const <name> <integer>";
+				}
+				else {
+					constants[tokens[1]] = value;
+				}
+			}
+			else if (tokens[0] == "symbol") {
+				if (tokens.size() != 3 || (tokens[2] != "segment" && tokens[2] != "rotate")) {
+					message = "usage: symbol <name> <segment|rotate>";
+				}
+				else if (tokens[1].find('\0') != std::string::npos || tokens[1] == ":") {
+					// 保存形式 (Serialization.h) は記号名を'\0'区切りで格納する
+					message = "invalid symbol name " + tokens[1];
+				}
+				else if (grammar.symbolIndex(tokens[1]) >= 0) {
+					message = "symbol " + tokens[1] + " is already defined";
+				}
+				else {
+					Symbol symbol = { tokens[1], tokens[2] == "segment" ? KIND_SEGMENT : KIND_ROTATE, 0, 0 };
+					grammar.symbols.push_back(symbol);
+				}
+			}
+			else if (tokens[0] == "axiom") {
+				if (tokens.size() != 2 || grammar.symbolIndex(tokens[1]) < 0) {
+					message = "usage: axiom <declared symbol>";
+				}
+				else {
+					grammar.axiom = grammar.symbolIndex(tokens[1]);
+				}
+			}
+			else if (tokens[0] == "rule") {
+				ParsedRule parsed;
+				parsed.lhs = tokens.size() >= 2 ? grammar.symbolIndex(tokens[1]) : -1;
+				parsed.rule.head = -1;
+				parsed.rule.hasAngle = false;
+				parsed.rule.angle = 0.0f;
+				if (parsed.lhs < 0) {
+					message = "rule needs a declared symbol on the left-hand side";
+					break;
+				}
+
+				int i = 2;
+				if (i < tokens.size() && tokens[i] == "when") {
+					for (i++; i + 2 < tokens.size() && tokens[i] != ":" && tokens[i] != "angle"; i += 3) {
+						Condition condition;
+						if (tokens[i] == "dist") condition.variable = VAR_DIST;
+						else if (tokens[i] == "level") condition.variable = VAR_LEVEL;
+						else { message = "unknown variable " + tokens[i]; break; }
+
+						if (tokens[i + 1] == "<") condition.op = OP_LT;
+						else if (tokens[i + 1] == "<=") condition.op = OP_LE;
+						else if (tokens[i + 1] == ">") condition.op = OP_GT;
+						else if (tokens[i + 1] == ">=") condition.op = OP_GE;
+						else if (tokens[i + 1] == "==") condition.op = OP_EQ;
+						else if (tokens[i + 1] == "!=") condition.op = OP_NE;
+						else { message = "unknown operator " + tokens[i + 1]; break; }
+
+						if (!parseValue(tokens[i + 2], constants, condition.value)) { message = "unknown value " + tokens[i + 2]; break; }
+
+						parsed.conditions.push_back(condition);
+					}
+					if (!message.empty()) break;
+				}
+
+				if (i + 1 < tokens.size() && tokens[i] == "angle") {
+					float angle;
+					char* end;
+					angle = strtof(tokens[i + 1].c_str(), &end);
+					if (*end != '\0' || i + 2 != tokens.size()) {
+						message = "usage: rule <symbol> [when ...] angle <degree>";
+						break;
+					}
+					parsed.rule.hasAngle = true;
+					parsed.rule.angle = angle;
+				}
+				else if (i + 1 < tokens.size() && tokens[i] == ":") {
+					parsed.rule.head = grammar.symbolIndex(tokens[i + 1]);
+					if (parsed.rule.head < 0) {
+						message = "unknown symbol " + tokens[i + 1];
+						break;
+					}
+
+					for (i += 2; i < tokens.size(); ++i) {
+						if (tokens[i] != "[" && tokens[i] != "+[") {
+							message = "expected [ or +[ but found " + tokens[i];
+							break;
+						}
+
+						Branch branch = { tokens[i] == "+[" ? 1 : 0, (int)parsed.branchSymbols.size(), 0 };
+						for (i++; i < tokens.size() && tokens[i] != "]"; ++i) {
+							int symbol = grammar.symbolIndex(tokens[i]);
+							if (symbol < 0) {
+								message = "unknown symbol " + tokens[i];
+								break;
+							}
+							parsed.branchSymbols.push_back(symbol);
+							branch.numSymbols++;
+						}
+						if (!message.empty()) break;
+						if (i >= tokens.size()) {
+							message = "missing ]";
+							break;
+						}
+						parsed.branches.push_back(branch);
+					}
+					if (!message.empty()) break;
+				}
+				else {
+					message = "usage: rule <symbol> [when ...] (: <successor> | angle <degree>)";
+					break;
+				}
+
+				parsedRules.push_back(parsed);
+			}
+			else {
+				message = "unknown keyword " + tokens[0];
+			}
+		}
+
+		if (message.empty() && grammar.axiom < 0) {
+			message = "axiom is not defined";
+		}
+		if (!message.empty()) {
+			if (error != NULL) {
+				std::stringstream ss;
+				ss << "line " << lineNo << ": " << message;
+				*error = ss.str();
+			}
+			return false;
+		}
+
+		// 左辺ごとにruleを連続させて、表に詰める (同じ左辺の中では定義順 = actionの番号)
+		std::stable_sort(parsedRules.begin(), parsedRules.end(), [](const ParsedRule& a, const ParsedRule& b) { return a.lhs < b.lhs; });
+		for (int r = 0; r < parsedRules.size(); ++r) {
+			ParsedRule& parsed = parsedRules[r];
+
+			Symbol& symbol = grammar.symbols[parsed.lhs];
+			if (symbol.numRules == 0) symbol.firstRule = grammar.rules.size();
+			symbol.numRules++;
+
+			parsed.rule.firstCondition = grammar.conditions.size();
+			parsed.rule.numConditions = parsed.conditions.size();
+			grammar.conditions.insert(grammar.conditions.end(), parsed.conditions.begin(), parsed.conditions.end());
+
+			parsed.rule.firstBranch = grammar.branches.size();
+			parsed.rule.numBranches = parsed.branches.size();
+			for (int b = 0; b < parsed.branches.size(); ++b) {
+				parsed.branches[b].firstSymbol += grammar.branchSymbols.size();
+				grammar.branches.push_back(parsed.branches[b]);
+			}
+			grammar.branchSymbols.insert(grammar.branchSymbols.end(), parsed.branchSymbols.begin(), parsed.branchSymbols.end());
+
+			grammar.rules.push_back(parsed.rule);
+		}
+
+		*this = grammar;
+		return true;
+	}
+
+	/**
+	 * 記号名から記号のindexを返す。見つからなければ-1。
+	 */
+	int Grammar::symbolIndex(const std::string& name) const {
+		for (int i = 0; i < symbols.size(); ++i) {
+			if (symbols[i].name == name) return i;
+		}
+		return -1;
+	}
+
+	/**
+	 * level/distのノードに、ruleを適用できるならtrueを返す。
+	 */
+	bool Grammar::applicable(const Rule& rule, int level, int dist) const {
+		for (int i = 0; i < rule.numConditions; ++i) {
+			const Condition& condition = conditions[rule.firstCondition + i];
+			int x = condition.variable == VAR_DIST ? dist : level;
+			switch (condition.op) {
+			case OP_LT: if (!(x < condition.value)) return false; break;
+			case OP_LE: if (!(x <= condition.value)) return false; break;
+			case OP_GT: if (!(x > condition.value)) return false; break;
+			case OP_GE: if (!(x >= condition.value)) return false; break;
+			case OP_EQ: if (!(x == condition.value)) return false; break;
+			case OP_NE: if (!(x != condition.value)) return false; break;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * 現在のgrammarを返す。setCurrent()で変更しなければ、DEFAULT_GRAMMARである。
+	 */
+	const Grammar& Grammar::current() {
+		return *currentGrammar;
+	}
+
+	/**
+	 * 現在のgrammarを変更する。
+	 * 探索中のスレッドからも参照するので、探索を開始する前（プログラムの起動時など）に呼ぶこと。
+	 * 既存のderivation treeの記号のindexは変換しないので、変更前に作ったtreeは使わないこと。
+	 */
+	void Grammar::setCurrent(const boost::shared_ptr<Grammar>& grammar) {
+		currentGrammar = grammar;
+	}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace mcts {
+
+	/**
+	 * derivationに使うgrammar。
+	 * テキストで定義し、読み込み時に記号・rule・条件・右辺を整数indexの表にコンパイルする。
+	 * actions()、applyRule()、generateGeometry()はこの表を引くだけで、記号名の文字列比較はしない。
+	 *
+	 * 書式（1行に1つ、#以降はコメント）:
+	 *   const <名前> <整数>							条件で使う定数
+	 *   symbol <名前> <segment|rotate>				記号。segmentはセグメントを描画して先端に進み、rotateは角度だけ回転する
+	 *   axiom <記号>									開始記号
+	 *   rule <左辺> [when <条件>...] : <右辺>
+	 *   rule <左辺> [when <条件>...] angle <角度>
+	 *
+	 * 条件は "dist >= MAX_DIST-1" のように、dist/levelを、整数または定数(±整数)と比較する。全ての条件を満たすruleだけを選べる。
+	 * 右辺の先頭の記号で左辺のノードを置き換え、続く [...] ごとに、記号の列（前の記号の子、その子、…）を子として追加する。
+	 * 追加したノードはdist+1、+[...] ならlevelも+1になる。
+	 * angleのruleは、左辺のノードに角度[degree]を設定して確定する。
+	 * ruleを持たない記号は終端記号。actionの番号は、左辺ごとのruleの定義順である。
+	 * 記号は、ruleで使う前に宣言すること。記号名の長さに制限はない（保存時は記号のindexと記号名の表で記録する）。
+	 */
+	class Grammar {
+	public:
+		enum { KIND_SEGMENT = 0, KIND_ROTATE };
+		enum { VAR_DIST = 0, VAR_LEVEL };
+		enum { OP_LT = 0, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE };
+
+		struct Symbol {
+			std::string name;
+			int kind;
+			int firstRule;		// rulesの中で、この記号を左辺とする最初のrule
+			int numRules;
+		};
+
+		struct Condition {
+			int variable;
+			int op;
+			int value;
+		};
+
+		// 右辺の [...] 1つ分。記号はbranchSymbols[firstSymbol]から順に、前の記号の子になる
+		struct Branch {
+			int levelOffset;
+			int firstSymbol;
+			int numSymbols;
+		};
+
+		struct Rule {
+			int head;			// 左辺のノードを置き換える記号 (-1なら左辺のまま)
+			bool hasAngle;
+			float angle;
+			int firstCondition;
+			int numConditions;
+			int firstBranch;
+			int numBranches;
+		};
+
+	public:
+		std::vector<Symbol> symbols;
+		std::vector<Rule> rules;			// 左辺ごとに連続している
+		std::vector<Condition> conditions;
+		std::vector<Branch> branches;
+		std::vector<int> branchSymbols;
+		int axiom;
+
+	public:
+		Grammar();
+
+		bool load(const std::string& filename, std::string* error = NULL);
+		bool parse(const std::string& text, std::string* error = NULL);
+		int symbolIndex(const std::string& name) const;
+		bool isTerminal(int symbol) const { return symbols[symbol].numRules == 0; }
+		bool applicable(const Rule& rule, int level, int dist) const;
+
+		static const Grammar& current();
+		static void setCurrent(const boost::shared_ptr<Grammar>& grammar);
+
+		// 組み込みのgrammar (X/F/"/"/"\\"による木)
+		static const char* DEFAULT_GRAMMAR;
+	};
+
+}
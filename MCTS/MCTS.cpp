@@ -1,13 +1,16 @@
 ﻿#include "MCTS.h"
-#include "GLWidget3D.h"
+#include "RenderManager.h"
 #include "GLUtils.h"
-#include <QDir>
-#include <QTextStream>
-#include <time.h>
+#include <QDateTime>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 namespace mcts {
 	const double PARAM_EXPLORATION = 1.0;
 	const double PARAM_EXPLORATION_VARIANCE = 0.1;
+	const double PARAM_WIDENING_C = 1.0;		// progressive wideningの係数 (子ノード数の上限 = C * visits^alpha)
+	const double PARAM_WIDENING_ALPHA = 0.5;
 	const float M_PI = 3.141592653f;
 	const float INITIAL_SEGMENT_LENGTH = 0.5f;
 	const float INITIAL_SEGMENT_WIDTH = 0.3f;
@@ -15,16 +18,39 @@ namespace mcts {
 	const int MAX_DIST = 20;
 	const float SIMILARITY_METRICS_ALPHA = 10000.0f;
 	const float SIMILARITY_METRICS_BETA = 5000.0f;
-	const int BASE_PART = 3;
 	const int SIMULATION_DEPTH = 2;
-
-	float time_select = 0.0f;
-	float time_expand = 0.0f;
-	float time_simulate = 0.0f;
-	float time_backpropagate = 0.0f;
+	const float REFINE_MIN_LENGTH_RATIO = 0.5f;		// refineでのセグメント長の範囲 (INITIAL_SEGMENT_LENGTHに対する比)
+	const float REFINE_MAX_LENGTH_RATIO = 2.0f;
+
+	// 計測する区間 (Profiler::ScopedTimerのたびに名前を検索しないよう、起動時に登録しておく)
+	const Profiler::Phase PHASE_ITERATION = Profiler::phase("iteration");
+	const Profiler::Phase PHASE_SELECT = Profiler::phase("select");
+	const Profiler::Phase PHASE_EXPAND = Profiler::phase("expand");
+	const Profiler::Phase PHASE_SIMULATE = Profiler::phase("simulate");
+	const Profiler::Phase PHASE_BACKPROPAGATE = Profiler::phase("backpropagate");
+	const Profiler::Phase PHASE_CLONE = Profiler::phase("clone");
+	const Profiler::Phase PHASE_PRIOR = Profiler::phase("prior");
+	const Profiler::Phase PHASE_GEOMETRY = Profiler::phase("geometry");
+	const Profiler::Phase PHASE_RENDER = Profiler::phase("render");
+	const Profiler::Phase PHASE_DISTANCE_TRANSFORM = Profiler::phase("distanceTransform");
+	const Profiler::Phase PHASE_SIMILARITY = Profiler::phase("similarity");
+	const Profiler::Phase PHASE_REFINE = Profiler::phase("refine");
+	const Profiler::Phase PHASE_RESULT_IMAGE = Profiler::phase("resultImage");
 
 	Nonterminal::Nonterminal(const std::string& name, int level, int dist, float segmentLength, float angle, bool terminal) {
 		this->name = name;
+		this->symbol = Grammar::current().symbolIndex(name);
+		this->level = level;
+		this->dist = dist;
+		this->segmentLength = segmentLength;
+		this->segmentWidth = INITIAL_SEGMENT_WIDTH;
+		this->angle = angle;
+		this->terminal = terminal;
+	}
+
+	Nonterminal::Nonterminal(int symbol, int level, int dist, float segmentLength, float angle, bool terminal) {
+		this->name = symbol >= 0 ? Grammar::current().symbols[symbol].name : "";
+		this->symbol = symbol;
 		this->level = level;
 		this->dist = dist;
 		this->segmentLength = segmentLength;
@@ -34,7 +60,8 @@ namespace mcts {
 	}
 
 	boost::shared_ptr<Nonterminal> Nonterminal::clone() {
-		boost::shared_ptr<Nonterminal> newNonterminal = boost::shared_ptr<Nonterminal>(new Nonterminal(name, level, dist, segmentLength, angle, terminal));
+		boost::shared_ptr<Nonterminal> newNonterminal = boost::shared_ptr<Nonterminal>(new Nonterminal(symbol, level, dist, segmentLength, angle, terminal));
+		newNonterminal->modelMat = modelMat;
 		for (int i = 0; i < children.size(); ++i) {
 			newNonterminal->children.push_back(children[i]->clone());
 		}
@@ -58,6 +85,71 @@ namespace mcts {
 		}
 	}
 
+	/**
+	 * derivation treeを1行のテキストにする。
+	 * 各ノードを前順に "name level dist segmentLength segmentWidth angle terminal #children" の順で出力する。
+	 * recover()で元に戻せる。
+	 */
+	std::string DerivationTree::to_string() const {
+		std::stringstream ss;
+		ss << std::setprecision(9);
+		if (root != NULL) {
+			std::list<boost::shared_ptr<Nonterminal> > stack;
+			stack.push_back(root);
+			while (!stack.empty()) {
+				boost::shared_ptr<Nonterminal> node = stack.back();
+				stack.pop_back();
+
+				if (node != root) ss << " ";
+				ss << node->name << " " << node->level << " " << node->dist << " " << node->segmentLength << " " << node->segmentWidth << " " << node->angle << " " << (node->terminal ? 1 : 0) << " " << node->children.size();
+
+				for (int i = (int)node->children.size() - 1; i >= 0; --i) {
+					stack.push_back(node->children[i]);
+				}
+			}
+		}
+
+		return ss.str();
+	}
+
+	/**
+	 * to_string()で出力したテキストから、derivation treeを復元する。
+	 *
+	 * @param str		to_string()の出力
+	 * @return			復元できなければfalse
+	 */
+	bool DerivationTree::recover(const std::string& str) {
+		root = NULL;
+
+		std::stringstream ss(str);
+		std::vector<std::pair<boost::shared_ptr<Nonterminal>, int> > stack;	// (ノード, 残りの子ノード数)
+		while (true) {
+			std::string name;
+			int level, dist, terminal, numChildren;
+			float segmentLength, segmentWidth, angle;
+			if (!(ss >> name)) break;
+			if (!(ss >> level >> dist >> segmentLength >> segmentWidth >> angle >> terminal >> numChildren)) return false;
+
+			boost::shared_ptr<Nonterminal> node = boost::shared_ptr<Nonterminal>(new Nonterminal(name, level, dist, segmentLength, angle, terminal != 0));
+			node->segmentWidth = segmentWidth;
+
+			if (root == NULL) {
+				root = node;
+			}
+			else {
+				if (stack.empty()) return false;
+				stack.back().first->children.push_back(node);
+				if (--stack.back().second == 0) stack.pop_back();
+			}
+
+			if (numChildren > 0) stack.push_back(std::make_pair(node, numChildren));
+		}
+		if (root == NULL || !stack.empty()) return false;
+
+		updateModelMatrices(root);
+		return true;
+	}
+
 	State::State() {
 	}
 
@@ -143,7 +235,27 @@ namespace mcts {
 		}
 	}
 
-	boost::shared_ptr<MCTSTreeNode> MCTSTreeNode::UCTSelectChild() {
+	/**
+	 * progressive wideningによる、このノードが持てる子ノード数の上限を返す。
+	 * 訪問回数に応じて ceil(C * visits^alpha) まで増える（最低1個）。
+	 */
+	int MCTSTreeNode::maxChildren() const {
+		return std::max(1, (int)ceil(PARAM_WIDENING_C * pow((double)visits, PARAM_WIDENING_ALPHA)));
+	}
+
+	/**
+	 * 未展開のactionが残っていて、且つ、子ノード数が上限に達していなければtrueを返す。
+	 */
+	bool MCTSTreeNode::canExpand() const {
+		return unexpandedActions.size() > 0 && children.size() < maxChildren();
+	}
+
+	/**
+	 * UCTが最大の子ノードを返す。未訪問の子ノードが複数あれば、randomでランダムに選ぶ。
+	 *
+	 * @param random	乱数生成器 (MCTSごとに持つもの)
+	 */
+	boost::shared_ptr<MCTSTreeNode> MCTSTreeNode::UCTSelectChild(utils::BatchRandom& random) {
 		double max_uct = -std::numeric_limits<double>::max();
 		boost::shared_ptr<MCTSTreeNode> bestChild = NULL;
 
@@ -153,7 +265,7 @@ namespace mcts {
 
 			double uct;
 			if (children[i]->visits == 0) {
-				uct = 10000 + rand() % 1000;
+				uct = 10000 + random.uniformInt(1000);
 			}
 			else {
 				uct = children[i]->bestValue
@@ -202,16 +314,31 @@ namespace mcts {
 		varianceValues = total_val2 / values.size() - meanValue * meanValue;
 	}
 
-	int MCTSTreeNode::randomlySelectAction() {
-		int index = rand() % unexpandedActions.size();
-		int action = unexpandedActions[index];
-		unexpandedActions.erase(unexpandedActions.begin() + index);
+	/**
+	 * 次に展開するactionを取り出す。
+	 * unexpandedActionsはMCTS::orderActions()でpriorの昇順に並べてあるので、末尾が最も有望なaction。
+	 */
+	int MCTSTreeNode::selectNextAction() {
+		int action = unexpandedActions.back();
+		unexpandedActions.pop_back();
 		return action;
 	}
 
-	MCTS::MCTS(const cv::Mat& target, GLWidget3D* glWidget) {
+	/**
+	 * MCTSによるinverse proceduralを準備する。
+	 * 評価時の描画はrenderManagerのrenderLayeredで行うので、GLWidget3Dがなくても（オフスクリーンでも）実行できる。
+	 *
+	 * @param target			ターゲットのスケッチ (8bit x 3ch)
+	 * @param renderManager		評価に使うRenderManager (このスレッドのOpenGL contextがcurrentであること)
+	 * @param mvpMatrix			評価時の描画に使うmodel/view/projection行列
+	 */
+	MCTS::MCTS(const cv::Mat& target, RenderManager* renderManager, const glm::mat4& mvpMatrix) : random(0) {
 		this->target = target;
-		this->glWidget = glWidget;
+		this->renderManager = renderManager;
+		this->mvpMatrix = mvpMatrix;
+		this->cancelFlag = NULL;
+		this->profileOutput = true;
+		this->maxRefineIterations = 0;
 
 		// compute a distance map
 		cv::Mat grayImage;
@@ -227,111 +354,236 @@ namespace mcts {
 
 	State MCTS::inverse(int maxDerivationSteps, int maxMCTSIterations) {
 		// initialize computation time
-		time_select = 0.0f;
-		time_expand = 0.0f;
-		time_simulate = 0.0f;
-		time_backpropagate = 0.0f;
+		profiler.reset();
+		profiler.start();
 
-		if (QDir("results").exists()) {
-			QDir("results").removeRecursively();
+		// デバッグ出力は、指定がなければresults/に非同期で書き出す
+		if (resultSink == NULL) {
+			resultSink = boost::shared_ptr<ResultSink>(new AsyncFileResultSink("results"));
 		}
+		resultSink->begin(target);
 
-		State state(boost::shared_ptr<Nonterminal>(new Nonterminal("X", 0, 0, INITIAL_SEGMENT_LENGTH)));
+		State state(createAxiom());
 
 		for (int iter = 0; iter < maxDerivationSteps; ++iter) {
 			state = mcts(state, maxMCTSIterations);
 
-			////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
-			if (!QDir("results/").exists())	QDir().mkpath("results/");
-
-			QString filename = QString("results/result_%1.png").arg(iter);
-			QImage image;
-			render(state.derivationTree, image);
-			cv::Mat backMat = target.clone();
-			QImage background(backMat.data, backMat.cols, backMat.rows, backMat.step, QImage::Format_RGB888);
-			QPainter painter(&background);
-			painter.setOpacity(0.5);
-			painter.drawImage(0, 0, image);
-			background.save(filename);
-			////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+			// 結果画像の合成・保存はsinkが探索とは別に行う
+			if (resultSink->wantsImages()) {
+				Profiler::ScopedTimer timer(&profiler, PHASE_RESULT_IMAGE);
+				cv::Mat image;
+				render(state.derivationTree, image);
+				resultSink->stepResult(iter, image);
+			}
+
+			if (progressCallback) {
+				progressCallback(iter, state);
+			}
+
+			// これ以上derivationできない場合、またはキャンセルされた場合は、終了
+			if (state.queue.empty() || isCancelled()) break;
+		}
 
-			// これ以上derivationできない場合は、終了
-			if (state.queue.empty()) break;
+		// MCTSで決めたトポロジーのまま、角度と長さを連続値で調整する
+		if (maxRefineIterations > 0 && !isCancelled()) {
+			refine(state.derivationTree, maxRefineIterations);
+
+			if (progressCallback) {
+				progressCallback(maxDerivationSteps, state);
+			}
 		}
 
 		// show compuattion time
-		std::cout << "Select: " << time_select << std::endl;
-		std::cout << "Expand: " << time_expand << std::endl;
-		std::cout << "Simulate: " << time_simulate << std::endl;
-		std::cout << "Back: " << time_backpropagate << std::endl;
+		profiler.stop();
+		resultSink->end();
+
+		if (profileOutput) {
+			profiler.print(std::cout);
 
+			// 性能の推移を追えるよう、resultsとは別に履歴を追記していく
+			QString label = QString("%1 steps=%2 iterations=%3").arg(QDateTime::currentDateTime().toString(Qt::ISODate)).arg(maxDerivationSteps).arg(maxMCTSIterations);
+			profiler.exportJson("results/profile.json", label.toUtf8().constData());
+			profiler.appendCsv("profile_history.csv", label.toUtf8().constData());
+		}
 
 		return state;
 	}
 
+	/**
+	 * derivation treeのトポロジーはそのままに、"/"、"\\"の角度とセグメントの長さを座標降下法で調整する。
+	 * 1回の反復で、全パラメータをそれぞれ+/-stepだけ動かした候補を作り、renderLayeredでまとめて評価する。
+	 * 候補ごとに木をcloneせず、パラメータを1つだけその場で書き換えてジオメトリを作り、すぐ元に戻す。
+	 * スコアが改善した方向は全て同時に適用し、同時に適用すると最良の単独変更より悪くなる場合は、その単独変更だけを適用する。
+	 * どちらの方向にも改善しなかったパラメータは、stepを半分にする。
+	 *
+	 * @param derivationTree [IN/OUT]	調整するderivation tree
+	 * @param maxIterations				最大反復回数
+	 * @return							調整後のスコア
+	 */
+	float MCTS::refine(DerivationTree& derivationTree, int maxIterations) {
+		Profiler::ScopedTimer refineTimer(&profiler, PHASE_REFINE);
+
+		std::vector<RefineParameter> params;
+		collectRefineParameters(derivationTree.root, params);
+
+		float bestValue = evaluate(derivationTree);
+
+		for (int iter = 0; iter < maxIterations && !isCancelled(); ++iter) {
+			// まだ調整中のパラメータについて、+/-stepの候補を作る (偶数番目が-、奇数番目が+)
+			std::vector<int> active;
+			std::vector<std::vector<Vertex> > candidates;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_GEOMETRY);
+				for (int i = 0; i < params.size(); ++i) {
+					if (params[i].step < params[i].minStep) continue;
+					active.push_back(i);
+
+					float value = *params[i].value;
+					for (int sign = -1; sign <= 1; sign += 2) {
+						*params[i].value = std::min(std::max(value + sign * params[i].step, params[i].minValue), params[i].maxValue);
+						candidates.push_back(std::vector<Vertex>());
+						generateGeometry(renderManager, glm::mat4(), derivationTree.root, candidates.back());
+					}
+					*params[i].value = value;
+				}
+			}
+			if (active.empty()) break;
+			profiler.addCount("refineIterations");
+
+			std::vector<float> values;
+			evaluateGeometries(candidates, values);
+
+			// 各パラメータについて、改善した方向を選ぶ
+			std::vector<float> oldValues(active.size());
+			std::vector<float> newValues(active.size());
+			std::vector<bool> improved(active.size(), false);
+			int bestSingle = -1;
+			float bestSingleValue = bestValue;
+			for (int k = 0; k < active.size(); ++k) {
+				RefineParameter& param = params[active[k]];
+				oldValues[k] = *param.value;
+
+				int best = values[k * 2] >= values[k * 2 + 1] ? k * 2 : k * 2 + 1;
+				if (values[best] > bestValue) {
+					improved[k] = true;
+					newValues[k] = std::min(std::max(*param.value + (best % 2 == 0 ? -param.step : param.step), param.minValue), param.maxValue);
+					if (values[best] > bestSingleValue) {
+						bestSingleValue = values[best];
+						bestSingle = k;
+					}
+				}
+				else {
+					param.step *= 0.5f;
+				}
+			}
+			if (bestSingle < 0) continue;
+
+			// 改善した方向を全て同時に適用してみる
+			int numImproved = 0;
+			for (int k = 0; k < active.size(); ++k) {
+				if (!improved[k]) continue;
+				*params[active[k]].value = newValues[k];
+				numImproved++;
+			}
+			float combinedValue = numImproved > 1 ? evaluate(derivationTree) : bestSingleValue;
+
+			if (combinedValue >= bestSingleValue) {
+				bestValue = combinedValue;
+			}
+			else {
+				for (int k = 0; k < active.size(); ++k) {
+					*params[active[k]].value = k == bestSingle ? newValues[k] : oldValues[k];
+				}
+				bestValue = bestSingleValue;
+			}
+		}
+
+		// 長さや角度が変わったので、各ノードのmodel行列を更新する
+		updateModelMatrices(derivationTree.root);
+
+		return bestValue;
+	}
+
+	/**
+	 * キャンセルが要求されていればtrueを返す。
+	 * キャンセルされても、その時点までの探索で最良のstateを返すので、結果は有効である。
+	 */
+	bool MCTS::isCancelled() const {
+		return cancelFlag != NULL && cancelFlag->load();
+	}
+
 	void MCTS::randomGeneration(RenderManager* renderManager) {
-		State state(boost::shared_ptr<Nonterminal>(new Nonterminal("X", 0, 0, INITIAL_SEGMENT_LENGTH)));
-		randomDerivation(state.derivationTree, state.queue);
+		State state(createAxiom());
+		randomDerivation(state.derivationTree, state.queue, random);
 
-		glWidget->renderManager.removeObjects();
+		renderManager->removeObjects();
 		std::vector<Vertex> vertices;
 		generateGeometry(renderManager, glm::mat4(), state.derivationTree.root, vertices);
-		glWidget->renderManager.addObject("tree", "", vertices, true);
+		renderManager->addObject("tree", "", vertices, true, VertexLayout::FORMAT_COMPACT);
 	}
 
 	State MCTS::mcts(const State& state, int maxMCTSIterations) {
 		boost::shared_ptr<MCTSTreeNode> rootNode = boost::shared_ptr<MCTSTreeNode>(new MCTSTreeNode(state));
-		for (int iter = 0; iter < maxMCTSIterations; ++iter) {
+		orderActions(rootNode);
+		for (int iter = 0; iter < maxMCTSIterations && !isCancelled(); ++iter) {
+			Profiler::ScopedTimer iterationTimer(&profiler, PHASE_ITERATION);
+			profiler.addCount("iterations");
+
 			// MCTS selection
-			time_t start = clock();
-			boost::shared_ptr<MCTSTreeNode> LeafNode = select(rootNode);
-			time_t end = clock();
-			time_select += (double)(end - start) / CLOCKS_PER_SEC;
+			boost::shared_ptr<MCTSTreeNode> LeafNode;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_SELECT);
+				LeafNode = select(rootNode);
+			}
 
 			// MCTS expansion
-			start = clock();
-			boost::shared_ptr<MCTSTreeNode> childNode = expand(LeafNode);
-			end = clock();
-			time_expand += (double)(end - start) / CLOCKS_PER_SEC;
+			boost::shared_ptr<MCTSTreeNode> childNode;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_EXPAND);
+				childNode = expand(LeafNode);
+			}
 
 			// MCTS simulation
-			start = clock();
-			float value = simulate(childNode);
-			end = clock();
-			time_simulate += (double)(end - start) / CLOCKS_PER_SEC;
+			float value;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_SIMULATE);
+				value = simulate(childNode);
+			}
 
 			// MCTS backpropagation
-			start = clock();
-			backpropage(childNode, value);
-			end = clock();
-			time_backpropagate += (double)(end - start) / CLOCKS_PER_SEC;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_BACKPROPAGATE);
+				backpropage(childNode, value);
+			}
 
 			// 子ノードが1個なら、終了
 			if (rootNode->unexpandedActions.size() == 0 && rootNode->children.size() <= 1) break;
 		}
 
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
-		if (!QDir("results/").exists())	QDir().mkpath("results/");
-		QFile file("results/visits.txt");
-		file.open(QIODevice::Append);
-		QTextStream out(&file);
-		for (int i = 0; i < rootNode->children.size(); ++i) {
-			if (i > 0) out << ",";
-			out << rootNode->children[i]->selectedAction << "(#visits: " << rootNode->children[i]->visits << ", #val: " << rootNode->children[i]->bestValue << ")";
-		}
-		out << "\n";
-		file.close();
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+		if (resultSink != NULL) {
+			std::stringstream ss;
+			for (int i = 0; i < rootNode->children.size(); ++i) {
+				if (i > 0) ss << ",";
+				ss << rootNode->children[i]->selectedAction << "(#visits: " << rootNode->children[i]->visits << ", #val: " << rootNode->children[i]->bestValue << ")";
+			}
+			resultSink->visits(ss.str());
+		}
+
+		// 1回も展開しないうちにキャンセルされた場合は、元のstateを返す
+		boost::shared_ptr<MCTSTreeNode> bestChild = rootNode->bestChild();
+		if (bestChild == NULL) return state;
 
-		return rootNode->bestChild()->state;
+		return bestChild->state;
 	}
 
 	boost::shared_ptr<MCTSTreeNode> MCTS::select(const boost::shared_ptr<MCTSTreeNode>& rootNode) {
 		boost::shared_ptr<MCTSTreeNode> node = rootNode;
 
-		// 探索木のリーフノードまで探索
-		while (node->unexpandedActions.size() == 0 && node->children.size() > 0) {
-			boost::shared_ptr<MCTSTreeNode> childNode = node->UCTSelectChild();
+		// 探索木のリーフノード、または、まだ子ノードを増やせるノードまで探索
+		while (!node->canExpand() && node->children.size() > 0) {
+			boost::shared_ptr<MCTSTreeNode> childNode = node->UCTSelectChild(random);
+
+			// 子ノードが全てスコア確定済みなら、このノードで止めて、子ノード数の上限を超えてexpandさせる
 			if (childNode == NULL) break;
 			node = childNode;
 		}
@@ -346,25 +598,115 @@ namespace mcts {
 		if (node->unexpandedActions.size() == 0) {
 			return node;
 		}
-		// 子ノードがまだ全てexpandされていない時は、1つランダムにexpand
+		// 子ノードがまだ全てexpandされていない時は、priorが最も高いactionを1つexpand
+		// (子ノード数の上限はselectで考慮済み。既存の子ノードが全てスコア確定済みの時は、selectがこのノードで止まるので、上限を超えてexpandする)
 		else {
-			int action = node->randomlySelectAction();
+			int action = node->selectNextAction();
 			
-			State child_state = node->state.clone();
+			State child_state;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_CLONE);
+				child_state = node->state.clone();
+			}
 			child_state.applyAction(action);
 
 			boost::shared_ptr<MCTSTreeNode> child_node = boost::shared_ptr<MCTSTreeNode>(new MCTSTreeNode(child_state));
+			profiler.addCount("nodes");
 			child_node->selectedAction = action;
 			node->children.push_back(child_node);
 			child_node->parent = node;
+			orderActions(child_node);
 
 			return child_node;
 		}
 	}
 	
+	/**
+	 * ノードのunexpandedActionsを、priorの昇順に並べ替える（末尾から順に展開される）。
+	 * priorは、各actionを適用した時の枝の先端が、ターゲットのストロークにどれだけ近いかで決める。
+	 * 乱数ではなくターゲットに基づいて展開順を決めるので、progressive wideningで子ノード数を絞っても有望な枝から探索できる。
+	 *
+	 * @param node		探索木のノード
+	 */
+	void MCTS::orderActions(const boost::shared_ptr<MCTSTreeNode>& node) {
+		if (node->unexpandedActions.size() <= 1) return;
+
+		Profiler::ScopedTimer timer(&profiler, PHASE_PRIOR);
+
+		boost::shared_ptr<Nonterminal> nonterminal = node->state.queue.front();
+
+		std::vector<std::pair<float, int> > priors;
+		for (int i = 0; i < node->unexpandedActions.size(); ++i) {
+			priors.push_back(std::make_pair(actionPrior(nonterminal, nonterminal->modelMat, node->unexpandedActions[i]), node->unexpandedActions[i]));
+		}
+		std::stable_sort(priors.begin(), priors.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first < b.first; });
+
+		for (int i = 0; i < priors.size(); ++i) {
+			node->unexpandedActions[i] = priors[i].second;
+		}
+	}
+
+	/**
+	 * actionのpriorを計算する（大きいほど有望）。
+	 * rotateの記号（"/"、"\\"）は、回転後のセグメントの中点と先端でのターゲットまでの距離の平均にマイナスを付けたもの。
+	 * segmentの記号（"X"）は、さらに1セグメント延ばした先がターゲットのストローク上にあれば
+	 * 延伸（右辺の枝が1つ）→枝分かれ（2つ以上）→ストップ（なし）の順、なければストップを優先する。
+	 *
+	 * @param nonterminal	展開するnon-terminal
+	 * @param modelMat		nonterminalの根元のmodel行列
+	 * @param action		action
+	 * @return				prior
+	 */
+	float MCTS::actionPrior(const boost::shared_ptr<Nonterminal>& nonterminal, const glm::mat4& modelMat, int action) {
+		const Grammar& grammar = Grammar::current();
+
+		if (grammar.symbols[nonterminal->symbol].kind == Grammar::KIND_SEGMENT) {
+			glm::vec2 base = project(modelMat, glm::vec3(0, 0, 0));
+			glm::vec2 tip = project(modelMat, glm::vec3(0, nonterminal->segmentLength, 0));
+			glm::vec2 next = project(modelMat, glm::vec3(0, nonterminal->segmentLength + INITIAL_SEGMENT_LENGTH, 0));
+			bool onStroke = targetDistance(next) < glm::length(tip - base);
+
+			int numBranches = grammar.rules[grammar.symbols[nonterminal->symbol].firstRule + action].numBranches;
+			if (numBranches == 0) return onStroke ? 0.0f : 2.0f;
+			else return onStroke ? 3.0f - numBranches : 2.0f - numBranches;
+		}
+		else {
+			glm::mat4 mat = glm::rotate(modelMat, ruleAngle(nonterminal->symbol, action) / 180.0f * M_PI, glm::vec3(0, 0, 1));
+			float dist1 = targetDistance(project(mat, glm::vec3(0, INITIAL_SEGMENT_LENGTH * 0.5f, 0)));
+			float dist2 = targetDistance(project(mat, glm::vec3(0, INITIAL_SEGMENT_LENGTH, 0)));
+			return -(dist1 + dist2) * 0.5f;
+		}
+	}
+
+	/**
+	 * 点をターゲット画像のピクセル座標に投影する。
+	 * renderLayeredは上下反転して描画するので、画像の上端がNDCのy=1に対応する。
+	 */
+	glm::vec2 MCTS::project(const glm::mat4& modelMat, const glm::vec3& p) {
+		glm::vec4 clip = mvpMatrix * modelMat * glm::vec4(p, 1);
+		if (clip.w <= 0.0f) return glm::vec2(-1, -1);
+
+		return glm::vec2((clip.x / clip.w + 1.0f) * 0.5f * target.cols, (1.0f - clip.y / clip.w) * 0.5f * target.rows);
+	}
+
+	/**
+	 * ピクセル座標での、ターゲットのストロークまでの距離を返す。画像の外なら、画像の幅+高さを返す。
+	 */
+	float MCTS::targetDistance(const glm::vec2& pixel) {
+		int x = (int)pixel.x;
+		int y = (int)pixel.y;
+		if (pixel.x < 0 || pixel.y < 0 || x >= targetDistMap.cols || y >= targetDistMap.rows) return targetDistMap.cols + targetDistMap.rows;
+
+		return targetDistMap.at<float>(y, x);
+	}
+
 	float MCTS::simulate(const boost::shared_ptr<MCTSTreeNode>& childNode) {
-		State state = childNode->state.clone();
-		randomDerivation(state.derivationTree, state.queue);
+		State state;
+		{
+			Profiler::ScopedTimer timer(&profiler, PHASE_CLONE);
+			state = childNode->state.clone();
+		}
+		randomDerivation(state.derivationTree, state.queue, random);
 		return evaluate(state.derivationTree);
 	}
 
@@ -397,90 +739,125 @@ namespace mcts {
 	}
 
 	float MCTS::evaluate(const DerivationTree& derivationTree) {
-		QImage image;
-		render(derivationTree.root, image);
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
-		//image.save("output.png");
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+		std::vector<DerivationTree> derivationTrees(1, derivationTree);
+		std::vector<float> values;
+		evaluate(derivationTrees, values);
+		return values[0];
+	}
 
-		cv::Mat sourceImage(image.height(), image.width(), CV_8UC4, image.bits(), image.bytesPerLine());
-		cv::Mat grayImage;
-		cv::cvtColor(sourceImage, grayImage, CV_RGB2GRAY);
+	/**
+	 * 複数のderivation treeを、texture arrayの各レイヤーに一度に描画して評価する。
+	 * 描画結果はグレースケールで、Fのセグメント（黒）だけが0になるので、
+	 * そのまま距離変換してターゲットの距離マップと比較する。
+	 *
+	 * @param derivationTrees	評価するderivation tree
+	 * @param values [OUT]		各derivation treeのスコア
+	 */
+	void MCTS::evaluate(const std::vector<DerivationTree>& derivationTrees, std::vector<float>& values) {
+		std::vector<std::vector<Vertex> > geometries(derivationTrees.size());
+		{
+			Profiler::ScopedTimer timer(&profiler, PHASE_GEOMETRY);
+			for (int i = 0; i < derivationTrees.size(); ++i) {
+				generateGeometry(renderManager, glm::mat4(), derivationTrees[i].root, geometries[i]);
+			}
+		}
 
+		evaluateGeometries(geometries, values);
+	}
 
-		// compute a distance map
-		cv::Mat distMap;
-		cv::distanceTransform(grayImage, distMap, CV_DIST_L2, 3);
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
-		//cv::imwrite("distMap.png", distMap);
-		////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
-		distMap.convertTo(distMap, CV_32F);
+	/**
+	 * generateGeometry()で作ったジオメトリを、texture arrayの各レイヤーに一度に描画して評価する。
+	 *
+	 * @param geometries		評価するジオメトリ (derivation treeごと)
+	 * @param values [OUT]		各ジオメトリのスコア
+	 */
+	void MCTS::evaluateGeometries(const std::vector<std::vector<Vertex> >& geometries, std::vector<float>& values) {
+		profiler.addCount("evaluations", geometries.size());
+
+		std::vector<unsigned char> pixels;
+		{
+			Profiler::ScopedTimer timer(&profiler, PHASE_RENDER);
+			renderManager->renderLayered(geometries, mvpMatrix, target.cols, target.rows, pixels, &profiler);
+		}
+
+		values.resize(geometries.size());
+		for (int i = 0; i < geometries.size(); ++i) {
+			cv::Mat grayImage(target.rows, target.cols, CV_8U, pixels.data() + (size_t)i * target.cols * target.rows);
+			////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+			//cv::imwrite("output.png", grayImage);
+			////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+
+			// compute a distance map
+			cv::Mat distMap;
+			{
+				Profiler::ScopedTimer timer(&profiler, PHASE_DISTANCE_TRANSFORM);
+				cv::distanceTransform(grayImage, distMap, CV_DIST_L2, 3);
+				////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+				//cv::imwrite("distMap.png", distMap);
+				////////////////////////////////////////////// DEBUG //////////////////////////////////////////////
+				distMap.convertTo(distMap, CV_32F);
+			}
 
-		// compute the squared difference
-		return similarity(distMap, targetDistMap, SIMILARITY_METRICS_ALPHA, SIMILARITY_METRICS_BETA);
+			// compute the squared difference
+			Profiler::ScopedTimer timer(&profiler, PHASE_SIMILARITY);
+			values[i] = similarity(distMap, targetDistMap, SIMILARITY_METRICS_ALPHA, SIMILARITY_METRICS_BETA);
+		}
 	}
 
-	void MCTS::render(const DerivationTree& derivationTree, QImage& image) {
-		glWidget->renderManager.removeObjects();
-		std::vector<Vertex> vertices;
-		generateGeometry(&glWidget->renderManager, glm::mat4(), derivationTree.root, vertices);
-		glWidget->renderManager.addObject("tree", "", vertices, true);
-		glWidget->render();
-		
-		image = glWidget->grabFrameBuffer();
+	/**
+	 * derivation treeを、評価時と同じ条件でグレースケール画像に描画する。
+	 *
+	 * @param derivationTree	derivation tree
+	 * @param image [OUT]		描画結果 (8bit x 1ch、ターゲットと同じサイズ)
+	 */
+	void MCTS::render(const DerivationTree& derivationTree, cv::Mat& image) {
+		std::vector<std::vector<Vertex> > geometries(1);
+		generateGeometry(renderManager, glm::mat4(), derivationTree.root, geometries[0]);
+
+		std::vector<unsigned char> pixels;
+		renderManager->renderLayered(geometries, mvpMatrix, target.cols, target.rows, pixels);
+		image = cv::Mat(target.rows, target.cols, CV_8U, pixels.data()).clone();
 	}
 
+	/**
+	 * derivation treeの各セグメントを四角形にして、頂点を追加する。
+	 * 座標系は全てz=0平面内の回転と平行移動なので、Rigid2Dで積んで四角形を集め、最後にemitQuads2Dでまとめて書き込む。
+	 *
+	 * @param renderManager		使わない
+	 * @param modelMat			nodeの根元のmodel行列
+	 * @param node				derivation treeのノード
+	 * @param vertices [OUT]	頂点 (末尾に追加される)
+	 */
 	void MCTS::generateGeometry(RenderManager* renderManager, const glm::mat4& modelMat, const boost::shared_ptr<Nonterminal>& node, std::vector<Vertex>& vertices) {
-		glm::mat4 mat;
-
-		if (node->name == "F") {
-			glutils::drawQuad(node->segmentWidth, node->segmentLength, glm::vec4(0, 0, 0, 1), glm::translate(modelMat, glm::vec3(0, node->segmentLength * 0.5, 0)), vertices);
-			mat = glm::translate(modelMat, glm::vec3(0, node->segmentLength, 0));
-		}
-		else if (node->name == "X") {
-			glutils::drawQuad(node->segmentWidth, node->segmentLength, glm::vec4(0.5, 0.5, 0.5, 1), glm::translate(modelMat, glm::vec3(0, node->segmentLength * 0.5, 0)), vertices);
-			mat = glm::translate(modelMat, glm::vec3(0, node->segmentLength, 0));
-		}
-		else if (node->name == "/") {
-			if (!node->terminal) return;
-			mat = glm::rotate(modelMat, node->angle / 180.0f * M_PI, glm::vec3(0, 0, 1));
-		}
-		else if (node->name == "\\") {
-			if (!node->terminal) return;
-			mat = glm::rotate(modelMat, node->angle / 180.0f * M_PI, glm::vec3(0, 0, 1));
-		}
-		
-		for (int i = 0; i < node->children.size(); ++i) {
-			generateGeometry(renderManager, mat, node->children[i], vertices);
+		glutils::Quads2D quads;
+		collectSegments(glutils::Rigid2D(), node, quads);
+		if (quads.size() == 0) return;
+
+		size_t first = vertices.size();
+		glutils::emitQuads2D(quads, glutils::appendSpan(vertices, quads.size() * glutils::QUAD_VERTICES));
+
+		// 根元の座標系が単位行列でなければ、追加した頂点を変換する
+		if (modelMat != glm::mat4()) {
+			for (size_t i = first; i < vertices.size(); ++i) {
+				vertices[i].position = glm::vec3(modelMat * glm::vec4(vertices[i].position, 1));
+				vertices[i].normal = glm::vec3(modelMat * glm::vec4(vertices[i].normal, 0));
+			}
 		}
 	}
 
+	/**
+	 * non-terminalに適用できるactionのリストを返す。
+	 * actionは、Grammar::current()でこの記号を左辺とするruleの番号で、条件を満たすものだけを返す。
+	 */
 	std::vector<int> actions(const boost::shared_ptr<Nonterminal>& nonterminal) {
 		std::vector<int> ret;
 
-		if (nonterminal->terminal) return ret;
+		if (nonterminal->terminal || nonterminal->symbol < 0) return ret;
 
-		if (nonterminal->name == "X") {
-			if (nonterminal->dist >= MAX_DIST - 1) {
-				ret.push_back(0);
-			}
-			else if (nonterminal->dist < BASE_PART) {
-				ret.push_back(1);
-			}
-			else {
-				ret.push_back(1);
-				if (nonterminal->level < MAX_LEVEL - 1) {
-					ret.push_back(2);
-				}
-			}
-		}
-		else if (nonterminal->name == "/") {
-			for (int i = 0; i < 5; ++i) {
-				ret.push_back(i);
-			}
-		}
-		else if (nonterminal->name == "\\") {
-			for (int i = 0; i < 8; ++i) {
+		const Grammar& grammar = Grammar::current();
+		const Grammar::Symbol& symbol = grammar.symbols[nonterminal->symbol];
+		for (int i = 0; i < symbol.numRules; ++i) {
+			if (grammar.applicable(grammar.rules[symbol.firstRule + i], nonterminal->level, nonterminal->dist)) {
 				ret.push_back(i);
 			}
 		}
@@ -488,7 +865,7 @@ namespace mcts {
 		return ret;
 	}
 
-	void randomDerivation(DerivationTree& derivationTree, std::list<boost::shared_ptr<Nonterminal> >& queue) {
+	void randomDerivation(DerivationTree& derivationTree, std::list<boost::shared_ptr<Nonterminal> >& queue, utils::BatchRandom& random) {
 		int start_depth = queue.front()->dist;
 
 		while (!queue.empty()) {
@@ -502,7 +879,7 @@ namespace mcts {
 
 			std::vector<int> act = actions(node);
 			if (act.size() > 0) {
-				int action = act[rand() % act.size()];
+				int action = act[random.uniformInt(act.size())];
 				applyRule(derivationTree, node, action, queue);
 			}
 			else {
@@ -511,52 +888,159 @@ namespace mcts {
 		}
 	}
 
+	/**
+	 * non-terminalにruleを適用する。
+	 * ruleの右辺の先頭の記号でノードを置き換え（angleのruleなら角度を設定し）、右辺の各枝を子ノードとして追加してqueueに入れる。
+	 *
+	 * @param derivationTree	derivation tree
+	 * @param node				ruleを適用するノード (queueから取り出し済み)
+	 * @param action			適用するrule (左辺ごとのruleの番号)
+	 * @param queue [OUT]		展開待ちのnon-terminal
+	 */
 	void applyRule(DerivationTree& derivationTree, const boost::shared_ptr<Nonterminal>& node, int action, std::list<boost::shared_ptr<Nonterminal> >& queue) {
-		if (node->name == "X") {
-			if (action == 0) {
-				node->name = "F";
-				node->terminal = true;
-			}
-			else if (action == 1) {
-				node->name = "F";
-				node->terminal = true;
+		const Grammar& grammar = Grammar::current();
+		const Grammar::Rule& rule = grammar.rules[grammar.symbols[node->symbol].firstRule + action];
 
-				boost::shared_ptr<Nonterminal> child = boost::shared_ptr<Nonterminal>(new Nonterminal("/", node->level, node->dist + 1, node->segmentLength));
-				node->children.push_back(child);
-				queue.push_back(child);
+		if (rule.hasAngle) {
+			node->angle = rule.angle;
+		}
+		if (rule.head >= 0) {
+			node->symbol = rule.head;
+			node->name = grammar.symbols[rule.head].name;
+		}
+		node->terminal = rule.hasAngle || grammar.isTerminal(node->symbol);
 
-				boost::shared_ptr<Nonterminal> grandchild = boost::shared_ptr<Nonterminal>(new Nonterminal("X", node->level, node->dist + 1, INITIAL_SEGMENT_LENGTH));
-				child->children.push_back(grandchild);
-				queue.push_back(grandchild);
-			}
-			else if (action == 2) {
-				node->name = "F";
-				node->terminal = true;
+		// 角度が決まったので、既にある子孫（同じ枝で後に続く記号）のmodel行列を更新する
+		if (rule.hasAngle) {
+			updateModelMatrices(node);
+		}
 
-				boost::shared_ptr<Nonterminal> child1 = boost::shared_ptr<Nonterminal>(new Nonterminal("/", node->level, node->dist + 1, node->segmentLength));
-				node->children.push_back(child1);
-				queue.push_back(child1);
+		// 置き換えた記号がまだnon-terminalなら、もう一度展開する
+		if (!node->terminal) {
+			queue.push_back(node);
+		}
 
-				boost::shared_ptr<Nonterminal> grandchild1 = boost::shared_ptr<Nonterminal>(new Nonterminal("X", node->level, node->dist + 1, INITIAL_SEGMENT_LENGTH));
-				child1->children.push_back(grandchild1);
-				queue.push_back(grandchild1);
+		for (int b = 0; b < rule.numBranches; ++b) {
+			const Grammar::Branch& branch = grammar.branches[rule.firstBranch + b];
 
-				boost::shared_ptr<Nonterminal> child2 = boost::shared_ptr<Nonterminal>(new Nonterminal("\\", node->level + 1, node->dist + 1, node->segmentLength));
-				node->children.push_back(child2);
-				queue.push_back(child2);
+			boost::shared_ptr<Nonterminal> parent = node;
+			for (int i = 0; i < branch.numSymbols; ++i) {
+				int symbol = grammar.branchSymbols[branch.firstSymbol + i];
+				float segmentLength = grammar.symbols[symbol].kind == Grammar::KIND_SEGMENT ? INITIAL_SEGMENT_LENGTH : node->segmentLength;
 
-				boost::shared_ptr<Nonterminal> grandchild2 = boost::shared_ptr<Nonterminal>(new Nonterminal("X", node->level + 1, node->dist + 1, INITIAL_SEGMENT_LENGTH));
-				child2->children.push_back(grandchild2);
-				queue.push_back(grandchild2);
+				boost::shared_ptr<Nonterminal> child = boost::shared_ptr<Nonterminal>(new Nonterminal(symbol, node->level + branch.levelOffset, node->dist + 1, segmentLength, 0.0f, grammar.isTerminal(symbol)));
+				child->modelMat = tipMatrix(parent);
+				parent->children.push_back(child);
+				if (!child->terminal) {
+					queue.push_back(child);
+				}
+
+				parent = child;
 			}
 		}
-		else if (node->name == "/") {
-			node->angle = action * 10 - 20;
-			node->terminal = true;
+	}
+
+	/**
+	 * grammarの開始記号のノードを作る。
+	 */
+	boost::shared_ptr<Nonterminal> createAxiom() {
+		return boost::shared_ptr<Nonterminal>(new Nonterminal(Grammar::current().axiom, 0, 0, INITIAL_SEGMENT_LENGTH));
+	}
+
+	/**
+	 * angleのruleで、actionに対応する回転角度[degree]を返す。
+	 */
+	float ruleAngle(int symbol, int action) {
+		const Grammar& grammar = Grammar::current();
+		return grammar.rules[grammar.symbols[symbol].firstRule + action].angle;
+	}
+
+	/**
+	 * refineで調整するパラメータを、derivation treeから前順に集める。
+	 * 同じトポロジーの木（clone）からは、同じ順番で集まる。確定済み（terminal）のノードのパラメータだけを集める。
+	 * 角度は、MCTSで選んだ値から角度の刻み幅分まで、セグメントの長さは、INITIAL_SEGMENT_LENGTHの0.5〜2倍の範囲で調整する。
+	 *
+	 * @param node			derivation treeのノード
+	 * @param params [OUT]	パラメータのリスト (末尾に追加される)
+	 */
+	void collectRefineParameters(const boost::shared_ptr<Nonterminal>& node, std::vector<RefineParameter>& params) {
+		if (node == NULL || node->symbol < 0) return;
+
+		const Grammar::Symbol& symbol = Grammar::current().symbols[node->symbol];
+		if (node->terminal && symbol.kind == Grammar::KIND_SEGMENT) {
+			RefineParameter param = { &node->segmentLength, INITIAL_SEGMENT_LENGTH * REFINE_MIN_LENGTH_RATIO, INITIAL_SEGMENT_LENGTH * REFINE_MAX_LENGTH_RATIO, INITIAL_SEGMENT_LENGTH * 0.25f, INITIAL_SEGMENT_LENGTH * 0.02f };
+			params.push_back(param);
+		}
+		else if (node->terminal && symbol.numRules >= 2) {
+			// 隣り合うactionの角度の差
+			float resolution = fabs(ruleAngle(node->symbol, 1) - ruleAngle(node->symbol, 0));
+			RefineParameter param = { &node->angle, node->angle - resolution, node->angle + resolution, resolution * 0.5f, resolution * 0.05f };
+			params.push_back(param);
 		}
-		else if (node->name == "\\") {
-			node->angle = action < 4 ? action * 20 - 90 : action * 20 - 50;
-			node->terminal = true;
+
+		for (int i = 0; i < node->children.size(); ++i) {
+			collectRefineParameters(node->children[i], params);
+		}
+	}
+
+	/**
+	 * derivation treeのセグメントの四角形 (中心の座標系、太さ、長さ、色) を集める。
+	 *
+	 * @param xf			nodeの根元の座標系
+	 * @param node			derivation treeのノード
+	 * @param quads [OUT]	四角形 (末尾に追加される)
+	 */
+	void collectSegments(const glutils::Rigid2D& xf, const boost::shared_ptr<Nonterminal>& node, glutils::Quads2D& quads) {
+		if (node->symbol < 0) return;
+
+		glutils::Rigid2D childXf;
+
+		if (Grammar::current().symbols[node->symbol].kind == Grammar::KIND_SEGMENT) {
+			// 確定したセグメント (F) は黒、未確定のセグメント (X) はグレー
+			glm::vec4 color = node->terminal ? glm::vec4(0, 0, 0, 1) : glm::vec4(0.5, 0.5, 0.5, 1);
+			quads.push_back(xf.translate(0, node->segmentLength * 0.5f), node->segmentWidth, node->segmentLength, color);
+			childXf = xf.translate(0, node->segmentLength);
+		}
+		else {
+			if (!node->terminal) return;
+			childXf = xf.rotate(node->angle / 180.0f * M_PI);
+		}
+
+		for (int i = 0; i < node->children.size(); ++i) {
+			collectSegments(childXf, node->children[i], quads);
+		}
+	}
+
+	/**
+	 * nodeの先端（子ノードの根元）のmodel行列を返す。generateGeometry()と同じ規則で行列を積む。
+	 * 角度がまだ決まっていない"/"、"\\"は、回転しないものとする（applyRuleで角度が決まった時に更新される）。
+	 *
+	 * @param node		derivation treeのノード (modelMatが設定済みであること)
+	 * @return			nodeの先端のmodel行列
+	 */
+	glm::mat4 tipMatrix(const boost::shared_ptr<Nonterminal>& node) {
+		if (node->symbol < 0) return node->modelMat;
+
+		if (Grammar::current().symbols[node->symbol].kind == Grammar::KIND_SEGMENT) {
+			return glm::translate(node->modelMat, glm::vec3(0, node->segmentLength, 0));
+		}
+		else {
+			return glm::rotate(node->modelMat, node->angle / 180.0f * M_PI, glm::vec3(0, 0, 1));
+		}
+	}
+
+	/**
+	 * nodeのmodelMatから、子孫の各ノードのmodelMatを計算し直す。
+	 *
+	 * @param node		derivation treeのノード (modelMatが設定済みであること)
+	 */
+	void updateModelMatrices(const boost::shared_ptr<Nonterminal>& node) {
+		if (node == NULL) return;
+
+		glm::mat4 mat = tipMatrix(node);
+		for (int i = 0; i < node->children.size(); ++i) {
+			node->children[i]->modelMat = mat;
+			updateModelMatrices(node->children[i]);
 		}
 	}
 
@@ -7,17 +7,29 @@
 #include <glm/gtx/string_cast.hpp>
 #include <list>
 #include <map>
+#include <functional>
+#include <atomic>
 #include "Vertex.h"
-#include <QImage>
+#include "GLUtils.h"
+#include "Profiler.h"
+#include "ResultSink.h"
+#include "Grammar.h"
+#include "Utils.h"
 
-class GLWidget3D;
 class RenderManager;
 
 namespace mcts {
 
+	// 組み込みのgrammar (Grammar::DEFAULT_GRAMMAR) のパラメータ (derivation treeを保存する際に、ファイルにも記録する)
+	extern const float INITIAL_SEGMENT_LENGTH;
+	extern const float INITIAL_SEGMENT_WIDTH;
+	extern const int MAX_LEVEL;
+	extern const int MAX_DIST;
+
 	class Nonterminal {
 	public:
 		std::string name;
+		int symbol;		// Grammar::current()の記号のindex (nameに対応する)
 		int level;
 		int dist;
 		float segmentLength;
@@ -25,9 +37,11 @@ namespace mcts {
 		float angle;
 		std::vector<boost::shared_ptr<Nonterminal> > children;
 		bool terminal; // trueなら、ruleは適用しない。もう確定ということ。
+		glm::mat4 modelMat;	// 根元のmodel行列 (applyRuleで更新する)
 
 	public:
 		Nonterminal(const std::string& name, int level, int dist, float segmentLength, float angle = 0.0f, bool terminal = false);
+		Nonterminal(int symbol, int level, int dist, float segmentLength, float angle = 0.0f, bool terminal = false);
 		boost::shared_ptr<Nonterminal> clone();
 	};
 
@@ -39,6 +53,8 @@ namespace mcts {
 		DerivationTree();
 		DerivationTree(const boost::shared_ptr<Nonterminal>& root);
 		DerivationTree clone() const;
+		std::string to_string() const;
+		bool recover(const std::string& str);
 	};
 
 	class State {
@@ -69,36 +85,82 @@ namespace mcts {
 
 	public:
 		MCTSTreeNode(const State& state);
-		boost::shared_ptr<MCTSTreeNode> UCTSelectChild();
-		int randomlySelectAction();
+		int maxChildren() const;
+		bool canExpand() const;
+		boost::shared_ptr<MCTSTreeNode> UCTSelectChild(utils::BatchRandom& random);
+		int selectNextAction();
 		boost::shared_ptr<MCTSTreeNode> bestChild();
 		void addValue(float value);
 	};
 
+	/**
+	 * MCTS::refine()で調整する連続パラメータ（"/"、"\\"の角度、またはセグメントの長さ）。
+	 */
+	struct RefineParameter {
+		float* value;		// derivation tree内の値へのポインタ
+		float minValue;
+		float maxValue;
+		float step;			// 現在のステップ幅
+		float minStep;		// これより小さくなったら、このパラメータの調整を終える
+	};
+
 	class MCTS {
+	public:
+		// derivationを1ステップ確定するたびに呼ばれる (ステップ番号, その時点のstate)
+		typedef std::function<void(int, const State&)> ProgressCallback;
+
 	private:
 		cv::Mat target;
 		cv::Mat targetDistMap;
-		GLWidget3D* glWidget;
+		RenderManager* renderManager;
+		glm::mat4 mvpMatrix;
+		Profiler profiler;
+		ProgressCallback progressCallback;
+		const std::atomic<bool>* cancelFlag;
+		boost::shared_ptr<ResultSink> resultSink;
+		bool profileOutput;
+		int maxRefineIterations;
+		utils::BatchRandom random;
 
 	public:
-		MCTS(const cv::Mat& target, GLWidget3D* glWidget);
+		MCTS(const cv::Mat& target, RenderManager* renderManager, const glm::mat4& mvpMatrix);
 
 		State inverse(int maxDerivationSteps, int maxMCTSIterations);
 		void randomGeneration(RenderManager* renderManager);
 		State mcts(const State& state, int maxMCTSIterations);
+		float refine(DerivationTree& derivationTree, int maxIterations);
 		boost::shared_ptr<MCTSTreeNode> select(const boost::shared_ptr<MCTSTreeNode>& rootNode);
 		boost::shared_ptr<MCTSTreeNode> expand(const boost::shared_ptr<MCTSTreeNode>& leafNode);
+		void orderActions(const boost::shared_ptr<MCTSTreeNode>& node);
+		float actionPrior(const boost::shared_ptr<Nonterminal>& nonterminal, const glm::mat4& modelMat, int action);
+		glm::vec2 project(const glm::mat4& modelMat, const glm::vec3& p);
+		float targetDistance(const glm::vec2& pixel);
 		float simulate(const boost::shared_ptr<MCTSTreeNode>& childNode);
 		void backpropage(const boost::shared_ptr<MCTSTreeNode>& childNode, float value);
 		float evaluate(const DerivationTree& derivationTree);
-		void render(const DerivationTree& derivationTree, QImage& image);
-		void generateGeometry(RenderManager* renderManager, const glm::mat4& modelMat, const boost::shared_ptr<Nonterminal>& node, std::vector<Vertex>& vertices);
+		void evaluate(const std::vector<DerivationTree>& derivationTrees, std::vector<float>& values);
+		void evaluateGeometries(const std::vector<std::vector<Vertex> >& geometries, std::vector<float>& values);
+		void render(const DerivationTree& derivationTree, cv::Mat& image);
+		const Profiler& getProfiler() const { return profiler; }
+		void setProgressCallback(const ProgressCallback& callback) { progressCallback = callback; }
+		void setCancelFlag(const std::atomic<bool>* cancelFlag) { this->cancelFlag = cancelFlag; }
+		bool isCancelled() const;
+		void setResultSink(const boost::shared_ptr<ResultSink>& resultSink) { this->resultSink = resultSink; }
+		void setProfileOutput(bool profileOutput) { this->profileOutput = profileOutput; }
+		void setRefineIterations(int maxRefineIterations) { this->maxRefineIterations = maxRefineIterations; }
+		void setSeed(uint32_t seed) { random.seed(seed); }
+		static void generateGeometry(RenderManager* renderManager, const glm::mat4& modelMat, const boost::shared_ptr<Nonterminal>& node, std::vector<Vertex>& vertices);
 	};
 
 	std::vector<int> actions(const boost::shared_ptr<Nonterminal>& nonterminal);
-	void randomDerivation(DerivationTree& derivationTree, std::list<boost::shared_ptr<Nonterminal> >& queue);
+	void randomDerivation(DerivationTree& derivationTree, std::list<boost::shared_ptr<Nonterminal> >& queue, utils::BatchRandom& random);
 	void applyRule(DerivationTree& derivationTree, const boost::shared_ptr<Nonterminal>& node, int action, std::list<boost::shared_ptr<Nonterminal> >& queue);
+	boost::shared_ptr<Nonterminal> createAxiom();
+	float ruleAngle(int symbol, int action);
+	void collectRefineParameters(const boost::shared_ptr<Nonterminal>& node, std::vector<RefineParameter>& params);
+	void collectSegments(const glutils::Rigid2D& xf, const boost::shared_ptr<Nonterminal>& node, glutils::Quads2D& quads);
+	glm::mat4 tipMatrix(const boost::shared_ptr<Nonterminal>& node);
+	void updateModelMatrices(const boost::shared_ptr<Nonterminal>& node);
 	float similarity(const cv::Mat& distMap, const cv::Mat& targetDistMap, float alpha, float beta);
 
 }
\ No newline at end of file
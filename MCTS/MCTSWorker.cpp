@@ -0,0 +1,80 @@
+#include "MCTSWorker.h"
+#include <QMetaType>
+
+/**
+ * @param target				ターゲットのスケッチ (8bit x 3ch)。内部でコピーを保持する。
+ * @param mvpMatrix				評価時の描画に使うmodel/view/projection行列
+ * @param maxDerivationSteps	derivationのステップ数
+ * @param maxMCTSIterations		各ステップでのMCTSのiteration数
+ */
+MCTSWorker::MCTSWorker(const cv::Mat& target, const glm::mat4& mvpMatrix, int maxDerivationSteps, int maxMCTSIterations) : cancelled(false) {
+	this->target = target.clone();
+	this->mvpMatrix = mvpMatrix;
+	this->maxDerivationSteps = maxDerivationSteps;
+	this->maxMCTSIterations = maxMCTSIterations;
+
+	qRegisterMetaType<mcts::DerivationTree>("mcts::DerivationTree");
+}
+
+/**
+ * 実行中なら、キャンセルして終了を待つ。GUIスレッドから破棄すること。
+ */
+MCTSWorker::~MCTSWorker() {
+	cancel();
+	thread.quit();
+	thread.wait();
+
+	// contextはrun()の最後にGUIスレッドに戻されているので、ここで破棄できる
+	context.reset();
+}
+
+/**
+ * 評価用のcontextを作成し、別スレッドで探索を開始する。GUIスレッドから呼び出すこと。
+ *
+ * @return		OpenGL contextが作成できなければfalse
+ */
+bool MCTSWorker::start() {
+	context = boost::shared_ptr<EvaluationContext>(new EvaluationContext());
+	if (!context->create()) {
+		context.reset();
+		return false;
+	}
+
+	context->moveToThread(&thread);
+	moveToThread(&thread);
+	connect(&thread, SIGNAL(started()), this, SLOT(run()));
+	thread.start();
+
+	return true;
+}
+
+/**
+ * 探索のキャンセルを要求する。どのスレッドから呼び出してもよい。
+ * 探索は現在のiterationを終えたところで止まり、その時点の最良のderivation treeでfinishedシグナルを送る。
+ */
+void MCTSWorker::cancel() {
+	cancelled = true;
+}
+
+bool MCTSWorker::isRunning() const {
+	return thread.isRunning();
+}
+
+void MCTSWorker::run() {
+	context->initGL(target.cols, target.rows);
+
+	mcts::MCTS mcts(target, &context->renderManager, mvpMatrix);
+	mcts.setCancelFlag(&cancelled);
+	mcts.setProgressCallback([this](int step, const mcts::State& state) {
+		emit progress(step, state.derivationTree.clone());
+	});
+	mcts::State state = mcts.inverse(maxDerivationSteps, maxMCTSIterations);
+
+	// GLのリソースを解放できるよう、contextをGUIスレッドに戻してからfinishedを送る
+	context->release();
+	moveToThread(context->surface.thread());
+
+	emit finished(state.derivationTree.clone(), cancelled);
+
+	thread.quit();
+}
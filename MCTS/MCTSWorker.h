@@ -0,0 +1,47 @@
+#pragma once
+
+#include "glew.h"
+#include <QObject>
+#include <QThread>
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include "MCTS.h"
+#include "EvaluationContext.h"
+
+Q_DECLARE_METATYPE(mcts::DerivationTree)
+
+/**
+ * MCTSによるinverse proceduralを、GUIスレッドとは別のスレッドで実行する。
+ * 評価用の描画には、専用のEvaluationContext（オフスクリーンのOpenGL context）を使うので、
+ * GLWidget3Dのcontextやrenderingとは干渉しない。
+ *
+ * derivationを1ステップ確定するたびに、その時点の最良のderivation treeのコピーをprogressシグナルで送る。
+ * シグナルはqueued connectionで受信側（GUI）スレッドに届くので、受信側では自由に使ってよい。
+ */
+class MCTSWorker : public QObject {
+	Q_OBJECT
+
+private:
+	cv::Mat target;
+	glm::mat4 mvpMatrix;
+	int maxDerivationSteps;
+	int maxMCTSIterations;
+	boost::shared_ptr<EvaluationContext> context;
+	QThread thread;
+	std::atomic<bool> cancelled;
+
+public:
+	MCTSWorker(const cv::Mat& target, const glm::mat4& mvpMatrix, int maxDerivationSteps, int maxMCTSIterations);
+	~MCTSWorker();
+
+	bool start();
+	void cancel();
+	bool isRunning() const;
+
+signals:
+	void progress(int step, const mcts::DerivationTree& derivationTree);
+	void finished(const mcts::DerivationTree& derivationTree, bool cancelled);
+
+private slots:
+	void run();
+};
@@ -10,6 +10,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 	connect(ui.actionSaveImage, SIGNAL(triggered()), this, SLOT(onSaveImage()));
 	connect(ui.actionSave3DMesh, SIGNAL(triggered()), this, SLOT(onSave3DMesh()));
 	connect(ui.actionMCTS, SIGNAL(triggered()), this, SLOT(onMCTS()));
+	connect(ui.actionStopMCTS, SIGNAL(triggered()), this, SLOT(onStopMCTS()));
 	connect(ui.actionRandomGeneration, SIGNAL(triggered()), this, SLOT(onRandomGeneration()));
 
 	glWidget = new GLWidget3D(this);
@@ -46,6 +47,10 @@ void MainWindow::onMCTS() {
 	glWidget->runMCTS();
 }
 
+void MainWindow::onStopMCTS() {
+	glWidget->stopMCTS();
+}
+
 void MainWindow::onRandomGeneration() {
 	glWidget->randomGeneration();
 }
\ No newline at end of file
@@ -14,141 +14,216 @@ namespace pmtree {
 	/**
 	* Shape ratioを返却する。
 	* 論文Cretion and rendering of realistic treesの4.3節に記載されている内容に基づく。
+	* shape idがコンパイル時に決まる場合は、分岐のないshapeRatio<shape>を使う。
 	*
-	* @param shape		shape id
 	* @param ratio		ratio
 	* @return			shape ratio
 	*/
-	float shapeRatio(int shape, float ratio) {
-		if (shape == 0) {
-			return 0.2f + 0.8f * ratio;
-		}
-		else if (shape == 1) {
-			return 0.2f + 0.8f * sinf(M_PI * ratio);
-		}
-		else if (shape == 2) {
-			return 0.2f + 0.8f * sinf(0.5f * M_PI * ratio);
-		}
-		else if (shape == 3) {
-			return 1.0f;
+	template<int SHAPE> float shapeRatio(float ratio) {
+		return 0.0f;
+	}
+
+	template<> float shapeRatio<0>(float ratio) {
+		return 0.2f + 0.8f * ratio;
+	}
+
+	template<> float shapeRatio<1>(float ratio) {
+		return 0.2f + 0.8f * sinf(M_PI * ratio);
+	}
+
+	template<> float shapeRatio<2>(float ratio) {
+		return 0.2f + 0.8f * sinf(0.5f * M_PI * ratio);
+	}
+
+	template<> float shapeRatio<3>(float ratio) {
+		return 1.0f;
+	}
+
+	template<> float shapeRatio<4>(float ratio) {
+		return 0.5f + 0.5f * ratio;
+	}
+
+	template<> float shapeRatio<5>(float ratio) {
+		if (ratio <= 0.7f) {
+			return ratio / 0.7f;
 		}
-		else if (shape == 4) {
-			return 0.5f + 0.5f * ratio;
+		else {
+			return (1.0f - ratio) / 0.3f;
 		}
-		else if (shape == 5) {
-			if (ratio <= 0.7f) {
-				return ratio / 0.7f;
-			}
-			else {
-				return (1.0f - ratio) / 0.3f;
-			}
+	}
+
+	template<> float shapeRatio<6>(float ratio) {
+		return 1.0f - 0.8f * ratio;
+	}
+
+	template<> float shapeRatio<7>(float ratio) {
+		if (ratio <= 0.7f) {
+			return 0.5f + 0.5f * ratio / 0.7f;
 		}
-		else if (shape == 6) {
-			return 1.0f - 0.8f * ratio;
+		else {
+			return 0.5f + 0.5f * (1.0f - ratio) / 0.3f;
 		}
-		else if (shape == 7) {
-			if (ratio <= 0.7f) {
-				return 0.5f + 0.5f * ratio / 0.7f;
-			}
-			else {
-				return 0.5f + 0.5f * (1.0f - ratio) / 0.3f;
-			}
+	}
+
+	typedef float (*ShapeRatioFunc)(float);
+	const ShapeRatioFunc SHAPE_RATIOS[] = { shapeRatio<0>, shapeRatio<1>, shapeRatio<2>, shapeRatio<3>, shapeRatio<4>, shapeRatio<5>, shapeRatio<6>, shapeRatio<7> };
+	const int NUM_SHAPES = sizeof(SHAPE_RATIOS) / sizeof(SHAPE_RATIOS[0]);
+
+	/**
+	* Shape ratioを返却する。shape idで関数のテーブルを引く。
+	*
+	* @param shape		shape id
+	* @param ratio		ratio
+	* @return			shape ratio (未知のshape idなら0)
+	*/
+	float shapeRatio(int shape, float ratio) {
+		if (shape < 0 || shape >= NUM_SHAPES) return 0.0f;
+		return SHAPE_RATIOS[shape](ratio);
+	}
+
+	/**
+	 * rand()を使う乱数 (utils::uniform)。generateRandom()で、これまでと同じ木を生成するために使う。
+	 */
+	struct GlobalRandom {
+		float uniform(float a, float b) {
+			return utils::uniform(a, b);
 		}
-		else {
-			return 0.0f;
+	};
+
+	PMTree2D::PMTree2D() {
+		clear();
+		addNode(-1, 0, 0, 10.0f / NUM_SEGMENTS, 0, 0, 0, 0);
+	}
+
+	void PMTree2D::clear() {
+		attenuationFactor.clear();
+		curveV.clear();
+		segmentLength.clear();
+		baseFactor.clear();
+		curve.clear();
+		curveBack.clear();
+		level.clear();
+		index.clear();
+		parent.clear();
+		firstChild.clear();
+		numChildren.clear();
+	}
+
+	/**
+	 * ノードを配列の末尾に追加し、親ノードの子ノードとして登録する。
+	 * 同じ親の子ノードは連続している必要があるので、幅優先の順に追加すること。
+	 *
+	 * @return		追加したノード
+	 */
+	int PMTree2D::addNode(int parent, int level, int index, float segmentLength, float attenuationFactor, float baseFactor, float curve, float curveBack) {
+		int node = curveV.size();
+
+		this->attenuationFactor.push_back(attenuationFactor);
+		this->curveV.push_back(0.0f);
+		this->segmentLength.push_back(segmentLength);
+		this->baseFactor.push_back(baseFactor);
+		this->curve.push_back(curve);
+		this->curveBack.push_back(curveBack);
+		this->level.push_back(level);
+		this->index.push_back(index);
+		this->parent.push_back(parent);
+		this->firstChild.push_back(-1);
+		this->numChildren.push_back(0);
+
+		if (parent >= 0) {
+			if (numChildren[parent] == 0) firstChild[parent] = node;
+			numChildren[parent]++;
 		}
+
+		return node;
 	}
 
-	TreeNode::TreeNode(boost::shared_ptr<TreeNode> parent, int level, int index, float segmentLength, float attenuationFactor, float baseFactor, float curve, float curveBack) {
-		this->parent = parent;
-		this->level = level;
-		this->index = index;
-		this->segmentLength = segmentLength;
-		this->baseFactor = baseFactor;
-		this->curve = curve;
-		this->curveBack = curveBack;
-		this->attenuationFactor = attenuationFactor;
-
-		attenuationFactor = 0.0f;
-		curveV = 0.0f;
+	std::string PMTree2D::nodeToString(int node) {
+		std::stringstream ss;
+		
+		ss << baseFactor[node] << "," << attenuationFactor[node] << "," << (curve[node] + 90) / 180.0f;
+
+		return ss.str();
 	}
 
-	void TreeNode::generateRandom() {
-		if (level == 0 && index == 0) {
-			baseFactor = utils::uniform(0.0f, 0.5f);
+	template<class Random> void PMTree2D::generateRandom(int node, Random& random) {
+		if (level[node] == 0 && index[node] == 0) {
+			baseFactor[node] = random.uniform(0.0f, 0.5f);
 		}
 		
-		if (index == 0) {
-			curve = utils::uniform(-90, 90);
-			curveBack = utils::uniform(-90, 90);
-			if (level > 0) {
-				curveV = utils::uniform(-90, 90);
+		if (index[node] == 0) {
+			curve[node] = random.uniform(-90, 90);
+			curveBack[node] = random.uniform(-90, 90);
+			if (level[node] > 0) {
+				curveV[node] = random.uniform(-90, 90);
 			}
 		}
 		else {
-			if (index < NUM_SEGMENTS / 2.0f) {
-				curveV = utils::uniform(-5, 5) + curve / NUM_SEGMENTS / 2.0f;
+			if (index[node] < NUM_SEGMENTS / 2.0f) {
+				curveV[node] = random.uniform(-5, 5) + curve[node] / NUM_SEGMENTS / 2.0f;
 			}
 			else {
-				curveV = utils::uniform(-5, 5) + curveBack / NUM_SEGMENTS / 2.0f;
+				curveV[node] = random.uniform(-5, 5) + curveBack[node] / NUM_SEGMENTS / 2.0f;
 			}
 		}
 	}
 
-	std::string TreeNode::to_string() {
-		std::stringstream ss;
-		
-		ss << baseFactor << "," << attenuationFactor << "," << (curve + 90) / 180.0f;
-
-		return ss.str();
+	/**
+	 * 木をランダムに生成する。乱数はrand()を使う。
+	 */
+	void PMTree2D::generateRandom() {
+		GlobalRandom random;
+		generateRandom(random);
 	}
 
-	void TreeNode::recover(const std::vector<float>& params) {
-		/*
-		attenuationFactor = params[0];
-		curve = params[1] * 180.0f - 90.0f;
-		*/
+	/**
+	 * 木をランダムに生成する。乱数の状態はrandomが持つので、複数のスレッドから別々のrandomで呼び出してよい。
+	 */
+	void PMTree2D::generateRandom(utils::BatchRandom& random) {
+		generateRandom<utils::BatchRandom>(random);
 	}
 
-	PMTree2D::PMTree2D() {
-		root = boost::shared_ptr<TreeNode>(new TreeNode(NULL, 0, 0, 0, 0, 0, 0, 0));
+	/**
+	 * numTrees個の木をランダムに生成する。1つのBatchRandomから乱数をまとめて生成し、
+	 * treesの各木の配列は再利用するので、多数の木を生成する場合に速い。
+	 *
+	 * @param numTrees		木の数
+	 * @param seed			乱数のseed (同じseedなら同じ木の列になる)
+	 * @param trees [OUT]	生成した木
+	 */
+	void PMTree2D::generateRandom(int numTrees, uint32_t seed, std::vector<PMTree2D>& trees) {
+		utils::BatchRandom random(seed);
+
+		trees.resize(numTrees);
+		for (int i = 0; i < numTrees; ++i) {
+			trees[i].generateRandom(random);
+		}
 	}
 
-	void PMTree2D::generateRandom() {
-		root = boost::shared_ptr<TreeNode>(new TreeNode(NULL, 0, 0, 10.0f / NUM_SEGMENTS, 1.0f, 0.0f, 0, 0));
-		root->generateRandom();
-
-		std::list<boost::shared_ptr<TreeNode> > queue;
-		queue.push_back(root);
+	template<class Random> void PMTree2D::generateRandom(Random& random) {
+		clear();
+		generateRandom(addNode(-1, 0, 0, 10.0f / NUM_SEGMENTS, 1.0f, 0.0f, 0, 0), random);
 
 		// generate random param values for branches in the breadth-first order
-		while (!queue.empty()) {
-			boost::shared_ptr<TreeNode> node = queue.front();
-			queue.pop_front();
-
-			if (node->index < NUM_SEGMENTS - 1) {
+		// (追加したノードは配列の末尾に並ぶので、配列をそのまま順に見ればキューと同じになる)
+		for (int node = 0; node < size(); ++node) {
+			if (index[node] < NUM_SEGMENTS - 1) {
 				// extend the segment
-				boost::shared_ptr<TreeNode> child = boost::shared_ptr<TreeNode>(new TreeNode(node, node->level, node->index + 1, node->segmentLength, 1.0f, node->baseFactor, node->curve, node->curveBack));
-				child->generateRandom();
-				node->children.push_back(child);
-				queue.push_back(child);
-
-				if (node->level < NUM_LEVELS - 1) {
-					if (node->level > 0 || node->index + 1 > NUM_SEGMENTS * node->baseFactor) {
-						if (utils::uniform(0, 1) > 0.5f) {
+				generateRandom(addNode(node, level[node], index[node] + 1, segmentLength[node], 1.0f, baseFactor[node], curve[node], curveBack[node]), random);
+
+				if (level[node] < NUM_LEVELS - 1) {
+					if (level[node] > 0 || index[node] + 1 > NUM_SEGMENTS * baseFactor[node]) {
+						if (random.uniform(0, 1) > 0.5f) {
 							// branching
 							float attenuationFactor;
-							if (node->level == 0) {
-								attenuationFactor = utils::uniform(0.5f, 0.8f) * shapeRatio(7, (NUM_SEGMENTS - node->index - 1) / (NUM_SEGMENTS * (1.0f - node->baseFactor)));
+							if (level[node] == 0) {
+								attenuationFactor = random.uniform(0.5f, 0.8f) * shapeRatio<7>((NUM_SEGMENTS - index[node] - 1) / (NUM_SEGMENTS * (1.0f - baseFactor[node])));
 							}
 							else {
-								attenuationFactor = utils::uniform(0.3f, 0.6f) * (NUM_SEGMENTS - node->index * 0.9f) / NUM_SEGMENTS;
+								attenuationFactor = random.uniform(0.3f, 0.6f) * (NUM_SEGMENTS - index[node] * 0.9f) / NUM_SEGMENTS;
 							}
 
-							boost::shared_ptr<TreeNode> child = boost::shared_ptr<TreeNode>(new TreeNode(node, node->level + 1, 0, node->segmentLength, attenuationFactor, 0.0f, 0.0f, 0.0f));
-							child->generateRandom();
-							node->children.push_back(child);
-							queue.push_back(child);
+							generateRandom(addNode(node, level[node] + 1, 0, segmentLength[node] * attenuationFactor, attenuationFactor, 0.0f, 0.0f, 0.0f), random);
 						}
 					}
 				}
@@ -157,242 +232,251 @@ namespace pmtree {
 	}
 
 	bool PMTree2D::generateGeometry(RenderManager* renderManager, bool fixed_width) {
-		bool underground = false;
-
-		glm::mat4 modelMat;
-		float length = 10.0f / NUM_SEGMENTS;
-		float width = 0.3f;
-		if (fixed_width) {
-			width = 0.03f;
-		}
-
 		std::vector<Vertex> vertices;
-		if (generateGeometry(renderManager, modelMat, length, width, fixed_width, root, glm::vec3(), glm::vec3(), vertices)) underground = true;
-		renderManager->addObject("tree", "", vertices, true);
+		bool underground = generateGeometry(fixed_width, vertices);
+		renderManager->addObject("tree", "", vertices, true, VertexLayout::FORMAT_COMPACT);
 
 		return underground;
 	}
 
-	bool PMTree2D::generateGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, glm::vec3& p0, glm::vec3& p1, std::vector<Vertex>& vertices) {
-		bool underground = false;
-
-		glm::mat4 mat = modelMat;
-
-		mat = glm::rotate(mat, node->curveV / 180.0f * M_PI, glm::vec3(0, 0, 1));
-
-		float w1 = segment_width;
-		if (!fixed_width) {
-			w1 = segment_width * (NUM_SEGMENTS - node->index) / NUM_SEGMENTS;
-		}
-		if (node->index == 0) {
-			p0 = glm::vec3(mat * glm::vec4(-w1 * 0.5f, 0, 0, 1));
-			p1 = glm::vec3(mat * glm::vec4(w1 * 0.5, 0, 0, 1));
-		}
-
-		float w2 = segment_width;
-		if (!fixed_width) {
-			w2 = segment_width * (NUM_SEGMENTS - node->index - 1) / NUM_SEGMENTS;
+	/**
+	 * 木の頂点を生成する。RenderManagerには登録しないので、GLのないスレッドからも呼び出せる。
+	 * 親ノードは子ノードより前にあるので、配列を先頭から順に見て、親ノードの座標系と枝の上端から各セグメントを作る。
+	 * 頂点数は (ノード数 x QUAD_VERTICES) なので、先に全て確保してから書き込み、セグメントごとのヒープ確保はしない。
+	 *
+	 * @param fixed_width		trueなら、枝の太さを一定（細い線）にする
+	 * @param vertices [OUT]	頂点 (末尾に追加される)
+	 * @return					幹の根元のセグメントが地面より下に伸びていればtrue
+	 */
+	bool PMTree2D::generateGeometry(bool fixed_width, std::vector<Vertex>& vertices) {
+		float width = 0.3f;
+		if (fixed_width) {
+			width = 0.03f;
 		}
-		glm::vec3 p2 = glm::vec3(mat * glm::vec4(w2 * 0.5, segment_length, 0, 1));
-		glm::vec3 p3 = glm::vec3(mat * glm::vec4(-w2 * 0.5, segment_length, 0, 1));
 
-		if (p2.y < 0 || p3.y < 0) underground = true;
+		// 各ノードのセグメントの上端の座標系、上端の左右の点、枝の太さ
+		std::vector<glm::mat4> mats(size());
+		std::vector<glm::vec3> tops(size() * 2);
+		std::vector<float> widths(size());
 
-		std::vector<glm::vec3> pts(4);
-		pts[0] = p0;
-		pts[1] = p1;
-		pts[2] = p2;
-		pts[3] = p3;
-		glutils::drawPolygon(pts, glm::vec4(0, 0, 0, 1), vertices);
+		bool underground = false;
+		glm::vec3 pts[4];
+		Vertex* out = glutils::appendSpan(vertices, size() * glutils::QUAD_VERTICES);
+		for (int node = 0; node < size(); ++node) {
+			glm::mat4 mat;
+			float segment_width = width;
+			if (parent[node] >= 0) {
+				mat = mats[parent[node]];
+				segment_width = widths[parent[node]];
+				if (index[node] == 0 && !fixed_width) {
+					// 分岐した枝は、親枝のセグメントの根元の太さに比例させる
+					segment_width = segment_width * (NUM_SEGMENTS - index[parent[node]]) / NUM_SEGMENTS * attenuationFactor[node];
+				}
+			}
+			widths[node] = segment_width;
 
-		mat = glm::translate(mat, glm::vec3(0, segment_length, 0));
+			mat = glm::rotate(mat, curveV[node] / 180.0f * M_PI, glm::vec3(0, 0, 1));
 
-		if (node->children.size() >= 1) {
-			// extend the segment
-			generateGeometry(renderManager, mat, segment_length, segment_width, fixed_width, node->children[0], pts[3], pts[2], vertices);
-		}
-		
-		if (node->children.size() >= 2) {
-			// branching
-			if (fixed_width) {
-				generateGeometry(renderManager, mat, segment_length * node->children[1]->attenuationFactor, segment_width, fixed_width, node->children[1], glm::vec3(), glm::vec3(), vertices);
+			float w1 = segment_width;
+			if (!fixed_width) {
+				w1 = segment_width * (NUM_SEGMENTS - index[node]) / NUM_SEGMENTS;
+			}
+			if (index[node] == 0) {
+				pts[0] = glm::vec3(mat * glm::vec4(-w1 * 0.5f, 0, 0, 1));
+				pts[1] = glm::vec3(mat * glm::vec4(w1 * 0.5, 0, 0, 1));
 			}
 			else {
-				generateGeometry(renderManager, mat, segment_length * node->children[1]->attenuationFactor, w1 * node->children[1]->attenuationFactor, fixed_width, node->children[1], glm::vec3(), glm::vec3(), vertices);
+				// 枝の延長は、親ノードのセグメントの上端につなげる
+				pts[0] = tops[parent[node] * 2];
+				pts[1] = tops[parent[node] * 2 + 1];
 			}
-		}
 
-		return underground;
-	}
-
-	void PMTree2D::generateTrainingData(const cv::Mat& image, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters) {
-		// 画像に空白マージンを付加する
-		int padding = 300;
-		cv::Mat imagePadded(image.rows + padding * 2, image.cols + padding * 2, image.type(), cv::Scalar(255));
-		image.copyTo(imagePadded(cv::Rect(padding, padding, image.cols, image.rows)));
-		//cv::imwrite("image_padded.jpg", imagePadded);
-
-		generateTrainingData(glm::mat4(), 10.0f / NUM_SEGMENTS, root, imagePadded, padding, camera, screenWidth, screenHeight, localImages, parameters);
-	}
-
-	void PMTree2D::generateTrainingData(const glm::mat4& modelMat, float segment_length, boost::shared_ptr<TreeNode>& node, const cv::Mat& imagePadded, int padding, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters) {
-		// 座標系を回転
-		glm::mat4 mat = modelMat;
-		mat = glm::rotate(mat, node->curveV / 180.0f * M_PI, glm::vec3(0, 0, 1));
-
-		// current positionを計算
-		glm::vec4 p(0, segment_length, 0, 1);
-		p = mat * p;
-		p = camera->mvpMatrix * p;
-		glm::vec2 pp((p.x / p.w + 1.0f) * 0.5f * screenWidth, screenHeight - (p.y / p.w + 1.0f) * 0.5f * screenHeight);
-
-		// current positionからsegment_length下がった点を計算
-		glm::vec4 p2(0, 0, 0, 1);
-		p2 = mat * p2;
-		p2 = camera->mvpMatrix * p2;
-		glm::vec2 pp2((p2.x / p2.w + 1.0f) * 0.5f * screenWidth, screenHeight - (p2.y / p2.w + 1.0f) * 0.5f * screenHeight);
-
-		// cropping sizeを計算
-		//float crop_size = glm::length(pp2 - pp) * 5.0f;
-		float crop_size = 64;
+			float w2 = segment_width;
+			if (!fixed_width) {
+				w2 = segment_width * (NUM_SEGMENTS - index[node] - 1) / NUM_SEGMENTS;
+			}
+			pts[2] = glm::vec3(mat * glm::vec4(w2 * 0.5, segmentLength[node], 0, 1));
+			pts[3] = glm::vec3(mat * glm::vec4(-w2 * 0.5, segmentLength[node], 0, 1));
 
-		if (crop_size <= 0) return;
+			if (node == 0 && (pts[2].y < 0 || pts[3].y < 0)) underground = true;
 
-		// matから、回転角度を抽出
-		float theta = asinf(mat[0][1]);
+			out = glutils::emitPolygon(pts, glm::vec4(0, 0, 0, 1), out);
 
-		// 画像を回転
-		cv::Mat rotatedImage;
-		cv::Mat affineMatrix = cv::getRotationMatrix2D(cv::Point2d(pp.x + padding, pp.y + padding), -theta / M_PI * 180, 1.0);
-		cv::warpAffine(imagePadded, rotatedImage, affineMatrix, imagePadded.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(255));
+			mats[node] = glm::translate(mat, glm::vec3(0, segmentLength[node], 0));
+			tops[node * 2] = pts[3];
+			tops[node * 2 + 1] = pts[2];
+		}
 
-		//cv::imwrite("image_rotated.jpg", rotatedImage);
+		return underground;
+	}
 
-		// 画像をcropping
-		cv::Rect roi(pp.x - crop_size / 2 + padding, pp.y - crop_size + padding, crop_size, crop_size);
-		cv::Mat croppedImage = rotatedImage(roi);
+	/**
+	 * 木を、頂点ではなく各セグメントのパラメータとして出力する。座標系の合成と四角形の生成は、
+	 * RenderManager::renderSegmentsLayeredでGPU上で行うので、generateGeometryよりCPUの処理がずっと少ない。
+	 * セグメントはノードと同じ順に並ぶ（親のセグメントの番号はparentと同じ）。
+	 *
+	 * @param fixed_width		trueなら、枝の太さを一定（細い線）にする
+	 * @param segments [OUT]	セグメント
+	 * @return					幹の根元のセグメントが地面より下に伸びていればtrue
+	 */
+	bool PMTree2D::generateSegments(bool fixed_width, std::vector<BranchSegment>& segments) {
+		float width = 0.3f;
+		if (fixed_width) {
+			width = 0.03f;
+		}
 
-		// 128x128にresize
-		cv::resize(croppedImage, croppedImage, cv::Size(128, 128));
-		cv::threshold(croppedImage, croppedImage, 200, 255, CV_THRESH_BINARY);
-		//cv::imwrite("image_cropped.jpg", croppedImage);
+		segments.resize(size());
+		std::vector<float> widths(size());
+		for (int node = 0; node < size(); ++node) {
+			float segment_width = width;
+			if (parent[node] >= 0) {
+				segment_width = widths[parent[node]];
+				if (index[node] == 0 && !fixed_width) {
+					// 分岐した枝は、親枝のセグメントの根元の太さに比例させる
+					segment_width = segment_width * (NUM_SEGMENTS - index[parent[node]]) / NUM_SEGMENTS * attenuationFactor[node];
+				}
+			}
+			widths[node] = segment_width;
 
-		localImages.push_back(croppedImage);
+			float w1 = segment_width;
+			float w2 = segment_width;
+			if (!fixed_width) {
+				w1 = segment_width * (NUM_SEGMENTS - index[node]) / NUM_SEGMENTS;
+				w2 = segment_width * (NUM_SEGMENTS - index[node] - 1) / NUM_SEGMENTS;
+			}
 
-		// パラメータを格納
-		std::vector<float> params;
-		if (node->children.size() >= 1) {
-			params.push_back(1);
-			params.push_back((node->children[0]->curveV + 90.0f) / 180.0f);
-		}
-		else {
-			params.push_back(0);
-			params.push_back(0.5);
-		}
-		if (node->children.size() >= 2) {
-			params.push_back(1);
-			params.push_back((node->children[1]->curveV + 90.0f) / 180.0f);
-			//params.push_back(node->children[1]->attenuationFactor);
-		}
-		else {
-			params.push_back(0);
-			params.push_back(0.5);
-			//params.push_back(0);
+			segments[node] = BranchSegment(curveV[node] / 180.0f * M_PI, segmentLength[node], w1, w2, parent[node], index[node] > 0 ? 1 : 0);
 		}
-		parameters.push_back(params);
 
-		mat = glm::translate(mat, glm::vec3(0, segment_length, 0));
+		// 幹の根元のセグメントの上端
+		float c = cosf(segments[0].angle);
+		float s = sinf(segments[0].angle);
+		for (int i = -1; i <= 1; i += 2) {
+			if (s * i * segments[0].width1 * 0.5f + c * segments[0].length < 0) return true;
+		}
 
-		// 子ノードの枝へ、再起処理
-		if (node->children.size() >= 1) {
-			generateTrainingData(mat, segment_length, node->children[0], imagePadded, padding, camera, screenWidth, screenHeight, localImages, parameters);
+		return false;
+	}
 
-			if (node->level <= 1 && node->children.size() >= 2) {
-				generateTrainingData(mat, segment_length * node->children[1]->attenuationFactor, node->children[1], imagePadded, padding, camera, screenWidth, screenHeight, localImages, parameters);
+	/**
+	 * 画像を、指定した点を中心に回転してから切り出し、リサイズしたパッチを返す。
+	 * 画像全体を回転（warpAffine）してから切り出すのと同じ結果になるが、パッチの各画素に対応する元画像の座標
+	 * （回転・切り出し・リサイズを1つのアフィン変換にまとめたもの）を直接計算し、その画素だけをサンプリングする。
+	 * 画像の外は白 (255) とする。
+	 *
+	 * @param image			元画像
+	 * @param anchor		回転の中心。パッチはこの点を下辺の中央とする
+	 * @param angle			回転角度 [degree] (cv::getRotationMatrix2Dと同じ向き)
+	 * @param cropSize		元画像での切り出しサイズ [pixel]
+	 * @param patchSize		パッチのサイズ [pixel]
+	 * @param patch [OUT]	パッチ (patchSize x patchSize、元画像と同じtype)
+	 */
+	void extractPatch(const cv::Mat& image, const cv::Point2f& anchor, float angle, int cropSize, int patchSize, cv::Mat& patch) {
+		// 回転後の画像の座標 → 元画像の座標
+		cv::Mat inverseMatrix;
+		cv::invertAffineTransform(cv::getRotationMatrix2D(anchor, angle, 1.0), inverseMatrix);
+		double a00 = inverseMatrix.at<double>(0, 0), a01 = inverseMatrix.at<double>(0, 1), a02 = inverseMatrix.at<double>(0, 2);
+		double a10 = inverseMatrix.at<double>(1, 0), a11 = inverseMatrix.at<double>(1, 1), a12 = inverseMatrix.at<double>(1, 2);
+
+		// パッチの画素 → 切り出し領域の座標 (cv::resizeのINTER_LINEARと同じ画素中心の対応) → 回転後の画像の座標
+		double scale = (double)cropSize / patchSize;
+		double left = anchor.x - cropSize * 0.5;
+		double top = anchor.y - cropSize;
+
+		cv::Mat mapX(patchSize, patchSize, CV_32F);
+		cv::Mat mapY(patchSize, patchSize, CV_32F);
+		for (int v = 0; v < patchSize; ++v) {
+			float* mx = mapX.ptr<float>(v);
+			float* my = mapY.ptr<float>(v);
+			double ry = top + (v + 0.5) * scale - 0.5;
+			for (int u = 0; u < patchSize; ++u) {
+				double rx = left + (u + 0.5) * scale - 0.5;
+				mx[u] = (float)(a00 * rx + a01 * ry + a02);
+				my[u] = (float)(a10 * rx + a11 * ry + a12);
 			}
 		}
-	}
 
-	std::string PMTree2D::to_string() {
-		std::stringstream ss;
-		bool first_node = true;
-
-		std::list<boost::shared_ptr<TreeNode> > queue;
-		queue.push_back(root);
+		cv::remap(image, patch, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::all(255));
+	}
 
-		while (!queue.empty()) {
-			boost::shared_ptr<TreeNode> node = queue.front();
-			queue.pop_front();
-			
-			if (first_node) {
-				first_node = false;
+	/**
+	 * 描画した木の画像から、各ノードの位置のパッチと、その子ノードのパラメータを学習データとして取り出す。
+	 * ノードは幅優先の順に出力する。
+	 */
+	void PMTree2D::generateTrainingData(const cv::Mat& image, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters) {
+		// 各ノードのセグメントの上端の座標系
+		std::vector<glm::mat4> mats(size());
+
+		localImages.reserve(localImages.size() + size());
+		parameters.reserve(parameters.size() + size());
+
+		for (int node = 0; node < size(); ++node) {
+			// 座標系を回転
+			glm::mat4 mat;
+			if (parent[node] >= 0) mat = mats[parent[node]];
+			mat = glm::rotate(mat, curveV[node] / 180.0f * M_PI, glm::vec3(0, 0, 1));
+			mats[node] = glm::translate(mat, glm::vec3(0, segmentLength[node], 0));
+
+			// current positionを計算
+			glm::vec4 p(0, segmentLength[node], 0, 1);
+			p = mat * p;
+			p = camera->mvpMatrix * p;
+			glm::vec2 pp((p.x / p.w + 1.0f) * 0.5f * screenWidth, screenHeight - (p.y / p.w + 1.0f) * 0.5f * screenHeight);
+
+			// cropping sizeを計算
+			float crop_size = 64;
+
+			// matから、回転角度を抽出
+			float theta = asinf(mat[0][1]);
+
+			// 画像を回転してcroppingし、128x128にresize（パッチの画素だけをサンプリングする）
+			cv::Mat croppedImage;
+			extractPatch(image, cv::Point2f(pp.x, pp.y), -theta / M_PI * 180, crop_size, 128, croppedImage);
+			cv::threshold(croppedImage, croppedImage, 200, 255, CV_THRESH_BINARY);
+
+			localImages.push_back(croppedImage);
+
+			// パラメータを格納
+			std::vector<float> params(4);
+			if (numChildren[node] >= 1) {
+				params[0] = 1;
+				params[1] = (curveV[firstChild[node]] + 90.0f) / 180.0f;
 			}
 			else {
-				ss << ",";
+				params[0] = 0;
+				params[1] = 0.5;
 			}
-			
-			ss << node->to_string();
-
-			for (int i = 0; i < node->children.size(); ++i) {
-				queue.push_back(node->children[i]);
+			if (numChildren[node] >= 2) {
+				params[2] = 1;
+				params[3] = (curveV[firstChild[node] + 1] + 90.0f) / 180.0f;
+			}
+			else {
+				params[2] = 0;
+				params[3] = 0.5;
 			}
+			parameters.push_back(params);
 		}
+	}
 
-		return ss.str();
+	std::string PMTree2D::to_string() {
+		return to_string(size());
 	}
 
 	std::string PMTree2D::to_string(int index) {
 		std::stringstream ss;
-		bool first_node = true;
-
-		std::list<boost::shared_ptr<TreeNode> > queue;
-		queue.push_back(root);
 
-		int count = 0;
-		while (!queue.empty()) {
-			boost::shared_ptr<TreeNode> node = queue.front();
-			queue.pop_front();
-
-			if (first_node) {
-				first_node = false;
-			}
-			else {
+		// ノードは幅優先の順に並んでいるので、先頭からindex個を出力する
+		for (int node = 0; node < size() && node < index; ++node) {
+			if (node > 0) {
 				ss << ",";
 			}
 
-			ss << node->to_string();
-
-			for (int i = 0; i < node->children.size(); ++i) {
-				queue.push_back(node->children[i]);
-			}
-
-			count++;
-			if (count >= index) break;
+			ss << nodeToString(node);
 		}
 
 		return ss.str();
 	}
 
 	void PMTree2D::recover(const std::vector<std::vector<float> >& params) {
-		/*
-		root = boost::shared_ptr<TreeNode>(new TreeNode(NULL, 0, 0));
-		std::list<boost::shared_ptr<TreeNode> > queue;
-		queue.push_back(root);
-
-		int count = 0;
-		while (!queue.empty()) {
-			boost::shared_ptr<TreeNode> node = queue.front();
-			queue.pop_front();
-
-			node->recover(params[count++]);
-			if (node->level < NUM_LEVELS - 1) {
-				for (int k = 0; k < node->branching.size(); ++k) {
-					boost::shared_ptr<TreeNode> child = boost::shared_ptr<TreeNode>(new TreeNode(node, node->level + 1, k));
-					node->children.push_back(child);
-					queue.push_back(child);
-				}
-			}
-		}
-		*/
 	}
 }
\ No newline at end of file
@@ -1,10 +1,10 @@
 ﻿#pragma once
 
 #include <glm/glm.hpp>
-#include "boost/shared_ptr.hpp"
 #include <string>
 #include <vector>
 #include "Vertex.h"
+#include "Utils.h"
 #include <opencv2/opencv.hpp>
 
 class RenderManager;
@@ -12,45 +12,48 @@ class Camera;
 
 namespace pmtree {
 	float shapeRatio(int shape, float ratio);
+	void extractPatch(const cv::Mat& image, const cv::Point2f& anchor, float angle, int cropSize, int patchSize, cv::Mat& patch);
 
-	class TreeNode {
-	public:
-		float attenuationFactor;	// 親枝に対する長さの比率
-		float curveV;
-
-		int level;
-		int index;
-		float segmentLength;
-		float baseFactor;			// この枝の根元部分の割合
-		float curve;				// この枝の全体的な曲率（前半部分）
-		float curveBack;			// この枝の全体的な曲率（後半部分）
-		boost::shared_ptr<TreeNode> parent;
-		std::vector<boost::shared_ptr<TreeNode> > children;
-
-	public:
-		TreeNode(boost::shared_ptr<TreeNode> parent, int level, int index, float segmentLength, float attenuationFactor, float baseFactor, float curve, float curveBack);
-		void generateRandom();
-		std::string to_string();
-		void recover(const std::vector<float>& params);
-	};
-
+	/**
+	 * 木を、ノードごとの値の配列 (structure of arrays) で表す。
+	 * ノードは幅優先の順に並んでいて、子ノードは親ノードより後ろにあり、同じ親の子ノードは連続している。
+	 * 各ノードの子ノードは、最大で2つ (最初が枝の延長、2つ目が分岐した枝) である。
+	 */
 	class PMTree2D {
 	public:
-		boost::shared_ptr<TreeNode> root;
+		std::vector<float> attenuationFactor;	// 親枝に対する長さの比率
+		std::vector<float> curveV;
+		std::vector<float> segmentLength;		// このセグメントの長さ (分岐した枝は、親枝のセグメントの長さ x attenuationFactor)
+		std::vector<float> baseFactor;			// この枝の根元部分の割合
+		std::vector<float> curve;				// この枝の全体的な曲率（前半部分）
+		std::vector<float> curveBack;			// この枝の全体的な曲率（後半部分）
+		std::vector<int> level;
+		std::vector<int> index;
+		std::vector<int> parent;				// 親ノード (ルートは-1)
+		std::vector<int> firstChild;			// 最初の子ノード (子ノードがなければ-1)
+		std::vector<int> numChildren;
 
 	public:
 		PMTree2D();
 
+		int size() const { return curveV.size(); }
+		void clear();
 		void generateRandom();
+		void generateRandom(utils::BatchRandom& random);
+		static void generateRandom(int numTrees, uint32_t seed, std::vector<PMTree2D>& trees);
 		bool generateGeometry(RenderManager* renderManager, bool fixed_width);
+		bool generateGeometry(bool fixed_width, std::vector<Vertex>& vertices);
+		bool generateSegments(bool fixed_width, std::vector<BranchSegment>& segments);
 		void generateTrainingData(const cv::Mat& image, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters);
-		void generateTrainingData(const glm::mat4& modelMat, float segment_length, boost::shared_ptr<TreeNode>& node, const cv::Mat& imagePadded, int padding, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters);
 		std::string to_string();
 		std::string to_string(int index);
 		void recover(const std::vector<std::vector<float> >& params);
 
 	private:
-		bool generateGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, glm::vec3& p0, glm::vec3& p1, std::vector<Vertex>& vertices);
+		int addNode(int parent, int level, int index, float segmentLength, float attenuationFactor, float baseFactor, float curve, float curveBack);
+		template<class Random> void generateRandom(Random& random);
+		template<class Random> void generateRandom(int node, Random& random);
+		std::string nodeToString(int node);
 	};
 
 }
\ No newline at end of file
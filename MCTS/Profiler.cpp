@@ -0,0 +1,283 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+#include <QFileInfo>
+#include <QDir>
+
+namespace {
+
+	/**
+	 * 登録された区間名 (idの順)。他のファイルの名前空間スコープの定数から登録されるので、
+	 * 初期化順に依存しないよう関数内のstatic変数にする。
+	 */
+	std::vector<std::string>& phaseNames() {
+		static std::vector<std::string> names;
+		return names;
+	}
+
+	std::mutex& phaseMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+}
+
+Profiler::ScopedTimer::ScopedTimer(Profiler* profiler, Phase phase) {
+	this->profiler = profiler;
+	this->phase = phase;
+	if (profiler != NULL) {
+		timer.start();
+	}
+}
+
+Profiler::ScopedTimer::~ScopedTimer() {
+	if (profiler != NULL) {
+		profiler->addSample(phase, timer.nsecsElapsed() * 1e-9);
+	}
+}
+
+Profiler::Profiler() {
+	wallTime = 0.0;
+}
+
+/**
+ * 区間名のidを返す。初めての名前なら登録する。
+ * 名前の検索にはロックを取るので、計測のたびではなく、起動時に一度だけ呼び出して定数にしておくこと。
+ *
+ * @param name		区間名
+ * @return			区間のid
+ */
+Profiler::Phase Profiler::phase(const char* name) {
+	std::lock_guard<std::mutex> lock(phaseMutex());
+
+	std::vector<std::string>& names = phaseNames();
+	for (int i = 0; i < names.size(); ++i) {
+		if (names[i] == name) return i;
+	}
+	names.push_back(name);
+	return names.size() - 1;
+}
+
+std::string Profiler::phaseName(Phase phase) {
+	std::lock_guard<std::mutex> lock(phaseMutex());
+
+	std::vector<std::string>& names = phaseNames();
+	if (phase < 0 || phase >= names.size()) return "";
+	return names[phase];
+}
+
+void Profiler::reset() {
+	phases.clear();
+	counters.clear();
+	order.clear();
+	wallTime = 0.0;
+}
+
+/**
+ * 全体の経過時間の計測を開始する。
+ */
+void Profiler::start() {
+	wallTimer.start();
+}
+
+void Profiler::stop() {
+	wallTime = wallTimer.nsecsElapsed() * 1e-9;
+}
+
+/**
+ * 全体の経過時間 [sec] を返す。stop()の前なら、現在までの経過時間を返す。
+ */
+double Profiler::elapsed() const {
+	if (wallTime > 0.0 || !wallTimer.isValid()) return wallTime;
+	return wallTimer.nsecsElapsed() * 1e-9;
+}
+
+void Profiler::addSample(Phase phase, double seconds) {
+	if (phase < 0) return;
+
+	if (phase >= phases.size()) {
+		PhaseData empty = { 0, 0.0, 0.0, { 0 } };
+		phases.resize(phase + 1, empty);
+	}
+
+	PhaseData& data = phases[phase];
+	if (data.count == 0) order.push_back(phase);
+	data.count++;
+	data.total += seconds;
+	data.max = (std::max)(data.max, seconds);
+	data.bins[fineBin(seconds)]++;
+}
+
+void Profiler::addCount(const std::string& counter, long long n) {
+	counters[counter] += n;
+}
+
+long long Profiler::count(const std::string& counter) const {
+	auto it = counters.find(counter);
+	if (it == counters.end()) return 0;
+	return it->second;
+}
+
+/**
+ * 経過時間を、細かいヒストグラムのビンに対応させる。
+ * ビン0は1us未満、[2^(e-1), 2^e) usはHISTOGRAM_SUB_BINS個に等分し、最後のオクターブより長いものは最後のビンに入れる。
+ */
+int Profiler::fineBin(double seconds) {
+	double us = seconds * 1e6;
+	if (us < 1.0) return 0;
+
+	int e;
+	double m = frexp(us, &e);	// us = m * 2^e, m in [0.5, 1)
+	if (e > NUM_HISTOGRAM_BINS - 1) return NUM_FINE_BINS - 1;
+
+	int sub = (std::min)((int)((m * 2.0 - 1.0) * HISTOGRAM_SUB_BINS), HISTOGRAM_SUB_BINS - 1);
+	return 1 + (e - 1) * HISTOGRAM_SUB_BINS + sub;
+}
+
+/**
+ * 細かいヒストグラムのビンの中央の値 [sec] を返す。
+ */
+double Profiler::fineBinCenter(int bin) {
+	if (bin == 0) return 0.5e-6;
+
+	int e = (bin - 1) / HISTOGRAM_SUB_BINS + 1;
+	int sub = (bin - 1) % HISTOGRAM_SUB_BINS;
+	return ldexp(1.0 + (sub + 0.5) / HISTOGRAM_SUB_BINS, e - 1) * 1e-6;
+}
+
+/**
+ * ヒストグラムから、pパーセンタイルの値 [sec] を求める（サンプルを昇順に並べた時の(count - 1) * p / 100番目）。
+ * ビンの中央の値を返すので、誤差はビンの幅の半分（約6%）以内。最大値を超えないようにする。
+ */
+double Profiler::percentile(const PhaseData& data, int p) const {
+	long long rank = (data.count - 1) * p / 100;
+	long long cumulative = 0;
+	for (int i = 0; i < NUM_FINE_BINS; ++i) {
+		cumulative += data.bins[i];
+		if (cumulative > rank) return (std::min)(fineBinCenter(i), data.max);
+	}
+	return data.max;
+}
+
+/**
+ * 指定した区間の統計量を計算する。
+ *
+ * @param phase		区間のid
+ * @return			統計量 (サンプルがなければ全て0)
+ */
+Profiler::PhaseStats Profiler::stats(Phase phase) const {
+	PhaseStats ret = { 0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	if (phase < 0 || phase >= phases.size() || phases[phase].count == 0) return ret;
+
+	const PhaseData& data = phases[phase];
+	ret.count = data.count;
+	ret.total = data.total;
+	ret.mean = data.total / data.count;
+	ret.p50 = percentile(data, 50);
+	ret.p99 = percentile(data, 99);
+	ret.max = data.max;
+
+	return ret;
+}
+
+/**
+ * 指定した区間のサンプル数を、2のべき乗[us]のビンごとに返す。
+ * ビン0は1us未満、ビンiは[2^(i-1), 2^i) us、最後のビンはそれ以上全て。
+ *
+ * @param phase		区間のid
+ * @return			各ビンのサンプル数
+ */
+std::vector<int> Profiler::histogram(Phase phase) const {
+	std::vector<int> bins(NUM_HISTOGRAM_BINS, 0);
+	if (phase < 0 || phase >= phases.size()) return bins;
+
+	const PhaseData& data = phases[phase];
+	bins[0] = data.bins[0];
+	for (int i = 1; i < NUM_FINE_BINS; ++i) {
+		bins[(i - 1) / HISTOGRAM_SUB_BINS + 1] += data.bins[i];
+	}
+
+	return bins;
+}
+
+void Profiler::print(std::ostream& out) const {
+	out << "Wall time: " << elapsed() << " sec" << std::endl;
+	for (auto it = counters.begin(); it != counters.end(); ++it) {
+		out << it->first << ": " << it->second;
+		if (elapsed() > 0.0) out << " (" << it->second / elapsed() << "/sec)";
+		out << std::endl;
+	}
+	for (int i = 0; i < order.size(); ++i) {
+		PhaseStats s = stats(order[i]);
+		out << phaseName(order[i]) << ": total " << s.total << " sec, #" << s.count << ", p50 " << s.p50 * 1000.0 << " ms, p99 " << s.p99 * 1000.0 << " ms" << std::endl;
+	}
+}
+
+/**
+ * 計測結果をJSONファイルに出力する。
+ *
+ * @param filename		出力ファイル名
+ * @param label			この計測の名前（日時や条件など）
+ */
+void Profiler::exportJson(const std::string& filename, const std::string& label) const {
+	QDir().mkpath(QFileInfo(filename.c_str()).absolutePath());
+
+	std::ofstream out(filename.c_str());
+	out << std::setprecision(9);
+	out << "{" << std::endl;
+	out << "\t\"label\": \"" << label << "\"," << std::endl;
+	out << "\t\"wall_time\": " << elapsed() << "," << std::endl;
+
+	out << "\t\"counters\": {";
+	for (auto it = counters.begin(); it != counters.end(); ++it) {
+		if (it != counters.begin()) out << ",";
+		out << std::endl << "\t\t\"" << it->first << "\": { \"count\": " << it->second << ", \"per_sec\": " << (elapsed() > 0.0 ? it->second / elapsed() : 0.0) << " }";
+	}
+	out << std::endl << "\t}," << std::endl;
+
+	out << "\t\"phases\": {";
+	for (int i = 0; i < order.size(); ++i) {
+		PhaseStats s = stats(order[i]);
+		if (i > 0) out << ",";
+		out << std::endl << "\t\t\"" << phaseName(order[i]) << "\": { \"count\": " << s.count << ", \"total\": " << s.total << ", \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << ", \"histogram_us_log2\": [";
+		std::vector<int> bins = histogram(order[i]);
+		for (int k = 0; k < bins.size(); ++k) {
+			if (k > 0) out << ", ";
+			out << bins[k];
+		}
+		out << "] }";
+	}
+	out << std::endl << "\t}" << std::endl;
+	out << "}" << std::endl;
+}
+
+/**
+ * 計測結果をCSVファイルに追記する。ファイルがなければヘッダを付けて作成する。
+ * 1行に1区間（またはカウンタ）ずつ出力するので、区間が増減しても列はずれない。
+ *
+ * @param filename		出力ファイル名
+ * @param label			この計測の名前（日時や条件など）
+ */
+void Profiler::appendCsv(const std::string& filename, const std::string& label) const {
+	QDir().mkpath(QFileInfo(filename.c_str()).absolutePath());
+	bool exists = QFileInfo(filename.c_str()).exists();
+
+	std::ofstream out(filename.c_str(), std::ios::app);
+	out << std::setprecision(9);
+	if (!exists) {
+		out << "label,kind,name,count,per_sec,total,mean,p50,p99,max" << std::endl;
+	}
+
+	double wall = elapsed();
+	out << label << ",run,wall_time,1,," << wall << ",,,," << std::endl;
+	for (auto it = counters.begin(); it != counters.end(); ++it) {
+		out << label << ",counter," << it->first << "," << it->second << "," << (wall > 0.0 ? it->second / wall : 0.0) << ",,,,," << std::endl;
+	}
+	for (int i = 0; i < order.size(); ++i) {
+		PhaseStats s = stats(order[i]);
+		out << label << ",phase," << phaseName(order[i]) << "," << s.count << "," << (wall > 0.0 ? s.count / wall : 0.0) << "," << s.total << "," << s.mean << "," << s.p50 << "," << s.p99 << "," << s.max << std::endl;
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+
+/**
+ * 処理時間を区間ごとに計測するプロファイラ。
+ * ScopedTimerで計測した各区間の回数、合計、最大値と、固定サイズのヒストグラムを持ち、p50/p99はヒストグラムから求めて、JSON/CSVに出力する。
+ * サンプルを全て保存しないので、長時間探索してもメモリ使用量は増えない。
+ * 区間はネストしてよい（例えば、"simulate"の中に"render"、"render"の中に"readback"）。
+ *
+ * 区間は、Profiler::phase()で登録したidで指定する。ScopedTimerのたびに区間名を検索しないよう、
+ * 使う側のファイルで、名前空間スコープの定数として起動時に一度だけ登録しておく。
+ *   const Profiler::Phase PHASE_CLONE = Profiler::phase("clone");
+ */
+class Profiler {
+public:
+	typedef int Phase;
+
+	/**
+	 * スコープを抜けるまでの経過時間を、指定した区間のサンプルとして記録する。
+	 * profilerがNULLの場合は何もしない。
+	 */
+	class ScopedTimer {
+	private:
+		Profiler* profiler;
+		Phase phase;
+		QElapsedTimer timer;
+
+	public:
+		ScopedTimer(Profiler* profiler, Phase phase);
+		~ScopedTimer();
+	};
+
+	struct PhaseStats {
+		long long count;
+		double total;	// [sec]
+		double mean;	// [sec]
+		double p50;		// [sec] (ヒストグラムのビンの中央の値)
+		double p99;		// [sec] (ヒストグラムのビンの中央の値)
+		double max;		// [sec]
+	};
+
+	// ヒストグラムのビン数（1us未満、1-2us、2-4us、...）
+	static const int NUM_HISTOGRAM_BINS = 24;
+
+	// p50/p99を求めるために、ヒストグラムの各ビン（1us未満以外）をさらに分割する数
+	static const int HISTOGRAM_SUB_BINS = 8;
+	static const int NUM_FINE_BINS = 1 + (NUM_HISTOGRAM_BINS - 1) * HISTOGRAM_SUB_BINS;
+
+private:
+	struct PhaseData {
+		long long count;
+		double total;
+		double max;
+		int bins[NUM_FINE_BINS];
+	};
+
+	std::vector<PhaseData> phases;	// 区間のidごと
+	std::map<std::string, long long> counters;
+	std::vector<Phase> order;		// 区間を最初に記録した順
+	QElapsedTimer wallTimer;
+	double wallTime;
+
+public:
+	Profiler();
+
+	static Phase phase(const char* name);
+	static std::string phaseName(Phase phase);
+
+	void reset();
+	void start();
+	void stop();
+	double elapsed() const;
+	void addSample(Phase phase, double seconds);
+	void addCount(const std::string& counter, long long n = 1);
+	long long count(const std::string& counter) const;
+	PhaseStats stats(Phase phase) const;
+	std::vector<int> histogram(Phase phase) const;
+	void print(std::ostream& out) const;
+	void exportJson(const std::string& filename, const std::string& label) const;
+	void appendCsv(const std::string& filename, const std::string& label) const;
+
+private:
+	static int fineBin(double seconds);
+	static double fineBinCenter(int bin);
+	double percentile(const PhaseData& data, int p) const;
+};
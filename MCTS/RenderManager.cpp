@@ -4,26 +4,193 @@
 #include <QImage>
 #include <QGLWidget>
 #include <sstream>
+#include <algorithm>
+#include <tuple>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// shadow mapの解像度を自動で決める際の、シーン1単位あたりのtexel数
+const float SHADOW_MAP_TEXELS_PER_UNIT = 40.0f;
+const int MIN_SHADOW_MAP_SIZE = 512;
+const int MAX_SHADOW_MAP_SIZE = 4096;
+
+// renderLayeredで一度に描画するレイヤー数の上限
+const int MAX_RENDER_LAYERS = 32;
+
+// readLayersの読み出し時間を記録する区間
+const Profiler::Phase PHASE_READBACK = Profiler::phase("readback");
+
+/**
+ * renderLayered用の頂点。position, color (unorm8 x 4), 描画先のレイヤー番号 = 20 bytes
+ */
+struct LayeredVertex {
+	glm::vec3 position;
+	glm::uint32 color;
+	GLint layer;
+};
+
+VertexLayout::VertexLayout(int format) {
+	this->format = format;
+
+	if (format == FORMAT_COMPACT) {
+		// position (float x 3), normal (10/10/10/2 snorm, drawEdgeはwに格納), color (unorm8 x 4), uv (half x 2) = 24 bytes
+		stride = 24;
+		attributes.push_back(VertexAttribute(0, 3, GL_FLOAT, GL_FALSE, 0));
+		attributes.push_back(VertexAttribute(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 12));
+		attributes.push_back(VertexAttribute(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 16));
+		attributes.push_back(VertexAttribute(3, 2, GL_HALF_FLOAT, GL_FALSE, 20));
+	}
+	else if (format == FORMAT_POSITION) {
+		// position (float x 3) = 12 bytes
+		stride = sizeof(glm::vec3);
+		attributes.push_back(VertexAttribute(0, 3, GL_FLOAT, GL_FALSE, 0));
+	}
+	else {
+		stride = sizeof(Vertex);
+		attributes.push_back(VertexAttribute(0, 3, GL_FLOAT, GL_FALSE, 0));
+		attributes.push_back(VertexAttribute(1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal)));
+		attributes.push_back(VertexAttribute(2, 4, GL_FLOAT, GL_FALSE, offsetof(Vertex, color)));
+		attributes.push_back(VertexAttribute(3, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texCoord)));
+		attributes.push_back(VertexAttribute(4, 1, GL_FLOAT, GL_FALSE, offsetof(Vertex, drawEdge)));
+	}
+}
+
+/**
+ * Return the layout descriptor of the specified format.
+ */
+const VertexLayout& VertexLayout::get(int format) {
+	static const VertexLayout layouts[NUM_FORMATS] = { VertexLayout(FORMAT_FULL), VertexLayout(FORMAT_COMPACT), VertexLayout(FORMAT_POSITION) };
+
+	if (format < 0 || format >= NUM_FORMATS) return layouts[FORMAT_FULL];
+	return layouts[format];
+}
+
+/**
+ * Convert the vertices into the byte array to be uploaded to the VBO.
+ *
+ * @param vertices		vertices
+ * @param data [OUT]	packed vertex data
+ */
+void VertexLayout::pack(const std::vector<Vertex>& vertices, std::vector<unsigned char>& data) const {
+	data.resize(stride * vertices.size());
+	if (vertices.empty()) return;
+
+	if (format == FORMAT_FULL) {
+		memcpy(data.data(), vertices.data(), data.size());
+		return;
+	}
+
+	unsigned char* p = data.data();
+	for (int i = 0; i < vertices.size(); ++i, p += stride) {
+		memcpy(p, &vertices[i].position, sizeof(glm::vec3));
+		if (format == FORMAT_POSITION) continue;
+
+		glm::uint32 normal = glm::packSnorm3x10_1x2(glm::vec4(vertices[i].normal, vertices[i].drawEdge));
+		glm::uint32 color = glm::packUnorm4x8(glm::clamp(vertices[i].color, 0.0f, 1.0f));
+		glm::uint32 texCoord = glm::packHalf2x16(vertices[i].texCoord);
+		memcpy(p + 12, &normal, 4);
+		memcpy(p + 16, &color, 4);
+		memcpy(p + 20, &texCoord, 4);
+	}
+}
+
+/**
+ * Configure the attributes of the currently bound VAO according to this layout.
+ * The attributes that are not contained in this layout are disabled.
+ */
+void VertexLayout::configure() const {
+	for (GLuint location = 0; location <= 4; ++location) {
+		glDisableVertexAttribArray(location);
+	}
+
+	for (int i = 0; i < attributes.size(); ++i) {
+		glEnableVertexAttribArray(attributes[i].location);
+		glVertexAttribPointer(attributes[i].location, attributes[i].size, attributes[i].type, attributes[i].normalized, stride, (void*)(size_t)attributes[i].offset);
+	}
+}
+
+/**
+ * Set the constant values for the attributes that this layout does not have.
+ * FORMAT_POSITIONのgeometryは、法線+Z、黒色で描画される。
+ */
+void VertexLayout::setConstantAttributes() const {
+	if (format != FORMAT_POSITION) return;
+
+	glVertexAttrib3f(1, 0.0f, 0.0f, 1.0f);
+	glVertexAttrib4f(2, 0.0f, 0.0f, 0.0f, 1.0f);
+	glVertexAttrib2f(3, 0.0f, 0.0f);
+	glVertexAttrib1f(4, 0.0f);
+}
 
 GeometryObject::GeometryObject() {
+	ebo = 0;
+	vertexFormat = VertexLayout::FORMAT_FULL;
+	vaoCreated = false;
+	vaoOutdated = true;
+}
+
+GeometryObject::GeometryObject(const std::vector<Vertex>& vertices, bool lighting, int vertexFormat) {
+	this->vertices = vertices;
+	this->lighting = lighting;
+	this->vertexFormat = vertexFormat;
+	ebo = 0;
 	vaoCreated = false;
 	vaoOutdated = true;
 }
 
-GeometryObject::GeometryObject(const std::vector<Vertex>& vertices, bool lighting) {
+GeometryObject::GeometryObject(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool lighting, int vertexFormat) {
 	this->vertices = vertices;
+	this->indices = indices;
 	this->lighting = lighting;
+	this->vertexFormat = vertexFormat;
+	ebo = 0;
 	vaoCreated = false;
 	vaoOutdated = true;
 }
 
+/**
+ * Append the vertices as a triangle soup.
+ * このobjectが既にindexedなら、追加した頂点をそのまま指すindexも追加する。
+ */
 void GeometryObject::addVertices(const std::vector<Vertex>& vertices) {
+	if (indexed()) {
+		unsigned int base = this->vertices.size();
+		for (int i = 0; i < vertices.size(); ++i) {
+			this->indices.push_back(base + i);
+		}
+	}
+	this->vertices.insert(this->vertices.end(), vertices.begin(), vertices.end());
+	vaoOutdated = true;
+}
+
+/**
+ * Append the indexed vertices.
+ * このobjectが非indexedの頂点を既に持っている場合は、先にそれらを指すindexを作ってindexedにする。
+ *
+ * @param vertices		追加する頂点
+ * @param indices		追加する頂点に対するindex (0 -- vertices[0])
+ */
+void GeometryObject::addVertices(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices) {
+	if (indices.empty()) return;
+
+	if (!indexed()) {
+		for (int i = 0; i < this->vertices.size(); ++i) {
+			this->indices.push_back(i);
+		}
+	}
+
+	unsigned int base = this->vertices.size();
+	this->indices.reserve(this->indices.size() + indices.size());
+	for (int i = 0; i < indices.size(); ++i) {
+		this->indices.push_back(base + indices[i]);
+	}
 	this->vertices.insert(this->vertices.end(), vertices.begin(), vertices.end());
 	vaoOutdated = true;
 }
 
 /**
  * Create VAO according to the vertices.
+ * indexedなら、EBOも作成してVAOに関連付ける。
  */
 void GeometryObject::createVAO() {
 	// VAOが作成済みで、最新なら、何もしないで終了
@@ -44,23 +211,30 @@ void GeometryObject::createVAO() {
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	}
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	const VertexLayout& layout = VertexLayout::get(vertexFormat);
+	if (layout.format == VertexLayout::FORMAT_FULL) {
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	}
+	else {
+		std::vector<unsigned char> data;
+		layout.pack(vertices, data);
+		glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	}
 
 	// configure the attributes in the vao
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, drawEdge));
+	layout.configure();
+
+	// EBOのbindはVAOに記録されるので、VAOをbindしたまま転送する
+	if (indexed()) {
+		if (ebo == 0) glGenBuffers(1, &ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	}
 		
 	// unbind the vao
 	glBindVertexArray(0); 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	vaoOutdated = false;
 }
@@ -70,11 +244,38 @@ RenderManager::RenderManager() {
 	uKernelSize = 64;// 16;
 	uRadius = 1;// 17.0f;
 	uPower = 2.0f;
+
+	frameUniformBuffer = 0;
+	ssaoKernelBuffer = 0;
+	batchesDirty = true;
+
+	layeredTex = 0;
+	layeredFB = 0;
+	layeredVAO = 0;
+	layeredVBO = 0;
+	layeredWidth = 0;
+	layeredHeight = 0;
+	layeredLayers = 0;
+	segmentVAO = 0;
+	segmentBuffers[0] = segmentBuffers[1] = 0;
+	segmentTextures[0] = segmentTextures[1] = 0;
 }
 
 RenderManager::~RenderManager() {
 	shader.cleanShaders();
 
+	glDeleteBuffers(1, &frameUniformBuffer);
+	glDeleteBuffers(1, &ssaoKernelBuffer);
+	releaseBatches();
+
+	glDeleteTextures(1, &layeredTex);
+	glDeleteFramebuffers(1, &layeredFB);
+	glDeleteBuffers(1, &layeredVBO);
+	glDeleteVertexArrays(1, &layeredVAO);
+	glDeleteTextures(2, segmentTextures);
+	glDeleteBuffers(2, segmentBuffers);
+	glDeleteVertexArrays(1, &segmentVAO);
+
 	//delete
 	glDeleteVertexArrays(1,&secondPassVBO);
 	glDeleteVertexArrays(1,&secondPassVAO);
@@ -83,6 +284,9 @@ RenderManager::~RenderManager() {
 void RenderManager::init(bool useShadow, int shadowMapSize) {
 	this->useShadow = useShadow;
 	this->softShadow = true;
+	this->shadowMapSize = shadowMapSize;
+	this->shadowDirty = true;
+	this->batchesDirty = true;
 	renderingMode = RENDERING_MODE_BASIC;
 
 	// init glew
@@ -111,6 +315,39 @@ void RenderManager::init(bool useShadow, int shadowMapSize) {
 	// Shadow mapping
 	programs["shadow"] = shader.createProgram("shaders/lc_vert_shadow.glsl", "shaders/lc_frag_shadow.glsl");
 
+	// Layered rendering
+	programs["layered"] = shader.createProgram("shaders/lc_vert_layered.glsl", "shaders/lc_geom_layered.glsl", "shaders/lc_frag_layered.glsl");
+
+	// 枝のセグメントから、geometry shaderで四角形を生成するprogram
+	// コンパイルできない環境では、segmentProgram.idを0のままにして、CPUで頂点を作る方法に戻す
+	try {
+		programs["segment"] = shader.createProgram("shaders/lc_vert_segment.glsl", "shaders/lc_geom_segment.glsl", "shaders/lc_frag_layered.glsl");
+		segmentProgram.resolve(shader, programs["segment"]);
+	}
+	catch (...) {
+		std::cout << "Warning: the segment program is not available. Branch segments are converted to vertices on the CPU." << std::endl;
+	}
+
+	// uniformのlocationはここで一度だけ解決する
+	pass1Program.resolve(shader, programs["pass1"]);
+	ssaoProgram.resolve(shader, programs["ssao"]);
+	blurProgram.resolve(shader, programs["blur"]);
+	lineProgram.resolve(shader, programs["line"]);
+	shadowProgram.resolve(shader, programs["shadow"]);
+	layeredProgram.resolve(shader, programs["layered"]);
+
+	// 毎フレームの定数（行列、光源方向）とSSAOカーネルはuniform bufferで共有する
+	glGenBuffers(1, &frameUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FrameUniforms::BINDING, frameUniformBuffer);
+
+	glGenBuffers(1, &ssaoKernelBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, ssaoKernelBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(SsaoKernelUniforms), NULL, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, SsaoKernelUniforms::BINDING, ssaoKernelBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
 	glUseProgram(programs["pass1"]);
 
 
@@ -156,7 +393,8 @@ void RenderManager::init(bool useShadow, int shadowMapSize) {
 	hatchingTextureFiles.push_back("hatching/hatching8.png");
 	hatchingTextures = load3DTexture(hatchingTextureFiles);
 	
-	shadow.init(programs["shadow"], shadowMapSize, shadowMapSize);
+	int initialShadowMapSize = shadowMapSize > 0 ? shadowMapSize : MIN_SHADOW_MAP_SIZE;
+	shadow.init(shadowProgram, initialShadowMapSize, initialShadowMapSize);
 }
 
 void RenderManager::resize(int winWidth, int winHeight){
@@ -331,19 +569,43 @@ T lerp(T v0, T v1, T t) {
 }
 
 void RenderManager::resizeSsaoKernel() {
-	uKernelOffsets.resize(uKernelSize*3);
+	uKernelOffsets.resize(std::min((int)uKernelSize, (int)SsaoKernelUniforms::MAX_KERNEL_SIZE));
 	qsrand(123456);
-	for (int i = 0; i < uKernelSize; ++i) {
+	for (int i = 0; i < uKernelOffsets.size(); ++i) {
 		glm::vec3 kernel = glm::normalize(glm::vec3((float(qrand()) / RAND_MAX)*2.0f - 1.0f, (float(qrand()) / RAND_MAX)*2.0f - 1.0f, (float(qrand()) / RAND_MAX)));
 		float scale = float(i) / uKernelSize;
 		kernel *= lerp<float>(0.1f, 1.0f, scale*scale);
 		//printf("[%d] %f %f %f\n",i,kernel.x,kernel.y,kernel.z);
-		uKernelOffsets[i * 3 + 0] = kernel.x;
-		uKernelOffsets[i * 3 + 1] = kernel.y;
-		uKernelOffsets[i * 3 + 2] = kernel.z;
+		uKernelOffsets[i] = glm::vec4(kernel, 0.0f);
 	}
+
+	// カーネルはサイズが変わった時だけuniform bufferに転送する
+	glBindBuffer(GL_UNIFORM_BUFFER, ssaoKernelBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::vec4) * uKernelOffsets.size(), uKernelOffsets.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }//
 
+/**
+ * 毎フレームの定数をuniform bufferに転送する。
+ * FrameUniformsブロックを宣言している全てのprogramから参照される。
+ *
+ * @param mvpMatrix			カメラのmodel/view/projection行列
+ * @param pMatrix			カメラのprojection行列
+ * @param light_mvpMatrix	光源から見たmodel/view/projection行列
+ * @param lightDir			光の進行方向
+ */
+void RenderManager::updateFrameUniforms(const glm::mat4& mvpMatrix, const glm::mat4& pMatrix, const glm::mat4& light_mvpMatrix, const glm::vec3& lightDir) {
+	FrameUniforms frame;
+	frame.mvpMatrix = mvpMatrix;
+	frame.pMatrix = pMatrix;
+	frame.light_mvpMatrix = light_mvpMatrix;
+	frame.lightDir = glm::vec4(lightDir, 0.0f);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 
 void RenderManager::addFaces(const std::vector<boost::shared_ptr<glutils::Face> >& faces) {
 	for (int i = 0; i < faces.size(); ++i) {
@@ -351,30 +613,61 @@ void RenderManager::addFaces(const std::vector<boost::shared_ptr<glutils::Face>
 	}
 }
 
-void RenderManager::addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, bool lighting) {
-	GLuint texId;
-	
-	if (texture_file.length() > 0) {
-		// テクスチャファイルがまだ読み込まれていない場合は、ロードする
-		if (!textures.contains(texture_file)) {
-			texId = loadTexture(texture_file);
-			textures[texture_file] = texId;
-		} else {
-			texId = textures[texture_file];
-		}
-	} else {
-		texId = 0;
-	}
+void RenderManager::addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, bool lighting, int vertexFormat) {
+	GLuint texId = textureId(texture_file);
 
 	if (objects.contains(object_name)) {
 		if (objects[object_name].contains(texId)) {
 			objects[object_name][texId].addVertices(vertices);
 		} else {
-			objects[object_name][texId] = GeometryObject(vertices, lighting);
+			objects[object_name][texId] = GeometryObject(vertices, lighting, vertexFormat);
 		}
 	} else {
-		objects[object_name][texId] = GeometryObject(vertices, lighting);
+		objects[object_name][texId] = GeometryObject(vertices, lighting, vertexFormat);
+	}
+
+	shadowDirty = true;
+	batchesDirty = true;
+}
+
+/**
+ * Add an indexed object, e.g., the geometry generated by the indexed variants of glutils::draw*.
+ * 同じ名前、textureのobjectが既にあれば、その頂点とindexに追加する。
+ *
+ * @param object_name		object name
+ * @param texture_file		texture file ("" -- color only)
+ * @param vertices			vertices
+ * @param indices			indices of the triangles (0 -- vertices[0])
+ * @param lighting			true if the lighting is applied
+ * @param vertexFormat		format of the vertices in the VBO
+ */
+void RenderManager::addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool lighting, int vertexFormat) {
+	GLuint texId = textureId(texture_file);
+
+	if (objects.contains(object_name) && objects[object_name].contains(texId)) {
+		objects[object_name][texId].addVertices(vertices, indices);
+	} else {
+		objects[object_name][texId] = GeometryObject(vertices, indices, lighting, vertexFormat);
 	}
+
+	shadowDirty = true;
+	batchesDirty = true;
+}
+
+/**
+ * Return the id of the texture, loading the file if it has not been loaded yet.
+ *
+ * @param texture_file		texture file ("" -- no texture)
+ * @return					texture id (0 -- no texture)
+ */
+GLuint RenderManager::textureId(const QString& texture_file) {
+	if (texture_file.length() == 0) return 0;
+
+	// テクスチャファイルがまだ読み込まれていない場合は、ロードする
+	if (!textures.contains(texture_file)) {
+		textures[texture_file] = loadTexture(texture_file);
+	}
+	return textures[texture_file];
 }
 
 void RenderManager::removeObjects() {
@@ -382,34 +675,31 @@ void RenderManager::removeObjects() {
 		removeObject(it.key());
 	}
 	objects.clear();
+	shadowDirty = true;
+	batchesDirty = true;
 }
 
 void RenderManager::removeObject(const QString& object_name) {
 	for (auto it = objects[object_name].begin(); it != objects[object_name].end(); ++it) {
+		// バッチ描画のみの場合は、個別のvaoは作成されていない
+		if (!it->vaoCreated) continue;
+
 		glDeleteBuffers(1, &it->vbo);
+		if (it->ebo > 0) {
+			glDeleteBuffers(1, &it->ebo);
+		}
 		glDeleteVertexArrays(1, &it->vao);
 	}
 
 	objects[object_name].clear();
+	shadowDirty = true;
+	batchesDirty = true;
 }
 
 void RenderManager::centerObjects() {
-	glm::vec3 minPt((std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)());
-	glm::vec3 maxPt = -minPt;
-
 	// もとのサイズを計算
-	for (auto it = objects.begin(); it != objects.end(); ++it) {
-		for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
-			for (int k = 0; k < it2->vertices.size(); ++k) {
-				minPt.x = (std::min)(minPt.x, it2->vertices[k].position.x);
-				minPt.y = (std::min)(minPt.y, it2->vertices[k].position.y);
-				minPt.z = (std::min)(minPt.z, it2->vertices[k].position.z);
-				maxPt.x = (std::max)(maxPt.x, it2->vertices[k].position.x);
-				maxPt.y = (std::max)(maxPt.y, it2->vertices[k].position.y);
-				maxPt.z = (std::max)(maxPt.z, it2->vertices[k].position.z);
-			}
-		}
-	}
+	glm::vec3 minPt, maxPt;
+	if (!computeBoundingBox(minPt, maxPt)) return;
 
 	glm::vec3 center = (maxPt + minPt) * 0.5f;
 
@@ -422,72 +712,594 @@ void RenderManager::centerObjects() {
 			for (int k = 0; k < it2->vertices.size(); ++k) {
 				it2->vertices[k].position = (it2->vertices[k].position - center) * scale;
 			}
+			it2->vaoOutdated = true;
 		}
 	}
-}
 
-void RenderManager::renderAll() {
-	for (auto it = objects.begin(); it != objects.end(); ++it) {
-		render(it.key());
-	}
+	shadowDirty = true;
+	batchesDirty = true;
 }
 
-void RenderManager::renderAllExcept(const QString& object_name) {
-	for (auto it = objects.begin(); it != objects.end(); ++it) {
-		if (it.key() == object_name) continue;
+/**
+ * Render all the objects.
+ * Objects that share the texture, lighting and vertex format are drawn by one multi draw call.
+ *
+ * @param shadow		falseなら、shadow mapを参照せずに描画する（評価用のレンダリングなど）
+ */
+void RenderManager::renderAll(bool shadow) {
+	renderBatches(NULL, shadow);
+}
 
-		render(it.key());
-	}
+void RenderManager::renderAllExcept(const QString& object_name, bool shadow) {
+	renderBatches(&object_name, shadow);
 }
 
-void RenderManager::render(const QString& object_name) {
+void RenderManager::render(const QString& object_name, bool shadow) {
 	for (auto it = objects[object_name].begin(); it != objects[object_name].end(); ++it) {
-		GLuint texId = it.key();
-		
 		// vaoを作成
 		it->createVAO();
 
-		if (texId > 0) {
-			// テクスチャなら、バインドする
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texId);
-			glUniform1i(glGetUniformLocation(programs["pass1"], "textureEnabled"), 1);
-			glUniform1i(glGetUniformLocation(programs["pass1"], "tex0"), 0);
-		} else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "textureEnabled"), 0);
+		setObjectState(it.key(), it->lighting, shadow);
+
+		// 描画
+		VertexLayout::get(it->vertexFormat).setConstantAttributes();
+		glBindVertexArray(it->vao);
+		if (it->indexed()) {
+			glDrawElements(GL_TRIANGLES, it->indices.size(), GL_UNSIGNED_INT, 0);
+		}
+		else {
+			glDrawArrays(GL_TRIANGLES, 0, it->vertices.size());
 		}
 
-		if (it->lighting) {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "lighting"), 1);
+		glBindVertexArray(0);
+	}
+}
+
+/**
+ * Set the per-object uniforms of the pass1 program and bind the texture.
+ *
+ * @param texId			texture id (0 -- color only)
+ * @param lighting		true if the lighting is applied
+ * @param shadow		falseなら、shadow mapを参照しない
+ */
+void RenderManager::setObjectState(GLuint texId, bool lighting, bool shadow) {
+	if (texId > 0) {
+		// テクスチャなら、バインドする
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texId);
+		glUniform1i(pass1Program.textureEnabled, 1);
+	} else {
+		glUniform1i(pass1Program.textureEnabled, 0);
+	}
+
+	if (lighting) {
+		glUniform1i(pass1Program.lighting, 1);
+	}
+	else {
+		glUniform1i(pass1Program.lighting, 0);
+	}
+
+	if (useShadow && shadow) {
+		glUniform1i(pass1Program.useShadow, 1);
+		if (softShadow) {
+			glUniform1i(pass1Program.softShadow, 1);
 		}
 		else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "lighting"), 0);
+			glUniform1i(pass1Program.softShadow, 0);
 		}
+	} else {
+		glUniform1i(pass1Program.useShadow, 0);
+	}
+}
+
+/**
+ * Rebuild the batches from the objects.
+ * 各バッチの頂点を1つのVBOに連結し、objectごとの範囲を記録する。
+ * indexedなobjectは別のバッチにまとめ、indexを1つのEBOに連結して、objectごとのindexの範囲と頂点の先頭を記録する。
+ * multi draw indirectが使える場合は、その範囲をindirect draw bufferにも転送しておく。
+ */
+void RenderManager::buildBatches() {
+	releaseBatches();
 
-		if (useShadow) {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "useShadow"), 1);
-			if (softShadow) {
-				glUniform1i(glGetUniformLocation(programs["pass1"], "softShadow"), 1);
+	std::map<std::tuple<GLuint, bool, int, bool>, int> batchIndex;
+	std::vector<std::vector<Vertex> > batchVertices;
+	std::vector<std::vector<unsigned int> > batchIndices;
+	for (auto it = objects.begin(); it != objects.end(); ++it) {
+		for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
+			if (it2->vertices.empty()) continue;
+
+			std::tuple<GLuint, bool, int, bool> key(it2.key(), it2->lighting, it2->vertexFormat, it2->indexed());
+			if (batchIndex.find(key) == batchIndex.end()) {
+				batchIndex[key] = batches.size();
+				batches.push_back(DrawBatch(it2.key(), it2->lighting, it2->vertexFormat, it2->indexed()));
+				batchVertices.push_back(std::vector<Vertex>());
+				batchIndices.push_back(std::vector<unsigned int>());
+			}
+
+			int index = batchIndex[key];
+			batches[index].objectNames.push_back(it.key());
+			if (it2->indexed()) {
+				batches[index].first.push_back(batchIndices[index].size());
+				batches[index].count.push_back(it2->indices.size());
+				batches[index].baseVertex.push_back(batchVertices[index].size());
+				batchIndices[index].insert(batchIndices[index].end(), it2->indices.begin(), it2->indices.end());
 			}
 			else {
-				glUniform1i(glGetUniformLocation(programs["pass1"], "softShadow"), 0);
+				batches[index].first.push_back(batchVertices[index].size());
+				batches[index].count.push_back(it2->vertices.size());
 			}
-		} else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "useShadow"), 0);
+			batchVertices[index].insert(batchVertices[index].end(), it2->vertices.begin(), it2->vertices.end());
 		}
+	}
 
-		// 描画
-		glBindVertexArray(it->vao);
-		glDrawArrays(GL_TRIANGLES, 0, it->vertices.size());
+	bool useIndirect = GLEW_ARB_multi_draw_indirect != 0;
+	for (int i = 0; i < batches.size(); ++i) {
+		DrawBatch& batch = batches[i];
+		const VertexLayout& layout = VertexLayout::get(batch.vertexFormat);
+
+		glGenVertexArrays(1, &batch.vao);
+		glBindVertexArray(batch.vao);
+		glGenBuffers(1, &batch.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+
+		std::vector<unsigned char> data;
+		layout.pack(batchVertices[i], data);
+		glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+		layout.configure();
+
+		if (batch.indexed) {
+			glGenBuffers(1, &batch.ebo);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.ebo);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * batchIndices[i].size(), batchIndices[i].data(), GL_STATIC_DRAW);
+		}
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+		if (useIndirect && batch.indexed) {
+			std::vector<DrawBatch::DrawElementsCommand> commands(batch.first.size());
+			for (int j = 0; j < commands.size(); ++j) {
+				commands[j].count = batch.count[j];
+				commands[j].instanceCount = 1;
+				commands[j].firstIndex = batch.first[j];
+				commands[j].baseVertex = batch.baseVertex[j];
+				commands[j].baseInstance = 0;
+			}
+
+			glGenBuffers(1, &batch.indirectBuffer);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawBatch::DrawElementsCommand) * commands.size(), commands.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		else if (useIndirect) {
+			std::vector<DrawBatch::DrawArraysCommand> commands(batch.first.size());
+			for (int j = 0; j < commands.size(); ++j) {
+				commands[j].count = batch.count[j];
+				commands[j].instanceCount = 1;
+				commands[j].first = batch.first[j];
+				commands[j].baseInstance = 0;
+			}
+
+			glGenBuffers(1, &batch.indirectBuffer);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawBatch::DrawArraysCommand) * commands.size(), commands.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+	}
+
+	batchesDirty = false;
+}
+
+void RenderManager::releaseBatches() {
+	for (int i = 0; i < batches.size(); ++i) {
+		glDeleteBuffers(1, &batches[i].vbo);
+		glDeleteVertexArrays(1, &batches[i].vao);
+		if (batches[i].ebo > 0) {
+			glDeleteBuffers(1, &batches[i].ebo);
+		}
+		if (batches[i].indirectBuffer > 0) {
+			glDeleteBuffers(1, &batches[i].indirectBuffer);
+		}
+	}
+	batches.clear();
+}
+
+/**
+ * Render the batches.
+ * 全objectを描画する場合はindirect draw bufferをそのまま使い、
+ * 除外するobjectがある場合は、それ以外の範囲だけをglMultiDrawArrays (indexedならglMultiDrawElementsBaseVertex) で描画する。
+ *
+ * @param excluded_name		描画しないobjectの名前 (NULL -- 全て描画)
+ * @param shadow			falseなら、shadow mapを参照しない
+ */
+void RenderManager::renderBatches(const QString* excluded_name, bool shadow) {
+	if (batchesDirty) buildBatches();
+
+	std::vector<GLint> first;
+	std::vector<GLsizei> count;
+	std::vector<GLvoid*> offsets;
+	std::vector<GLint> baseVertex;
+	for (int i = 0; i < batches.size(); ++i) {
+		const DrawBatch& batch = batches[i];
+
+		setObjectState(batch.texId, batch.lighting, shadow);
+		VertexLayout::get(batch.vertexFormat).setConstantAttributes();
+		glBindVertexArray(batch.vao);
+
+		if (batch.indexed && excluded_name == NULL && batch.indirectBuffer > 0) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, batch.first.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		else if (batch.indexed) {
+			count.clear();
+			offsets.clear();
+			baseVertex.clear();
+			for (int j = 0; j < batch.objectNames.size(); ++j) {
+				if (excluded_name != NULL && batch.objectNames[j] == *excluded_name) continue;
+				count.push_back(batch.count[j]);
+				offsets.push_back((GLvoid*)(sizeof(unsigned int) * batch.first[j]));
+				baseVertex.push_back(batch.baseVertex[j]);
+			}
+			if (!count.empty()) {
+				glMultiDrawElementsBaseVertex(GL_TRIANGLES, count.data(), GL_UNSIGNED_INT, offsets.data(), count.size(), baseVertex.data());
+			}
+		}
+		else if (excluded_name == NULL && batch.indirectBuffer > 0) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+			glMultiDrawArraysIndirect(GL_TRIANGLES, 0, batch.first.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		else if (excluded_name == NULL) {
+			glMultiDrawArrays(GL_TRIANGLES, batch.first.data(), batch.count.data(), batch.first.size());
+		}
+		else {
+			first.clear();
+			count.clear();
+			for (int j = 0; j < batch.objectNames.size(); ++j) {
+				if (batch.objectNames[j] == *excluded_name) continue;
+				first.push_back(batch.first[j]);
+				count.push_back(batch.count[j]);
+			}
+			if (!first.empty()) {
+				glMultiDrawArrays(GL_TRIANGLES, first.data(), count.data(), first.size());
+			}
+		}
+
+		glBindVertexArray(0);
+	}
+}
+
+/**
+ * Set the resolution of the shadow map.
+ *
+ * @param size		resolution of the shadow map (0 -- chosen from the scene bounds)
+ */
+void RenderManager::setShadowMapSize(int size) {
+	shadowMapSize = size;
+	shadowDirty = true;
+}
+
+/**
+ * Update the shadow map if the objects have changed since the last update.
+ * The light frustum is fitted to the bounding box of the objects, and light_mvpMatrix is updated accordingly.
+ * If shadowMapSize is 0, the resolution is chosen such that the scene is covered with SHADOW_MAP_TEXELS_PER_UNIT texels per unit.
+ *
+ * @param light_dir				light direction
+ * @param light_mvpMatrix [OUT]	model/view/projection matrix of the light
+ */
+void RenderManager::updateShadowMap(const glm::vec3& light_dir, glm::mat4& light_mvpMatrix) {
+	if (!useShadow || !shadowDirty) return;
+
+	glm::vec3 minPt, maxPt;
+	if (computeBoundingBox(minPt, maxPt)) {
+		glm::vec3 center = (minPt + maxPt) * 0.5f;
+		float radius = (std::max)(glm::length(maxPt - minPt) * 0.5f, 1.0f);
+
+		// 光源の方向に沿って、シーンを囲むようにshadow用のfrustumを設定
+		glm::vec3 up(0, 1, 0);
+		if (fabs(glm::dot(up, light_dir)) > 0.99f) up = glm::vec3(1, 0, 0);
+		glm::mat4 light_pMatrix = glm::ortho<float>(-radius, radius, -radius, radius, radius, radius * 3.0f);
+		glm::mat4 light_mvMatrix = glm::lookAt(center - light_dir * radius * 2.0f, center, up);
+		light_mvpMatrix = light_pMatrix * light_mvMatrix;
+
+		int size = shadowMapSize;
+		if (size <= 0) {
+			size = MIN_SHADOW_MAP_SIZE;
+			while (size < radius * 2.0f * SHADOW_MAP_TEXELS_PER_UNIT && size < MAX_SHADOW_MAP_SIZE) {
+				size *= 2;
+			}
+		}
+		shadow.resize(size, size);
+	}
+
+	shadow.update(this, light_dir, light_mvpMatrix);
+	shadowDirty = false;
+}
+
+/**
+ * Render the geometries into the layers of a texture array in one pass, and read back all the layers at once.
+ * 各geometryはi番目のレイヤーに、vertexの色をグレースケールにして背景白で描画される（lightingなし）。
+ * registered objectsとは独立しているので、MCTSの候補の評価などに使う。
+ *
+ * @param geometries		geometries to render (i-th geometry is rendered to the i-th layer)
+ * @param mvpMatrix			model/view/projection matrix
+ * @param width				width of each layer
+ * @param height			height of each layer
+ * @param pixels [OUT]		8bit gray images of all the layers (width x height x geometries.size(), rows top to bottom)
+ * @param profiler			読み出し時間("readback")を記録するプロファイラ (NULL -- 記録しない)
+ */
+void RenderManager::renderLayered(const std::vector<std::vector<Vertex> >& geometries, const glm::mat4& mvpMatrix, int width, int height, std::vector<unsigned char>& pixels, Profiler* profiler) {
+	pixels.resize((size_t)width * height * geometries.size());
+	if (geometries.empty()) return;
+
+	resizeLayered(width, height, (std::min)((int)geometries.size(), MAX_RENDER_LAYERS));
+
+	GLint origViewport[4];
+	glGetIntegerv(GL_VIEWPORT, origViewport);
+	GLint origProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &origProgram);
+	GLfloat origClearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, origClearColor);
+
+	// 上下反転して描画することで、読み出した画像がそのまま上から下の行順になる
+	glm::mat4 flippedMvpMatrix = glm::scale(glm::mat4(), glm::vec3(1, -1, 1)) * mvpMatrix;
+
+	glUseProgram(layeredProgram.id);
+	glUniformMatrix4fv(layeredProgram.mvpMatrix, 1, GL_FALSE, &flippedMvpMatrix[0][0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, layeredFB);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	std::vector<LayeredVertex> vertices;
+	std::vector<unsigned char> remainder;
+	for (int start = 0; start < geometries.size(); start += layeredLayers) {
+		int numLayers = (std::min)((int)geometries.size() - start, layeredLayers);
+
+		// 全候補の頂点を、レイヤー番号付きで1つのVBOにまとめる
+		vertices.clear();
+		for (int i = 0; i < numLayers; ++i) {
+			const std::vector<Vertex>& geometry = geometries[start + i];
+			for (int k = 0; k < geometry.size(); ++k) {
+				LayeredVertex v;
+				v.position = geometry[k].position;
+				v.color = glm::packUnorm4x8(glm::clamp(geometry[k].color, 0.0f, 1.0f));
+				v.layer = i;
+				vertices.push_back(v);
+			}
+		}
 
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glBindVertexArray(layeredVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, layeredVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(LayeredVertex) * vertices.size(), vertices.data(), GL_STREAM_DRAW);
+		glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
+
+		readLayers(start, numLayers, width, height, pixels, remainder, profiler);
 	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
+	glClearColor(origClearColor[0], origClearColor[1], origClearColor[2], origClearColor[3]);
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(origProgram);
 }
 
-void RenderManager::updateShadowMap(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix) {
-	if (useShadow) {
-		shadow.update(glWidget3D, light_dir, light_mvpMatrix);
+/**
+ * Render the trees given as branch segments into the layers of a texture array, and read back all the layers at once.
+ * 頂点はCPUで作らず、各セグメントのパラメータだけをtexture bufferに転送する。vertex shaderで親をたどって
+ * 各セグメントの座標系を求め、geometry shaderで四角形を生成する（色は黒）。結果はrenderLayeredと同じになる。
+ * segmentProgramが使えない場合は呼び出さないこと。
+ *
+ * @param trees				trees to render (i-th tree is rendered to the i-th layer)
+ * @param mvpMatrix			model/view/projection matrix
+ * @param width				width of each layer
+ * @param height			height of each layer
+ * @param pixels [OUT]		8bit gray images of all the layers (width x height x trees.size(), rows top to bottom)
+ * @param profiler			読み出し時間("readback")を記録するプロファイラ (NULL -- 記録しない)
+ */
+void RenderManager::renderSegmentsLayered(const std::vector<std::vector<BranchSegment> >& trees, const glm::mat4& mvpMatrix, int width, int height, std::vector<unsigned char>& pixels, Profiler* profiler) {
+	pixels.resize((size_t)width * height * trees.size());
+	if (trees.empty() || segmentProgram.id == 0) return;
+
+	resizeLayered(width, height, (std::min)((int)trees.size(), MAX_RENDER_LAYERS));
+
+	if (segmentVAO == 0) {
+		// 頂点属性は使わず、gl_VertexIDでセグメントを参照する
+		glGenVertexArrays(1, &segmentVAO);
+		glGenBuffers(2, segmentBuffers);
+		glGenTextures(2, segmentTextures);
+
+		GLenum formats[2] = { GL_RGBA32F, GL_RGBA32I };
+		for (int i = 0; i < 2; ++i) {
+			glBindBuffer(GL_TEXTURE_BUFFER, segmentBuffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 0, NULL, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, segmentTextures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], segmentBuffers[i]);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	GLint origViewport[4];
+	glGetIntegerv(GL_VIEWPORT, origViewport);
+	GLint origProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &origProgram);
+	GLfloat origClearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, origClearColor);
+
+	// 上下反転して描画することで、読み出した画像がそのまま上から下の行順になる
+	glm::mat4 flippedMvpMatrix = glm::scale(glm::mat4(), glm::vec3(1, -1, 1)) * mvpMatrix;
+
+	glUseProgram(segmentProgram.id);
+	glUniformMatrix4fv(segmentProgram.mvpMatrix, 1, GL_FALSE, &flippedMvpMatrix[0][0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, layeredFB);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	glActiveTexture(GL_TEXTURE0 + SegmentProgram::SEGMENTS_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, segmentTextures[0]);
+	glActiveTexture(GL_TEXTURE0 + SegmentProgram::LINKS_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, segmentTextures[1]);
+	glActiveTexture(GL_TEXTURE0);
+
+	std::vector<glm::vec4> segments;
+	std::vector<glm::ivec4> links;
+	std::vector<unsigned char> remainder;
+	for (int start = 0; start < trees.size(); start += layeredLayers) {
+		int numLayers = (std::min)((int)trees.size() - start, layeredLayers);
+
+		// 全ての木のセグメントを1つのbufferにまとめ、親の番号をbuffer内の番号に直す
+		segments.clear();
+		links.clear();
+		for (int i = 0; i < numLayers; ++i) {
+			const std::vector<BranchSegment>& tree = trees[start + i];
+			int base = segments.size();
+			for (int k = 0; k < tree.size(); ++k) {
+				segments.push_back(glm::vec4(tree[k].angle, tree[k].length, tree[k].width0, tree[k].width1));
+				links.push_back(glm::ivec4(tree[k].parent >= 0 ? base + tree[k].parent : -1, tree[k].connect, i, 0));
+			}
+		}
+
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glBindBuffer(GL_TEXTURE_BUFFER, segmentBuffers[0]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * segments.size(), segments.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, segmentBuffers[1]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::ivec4) * links.size(), links.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glBindVertexArray(segmentVAO);
+		glDrawArrays(GL_POINTS, 0, segments.size());
+		glBindVertexArray(0);
+
+		readLayers(start, numLayers, width, height, pixels, remainder, profiler);
 	}
+
+	glActiveTexture(GL_TEXTURE0 + SegmentProgram::SEGMENTS_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + SegmentProgram::LINKS_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
+	glClearColor(origClearColor[0], origClearColor[1], origClearColor[2], origClearColor[3]);
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(origProgram);
+}
+
+/**
+ * Read back the layers of the texture array at once into pixels, starting from the start-th image.
+ *
+ * @param start				index of the first image in pixels
+ * @param numLayers			number of layers to read (at most layeredLayers)
+ * @param width				width of each layer
+ * @param height			height of each layer
+ * @param pixels [OUT]		8bit gray images
+ * @param remainder			work buffer for the case numLayers < layeredLayers
+ * @param profiler			読み出し時間("readback")を記録するプロファイラ (NULL -- 記録しない)
+ */
+void RenderManager::readLayers(int start, int numLayers, int width, int height, std::vector<unsigned char>& pixels, std::vector<unsigned char>& remainder, Profiler* profiler) {
+	// 全レイヤーを一度に読み出す
+	Profiler::ScopedTimer readbackTimer(profiler, PHASE_READBACK);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layeredTex);
+	if (numLayers == layeredLayers) {
+		glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data() + (size_t)start * width * height);
+	}
+	else {
+		// MAX_RENDER_LAYERSを超えた分の端数は、一旦全レイヤーを読み出してから必要な分だけコピー
+		remainder.resize((size_t)layeredLayers * width * height);
+		glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RED, GL_UNSIGNED_BYTE, remainder.data());
+		std::copy(remainder.begin(), remainder.begin() + (size_t)numLayers * width * height, pixels.begin() + (size_t)start * width * height);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+/**
+ * Allocate the texture array and the framebuffer for renderLayered.
+ * サイズが変わらない場合は何もしない。
+ *
+ * @param width			width of each layer
+ * @param height		height of each layer
+ * @param layers		number of layers
+ */
+void RenderManager::resizeLayered(int width, int height, int layers) {
+	if (layeredFB > 0 && layeredWidth == width && layeredHeight == height && layeredLayers == layers) return;
+
+	if (layeredFB == 0) {
+		glGenFramebuffers(1, &layeredFB);
+		glGenTextures(1, &layeredTex);
+
+		glGenVertexArrays(1, &layeredVAO);
+		glBindVertexArray(layeredVAO);
+		glGenBuffers(1, &layeredVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, layeredVBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(LayeredVertex), (void*)offsetof(LayeredVertex, position));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LayeredVertex), (void*)offsetof(LayeredVertex, color));
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, 1, GL_INT, sizeof(LayeredVertex), (void*)offsetof(LayeredVertex, layer));
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	layeredWidth = width;
+	layeredHeight = height;
+	layeredLayers = layers;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layeredTex);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, width, height, layers, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// texture array全体をattachすると、layered framebufferになり、gl_Layerで描画先を選べる
+	glBindFramebuffer(GL_FRAMEBUFFER, layeredFB);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layeredTex, 0);
+	GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
+	glDrawBuffers(1, drawBuffers);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("+3ERROR: GL_FRAMEBUFFER_COMPLETE false\n");
+		exit(0);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+ * Compute the bounding box of all the objects.
+ *
+ * @param minPt [OUT]	minimum corner
+ * @param maxPt [OUT]	maximum corner
+ * @return				false if there is no vertex
+ */
+bool RenderManager::computeBoundingBox(glm::vec3& minPt, glm::vec3& maxPt) {
+	minPt = glm::vec3((std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)());
+	maxPt = -minPt;
+
+	bool found = false;
+	for (auto it = objects.begin(); it != objects.end(); ++it) {
+		for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
+			for (int k = 0; k < it2->vertices.size(); ++k) {
+				minPt = glm::min(minPt, it2->vertices[k].position);
+				maxPt = glm::max(maxPt, it2->vertices[k].position);
+				found = true;
+			}
+		}
+	}
+
+	return found;
 }
 
 GLuint RenderManager::loadTexture(const QString& filename) {
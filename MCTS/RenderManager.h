@@ -8,24 +8,116 @@
 #include "GLUtils.h"
 #include <boost/shared_ptr.hpp>
 #include "Shader.h"
+#include "ShaderProgram.h"
+#include "Profiler.h"
 #include <map>
 
+/**
+ * One attribute of a vertex layout, i.e., the arguments of glVertexAttribPointer.
+ */
+struct VertexAttribute {
+	GLuint location;
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	GLuint offset;
+
+	VertexAttribute(GLuint location, GLint size, GLenum type, GLboolean normalized, GLuint offset) : location(location), size(size), type(type), normalized(normalized), offset(offset) {}
+};
+
+/**
+ * Describes how the vertices are stored in the VBO.
+ * FORMAT_FULL uploads Vertex as it is, FORMAT_COMPACT packs normal/color/uv into 32bit each,
+ * and FORMAT_POSITION uploads only the positions.
+ */
+class VertexLayout {
+public:
+	enum { FORMAT_FULL = 0, FORMAT_COMPACT, FORMAT_POSITION, NUM_FORMATS };
+
+public:
+	int format;
+	GLsizei stride;
+	std::vector<VertexAttribute> attributes;
+
+public:
+	static const VertexLayout& get(int format);
+	void pack(const std::vector<Vertex>& vertices, std::vector<unsigned char>& data) const;
+	void configure() const;
+	void setConstantAttributes() const;
+
+private:
+	VertexLayout(int format);
+};
+
+/**
+ * texture、lightingが同じ頂点の集まり。
+ * indicesが空ならglDrawArraysで、空でなければEBOを作ってglDrawElementsで描画する。
+ */
 class GeometryObject {
 public:
 	GLuint vao;
 	GLuint vbo;
+	GLuint ebo;
 	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;	// empty -- 非indexed (頂点を3つずつ三角形として描画)
 	bool lighting;
+	int vertexFormat;
 	bool vaoCreated;
 	bool vaoOutdated;
 
 public:
 	GeometryObject();
-	GeometryObject(const std::vector<Vertex>& vertices, bool lighting = true);
+	GeometryObject(const std::vector<Vertex>& vertices, bool lighting = true, int vertexFormat = VertexLayout::FORMAT_FULL);
+	GeometryObject(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool lighting = true, int vertexFormat = VertexLayout::FORMAT_FULL);
 	void addVertices(const std::vector<Vertex>& vertices);
+	void addVertices(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices);
+	bool indexed() const { return !indices.empty(); }
+	size_t numElements() const { return indexed() ? indices.size() : vertices.size(); }
 	void createVAO();
 };
 
+/**
+ * 同じtexture、lighting、頂点フォーマットを持つGeometryObjectをまとめて描画するためのバッチ。
+ * 頂点は1つのVBOに連結し、各objectの範囲をindirect draw bufferのコマンドとして保持する。
+ * indexedなバッチは、indexも1つのEBOに連結し、各objectの頂点の先頭をbaseVertexとして保持する。
+ */
+class DrawBatch {
+public:
+	/** glMultiDrawArraysIndirectの1コマンド */
+	struct DrawArraysCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	/** glMultiDrawElementsIndirectの1コマンド */
+	struct DrawElementsCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+public:
+	GLuint texId;
+	bool lighting;
+	int vertexFormat;
+	bool indexed;
+	GLuint vao;
+	GLuint vbo;
+	GLuint ebo;						// 0 -- 非indexed
+	GLuint indirectBuffer;			// 0 -- multi draw indirect非対応
+	std::vector<QString> objectNames;	// 各コマンドに対応するobject名
+	std::vector<GLint> first;		// 非indexedなら先頭の頂点、indexedなら先頭のindex
+	std::vector<GLsizei> count;		// 頂点数、またはindex数
+	std::vector<GLint> baseVertex;	// indexedの場合のみ
+
+public:
+	DrawBatch(GLuint texId, bool lighting, int vertexFormat, bool indexed) : texId(texId), lighting(lighting), vertexFormat(vertexFormat), indexed(indexed), vao(0), vbo(0), ebo(0), indirectBuffer(0) {}
+};
+
 class RenderManager {
 public:
 	static enum { RENDERING_MODE_BASIC = 0, RENDERING_MODE_SSAO, RENDERING_MODE_LINE, RENDERING_MODE_HATCHING, RENDERING_MODE_SKETCHY };
@@ -33,13 +125,26 @@ public:
 public:
 	Shader shader;
 	std::map<std::string, GLuint> programs;
+	Pass1Program pass1Program;
+	SsaoProgram ssaoProgram;
+	BlurProgram blurProgram;
+	LineProgram lineProgram;
+	ShadowProgram shadowProgram;
+	LayeredProgram layeredProgram;
+	SegmentProgram segmentProgram;	// id = 0 -- 使えない（CPUで頂点を作ってrenderLayeredで描画する）
+	GLuint frameUniformBuffer;	// FrameUniforms (binding = 0)
+	GLuint ssaoKernelBuffer;	// SsaoKernelUniforms (binding = 1)
 
 	QMap<QString, QMap<GLuint, GeometryObject> > objects;
 	QMap<QString, GLuint> textures;
+	std::vector<DrawBatch> batches;
+	bool batchesDirty;
 
 	bool useShadow;
 	bool softShadow;
 	ShadowMapping shadow;
+	int shadowMapSize;	// 0 -- chosen from the scene bounds
+	bool shadowDirty;
 	GLuint hatchingTextures;
 
 	int renderingMode;
@@ -54,6 +159,18 @@ public:
 	GLuint fragDataFB_AO;
 	GLuint fragDepthTex_AO;
 	
+	// layered rendering (複数のgeometryを、texture arrayの各レイヤーに一度に描画する)
+	GLuint layeredTex;
+	GLuint layeredFB;
+	GLuint layeredVAO;
+	GLuint layeredVBO;
+	int layeredWidth;
+	int layeredHeight;
+	int layeredLayers;
+	GLuint segmentVAO;
+	GLuint segmentBuffers[2];	// セグメントのパラメータ、親などの情報
+	GLuint segmentTextures[2];	// segmentBuffersを参照するtexture buffer
+
 	// second pass
 	GLuint secondPassVBO;
 	GLuint secondPassVAO;
@@ -62,31 +179,44 @@ public:
 	float uRadius;
 	float uPower;
 	float uKernelSize;
-	std::vector<float> uKernelOffsets;
+	std::vector<glm::vec4> uKernelOffsets;
 
 
 public:
 	RenderManager();
 	~RenderManager();
 
-	void init(bool useShadow, int shadowMapSize = 4096);
+	void init(bool useShadow, int shadowMapSize = 0);
 	
 	// ssao
 	void resize(int width,int height);
 	void resizeSsaoKernel();
+	void updateFrameUniforms(const glm::mat4& mvpMatrix, const glm::mat4& pMatrix, const glm::mat4& light_mvpMatrix, const glm::vec3& lightDir);
 
 	void addFaces(const std::vector<boost::shared_ptr<glutils::Face> >& faces);
-	void addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, bool lighting);
+	void addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, bool lighting, int vertexFormat = VertexLayout::FORMAT_FULL);
+	void addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool lighting, int vertexFormat = VertexLayout::FORMAT_FULL);
 	void removeObjects();
 	void removeObject(const QString& object_name);
 	void centerObjects();
-	void renderAll();
-	void renderAllExcept(const QString& object_name);
-	void render(const QString& object_name);
-	void updateShadowMap(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix);
+	void renderAll(bool shadow = true);
+	void renderAllExcept(const QString& object_name, bool shadow = true);
+	void render(const QString& object_name, bool shadow = true);
+	void setShadowMapSize(int size);
+	void updateShadowMap(const glm::vec3& light_dir, glm::mat4& light_mvpMatrix);
+	void renderLayered(const std::vector<std::vector<Vertex> >& geometries, const glm::mat4& mvpMatrix, int width, int height, std::vector<unsigned char>& pixels, Profiler* profiler = NULL);
+	void renderSegmentsLayered(const std::vector<std::vector<BranchSegment> >& trees, const glm::mat4& mvpMatrix, int width, int height, std::vector<unsigned char>& pixels, Profiler* profiler = NULL);
 	
 
 private:
+	void setObjectState(GLuint texId, bool lighting, bool shadow);
+	void buildBatches();
+	void releaseBatches();
+	GLuint textureId(const QString& texture_file);
+	void resizeLayered(int width, int height, int layers);
+	void readLayers(int start, int numLayers, int width, int height, std::vector<unsigned char>& pixels, std::vector<unsigned char>& remainder, Profiler* profiler);
+	void renderBatches(const QString* excluded_name, bool shadow);
+	bool computeBoundingBox(glm::vec3& minPt, glm::vec3& maxPt);
 	GLuint loadTexture(const QString& filename);
 	GLuint load3DTexture(const std::vector<QString> & pathes);
 };
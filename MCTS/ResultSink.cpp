@@ -0,0 +1,141 @@
+#include "ResultSink.h"
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <iostream>
+
+void MemoryResultSink::begin(const cv::Mat& target) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->target = target;
+	images.clear();
+	lines.clear();
+}
+
+void MemoryResultSink::stepResult(int step, const cv::Mat& image) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (images.size() <= step) images.resize(step + 1);
+	images[step] = image;
+}
+
+void MemoryResultSink::visits(const std::string& line) {
+	std::lock_guard<std::mutex> lock(mutex);
+	lines.push_back(line);
+}
+
+std::vector<cv::Mat> MemoryResultSink::getImages() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return images;
+}
+
+std::vector<std::string> MemoryResultSink::getVisits() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return lines;
+}
+
+/**
+ * @param directory		出力先のディレクトリ。begin()のたびに削除して作り直す。
+ * @param maxQueueSize	書き込み待ちの出力の最大数
+ */
+AsyncFileResultSink::AsyncFileResultSink(const std::string& directory, size_t maxQueueSize) : queue(maxQueueSize) {
+	this->directory = directory;
+	dropped = 0;
+	flushRequested = 0;
+	flushDone = 0;
+
+	writer = std::thread(&AsyncFileResultSink::run, this);
+}
+
+AsyncFileResultSink::~AsyncFileResultSink() {
+	queue.close();
+	writer.join();
+}
+
+void AsyncFileResultSink::begin(const cv::Mat& target) {
+	dropped = 0;
+
+	// begin/endは探索の外で呼ばれるので、捨てずに空きを待つ
+	Task task;
+	task.type = Task::BEGIN;
+	task.image = target.clone();
+	queue.push(task);
+}
+
+void AsyncFileResultSink::stepResult(int step, const cv::Mat& image) {
+	Task task;
+	task.type = Task::IMAGE;
+	task.step = step;
+	task.image = image;
+	enqueue(task);
+}
+
+void AsyncFileResultSink::visits(const std::string& line) {
+	Task task;
+	task.type = Task::VISITS;
+	task.text = line;
+	enqueue(task);
+}
+
+/**
+ * それまでに受け取った出力を、全て書き終えるまで待つ。
+ */
+void AsyncFileResultSink::end() {
+	int id;
+	{
+		std::lock_guard<std::mutex> lock(flushMutex);
+		id = ++flushRequested;
+	}
+
+	Task task;
+	task.type = Task::FLUSH;
+	queue.push(task);
+
+	std::unique_lock<std::mutex> lock(flushMutex);
+	flushed.wait(lock, [this, id]() { return flushDone >= id; });
+
+	if (dropped > 0) {
+		std::cout << "ResultSink: " << dropped << " outputs were dropped because the queue was full." << std::endl;
+	}
+}
+
+void AsyncFileResultSink::enqueue(const Task& task) {
+	if (!queue.tryPush(task)) {
+		dropped++;
+	}
+}
+
+void AsyncFileResultSink::run() {
+	QString dir = QString::fromStdString(directory);
+
+	Task task;
+	while (queue.pop(task)) {
+		if (task.type == Task::BEGIN) {
+			if (QDir(dir).exists()) {
+				QDir(dir).removeRecursively();
+			}
+			QDir().mkpath(dir);
+			target = task.image;
+		}
+		else if (task.type == Task::IMAGE) {
+			// ターゲットと半々で合成して保存する
+			cv::Mat image;
+			cv::cvtColor(task.image, image, CV_GRAY2BGR);
+			if (target.size() == image.size() && target.type() == image.type()) {
+				cv::addWeighted(target, 0.5, image, 0.5, 0.0, image);
+			}
+
+			QString filename = QString("%1/result_%2.png").arg(dir).arg(task.step);
+			cv::imwrite(filename.toUtf8().constData(), image);
+		}
+		else if (task.type == Task::VISITS) {
+			QFile file(dir + "/visits.txt");
+			file.open(QIODevice::Append);
+			QTextStream out(&file);
+			out << QString::fromStdString(task.text) << "\n";
+		}
+		else if (task.type == Task::FLUSH) {
+			std::lock_guard<std::mutex> lock(flushMutex);
+			flushDone++;
+			flushed.notify_all();
+		}
+	}
+}
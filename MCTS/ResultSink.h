@@ -0,0 +1,123 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "BoundedQueue.h"
+
+/**
+ * MCTS::inverseのデバッグ出力（各ステップの結果画像、探索木の訪問回数）の出力先。
+ * 探索のスレッドから呼ばれるので、実装はディスクI/OやPNGのエンコードで探索をブロックしないこと。
+ */
+class ResultSink {
+public:
+	virtual ~ResultSink() {}
+
+	/**
+	 * 探索の開始時に呼ばれる。
+	 *
+	 * @param target	ターゲットのスケッチ (8bit x 3ch)。結果画像の背景に使う。
+	 */
+	virtual void begin(const cv::Mat& target) = 0;
+
+	/**
+	 * 結果画像が必要かどうか。falseなら、MCTSは結果画像の描画自体を省略する。
+	 */
+	virtual bool wantsImages() const = 0;
+
+	/**
+	 * derivationの各ステップの結果を受け取る。
+	 *
+	 * @param step		ステップ番号
+	 * @param image		そのステップの結果 (8bit x 1ch)。呼び出し後にMCTS側で再利用しないので、コピーせずに保持してよい。
+	 */
+	virtual void stepResult(int step, const cv::Mat& image) = 0;
+
+	/**
+	 * 各ステップの探索後、ルートの子ノードの訪問回数などを1行で受け取る。
+	 */
+	virtual void visits(const std::string& line) = 0;
+
+	/**
+	 * 探索の終了時に呼ばれる。それまでに受け取った出力を全て書き出す。
+	 */
+	virtual void end() = 0;
+};
+
+/**
+ * 何も出力しない。ベンチマークなど、探索だけを計測したい場合に使う。
+ */
+class NullResultSink : public ResultSink {
+public:
+	void begin(const cv::Mat& target) {}
+	bool wantsImages() const { return false; }
+	void stepResult(int step, const cv::Mat& image) {}
+	void visits(const std::string& line) {}
+	void end() {}
+};
+
+/**
+ * 出力をメモリに保持する。テストや、GUIで結果を表示する場合に使う。
+ */
+class MemoryResultSink : public ResultSink {
+private:
+	mutable std::mutex mutex;
+	cv::Mat target;
+	std::vector<cv::Mat> images;
+	std::vector<std::string> lines;
+
+public:
+	void begin(const cv::Mat& target);
+	bool wantsImages() const { return true; }
+	void stepResult(int step, const cv::Mat& image);
+	void visits(const std::string& line);
+	void end() {}
+
+	std::vector<cv::Mat> getImages() const;
+	std::vector<std::string> getVisits() const;
+};
+
+/**
+ * 専用のスレッドでファイルに書き出す。
+ * 結果画像とターゲットの合成、PNGのエンコード、visits.txtへの追記は全て書き込みスレッドで行う。
+ * キューが満杯の場合、探索をブロックしないよう、その出力は捨てる（捨てた数はend()で表示する）。
+ */
+class AsyncFileResultSink : public ResultSink {
+private:
+	struct Task {
+		enum { BEGIN = 0, IMAGE, VISITS, FLUSH };
+
+		int type;
+		int step;
+		cv::Mat image;
+		std::string text;
+	};
+
+	std::string directory;
+	BoundedQueue<Task> queue;
+	std::thread writer;
+	cv::Mat target;			// 書き込みスレッドだけが使う
+	int dropped;
+	std::mutex flushMutex;
+	std::condition_variable flushed;
+	int flushRequested;
+	int flushDone;
+
+public:
+	AsyncFileResultSink(const std::string& directory, size_t maxQueueSize = 64);
+	~AsyncFileResultSink();
+
+	void begin(const cv::Mat& target);
+	bool wantsImages() const { return true; }
+	void stepResult(int step, const cv::Mat& image);
+	void visits(const std::string& line);
+	void end();
+
+private:
+	void enqueue(const Task& task);
+	void run();
+};
@@ -0,0 +1,309 @@
+#include "SampleFormat.h"
+#include <QDir>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+namespace pmtree {
+
+	namespace {
+
+		void writeVarint(uint32_t value, std::vector<unsigned char>& data) {
+			while (value >= 0x80) {
+				data.push_back((unsigned char)(value | 0x80));
+				value >>= 7;
+			}
+			data.push_back((unsigned char)value);
+		}
+
+		bool readVarint(const unsigned char*& p, const unsigned char* end, uint32_t& value) {
+			value = 0;
+			for (int shift = 0; shift < 35; shift += 7) {
+				if (p >= end) return false;
+				unsigned char b = *p++;
+				value |= (uint32_t)(b & 0x7f) << shift;
+				if ((b & 0x80) == 0) return true;
+			}
+			return false;
+		}
+
+	}
+
+	/**
+	 * 2値のパッチを、1画素1bit (行優先、各byteの上位bitから、白 = 1) に詰める。
+	 *
+	 * @param patch			パッチ (8bit x 1ch、128以上を白とする)
+	 * @param data [OUT]	詰めたデータ (ceil(画素数 / 8) byte)
+	 */
+	void packMask(const cv::Mat& patch, std::vector<unsigned char>& data) {
+		data.assign((patch.rows * patch.cols + 7) / 8, 0);
+
+		int bit = 0;
+		for (int r = 0; r < patch.rows; ++r) {
+			const unsigned char* row = patch.ptr<unsigned char>(r);
+			for (int c = 0; c < patch.cols; ++c, ++bit) {
+				if (row[c] >= 128) data[bit >> 3] |= 0x80 >> (bit & 7);
+			}
+		}
+	}
+
+	bool unpackMask(const unsigned char* data, size_t size, int patchSize, cv::Mat& patch) {
+		if (size < (patchSize * patchSize + 7) / 8) return false;
+
+		patch.create(patchSize, patchSize, CV_8U);
+		int bit = 0;
+		for (int r = 0; r < patchSize; ++r) {
+			unsigned char* row = patch.ptr<unsigned char>(r);
+			for (int c = 0; c < patchSize; ++c, ++bit) {
+				row[c] = (data[bit >> 3] & (0x80 >> (bit & 7))) ? 255 : 0;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * 2値のパッチを、黒から始めて黒・白交互の連続長 (varint) で表す。
+	 * スケッチのパッチはほとんど白なので、多くの場合bitに詰めるより小さくなる。
+	 *
+	 * @param patch			パッチ (8bit x 1ch、128以上を白とする)
+	 * @param data [OUT]	符号化したデータ
+	 */
+	void encodeRLE(const cv::Mat& patch, std::vector<unsigned char>& data) {
+		data.clear();
+
+		bool white = false;
+		uint32_t run = 0;
+		for (int r = 0; r < patch.rows; ++r) {
+			const unsigned char* row = patch.ptr<unsigned char>(r);
+			for (int c = 0; c < patch.cols; ++c) {
+				if ((row[c] >= 128) != white) {
+					writeVarint(run, data);
+					white = !white;
+					run = 0;
+				}
+				run++;
+			}
+		}
+		writeVarint(run, data);
+	}
+
+	bool decodeRLE(const unsigned char* data, size_t size, int patchSize, cv::Mat& patch) {
+		patch.create(patchSize, patchSize, CV_8U);
+		unsigned char* pixels = patch.ptr<unsigned char>(0);
+		size_t total = (size_t)patchSize * patchSize;
+
+		const unsigned char* p = data;
+		const unsigned char* end = data + size;
+		size_t filled = 0;
+		bool white = false;
+		while (p < end) {
+			uint32_t run;
+			if (!readVarint(p, end, run) || filled + run > total) return false;
+			memset(pixels + filled, white ? 255 : 0, run);
+			filled += run;
+			white = !white;
+		}
+
+		return filled == total;
+	}
+
+	SampleWriter::SampleWriter(const std::string& directory, int samplesPerShard) {
+		this->directory = directory;
+		this->samplesPerShard = samplesPerShard;
+		numShards = 0;
+		numSamples = 0;
+		numBytes = 0;
+	}
+
+	SampleWriter::~SampleWriter() {
+		close();
+	}
+
+	/**
+	 * サンプルを1つ書き出す。シャードのレイアウト（パッチのサイズ、パラメータ数）は、各シャードの最初のサンプルで決まる。
+	 *
+	 * @param patch		パッチ (patchSize x patchSize、8bit x 1ch、2値)
+	 * @param params	パラメータ ([0, 1]に正規化されていること)
+	 * @return			書き出せなければ (レイアウトが合わない、ファイルが開けない場合も) false
+	 */
+	bool SampleWriter::write(const cv::Mat& patch, const std::vector<float>& params) {
+		if (patch.type() != CV_8U || patch.rows != patch.cols) return false;
+
+		if (out.is_open() && header.numRecords >= samplesPerShard) {
+			closeShard();
+		}
+		if (!out.is_open()) {
+			if (!openShard(patch.rows, params.size())) return false;
+		}
+		if (patch.rows != header.patchSize || params.size() != header.numParams) return false;
+
+		// パラメータをuint8に量子化
+		unsigned char quantized[256];
+		for (int i = 0; i < params.size() && i < 256; ++i) {
+			quantized[i] = (unsigned char)(std::min(std::max(params[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+
+		// bitに詰めるかRLEかの、小さい方で保存
+		packMask(patch, bits);
+		encodeRLE(patch, rle);
+		const std::vector<unsigned char>& mask = rle.size() < bits.size() ? rle : bits;
+
+		SampleIndexEntry entry;
+		entry.offset = offset;
+		entry.size = params.size() + mask.size();
+		entry.encoding = rle.size() < bits.size() ? ENCODING_RLE : ENCODING_BITS;
+		index.push_back(entry);
+
+		out.write((const char*)quantized, params.size());
+		out.write((const char*)mask.data(), mask.size());
+		offset += entry.size;
+
+		header.numRecords++;
+		numSamples++;
+		numBytes += entry.size;
+		return true;
+	}
+
+	void SampleWriter::close() {
+		if (out.is_open()) closeShard();
+	}
+
+	bool SampleWriter::openShard(int patchSize, int numParams) {
+		if (numParams > 256) return false;
+
+		QDir().mkpath(directory.c_str());
+
+		std::stringstream filename;
+		filename << directory << "/shard_" << std::setw(5) << std::setfill('0') << numShards << ".bin";
+		out.open(filename.str().c_str(), std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+
+		header.magic = SAMPLE_MAGIC;
+		header.version = SAMPLE_VERSION;
+		header.patchSize = patchSize;
+		header.numParams = numParams;
+		header.numRecords = 0;
+		header.reserved = 0;
+		out.write((const char*)&header, sizeof(SampleHeader));
+
+		index.clear();
+		offset = sizeof(SampleHeader);
+		numShards++;
+		return true;
+	}
+
+	/**
+	 * インデックスとフッタを書き、レコード数をヘッダに書き込んでシャードを閉じる。
+	 */
+	void SampleWriter::closeShard() {
+		// インデックスはメモリマップして直接参照するので、8byte境界に揃える
+		static const char padding[8] = { 0 };
+		int pad = (8 - offset % 8) % 8;
+		out.write(padding, pad);
+
+		SampleFooter footer;
+		footer.indexOffset = offset + pad;
+		footer.numRecords = index.size();
+		footer.magic = SAMPLE_MAGIC;
+		out.write((const char*)index.data(), sizeof(SampleIndexEntry) * index.size());
+		out.write((const char*)&footer, sizeof(SampleFooter));
+
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(SampleHeader));
+		out.close();
+
+		numBytes += sizeof(SampleHeader) + pad + sizeof(SampleIndexEntry) * index.size() + sizeof(SampleFooter);
+		index.clear();
+	}
+
+	SampleReader::SampleReader() {
+		data = NULL;
+		size = 0;
+		header = NULL;
+		index = NULL;
+	}
+
+	SampleReader::~SampleReader() {
+		close();
+	}
+
+	/**
+	 * シャードファイルをメモリマップして開く。レコードはread()するまで展開しない。
+	 *
+	 * @param filename		シャードファイル
+	 * @return				開けない、または形式が正しくなければfalse
+	 */
+	bool SampleReader::open(const QString& filename) {
+		close();
+
+		file.setFileName(filename);
+		if (!file.open(QIODevice::ReadOnly)) return false;
+
+		size = file.size();
+		data = file.map(0, size);
+		if (data == NULL || size < sizeof(SampleHeader) + sizeof(SampleFooter)) {
+			close();
+			return false;
+		}
+
+		const SampleFooter* footer = (const SampleFooter*)(data + size - sizeof(SampleFooter));
+		header = (const SampleHeader*)data;
+		if (header->magic != SAMPLE_MAGIC || header->version != SAMPLE_VERSION || footer->magic != SAMPLE_MAGIC || footer->numRecords != header->numRecords
+			|| footer->indexOffset % 8 != 0 || footer->indexOffset < sizeof(SampleHeader) || footer->indexOffset > size
+			|| size - footer->indexOffset != (unsigned long long)footer->numRecords * sizeof(SampleIndexEntry) + sizeof(SampleFooter)) {
+			std::cout << "Error: " << filename.toUtf8().constData() << " is not a valid sample file." << std::endl;
+			close();
+			return false;
+		}
+		index = (const SampleIndexEntry*)(data + footer->indexOffset);
+
+		return true;
+	}
+
+	void SampleReader::close() {
+		if (data != NULL) {
+			file.unmap(const_cast<unsigned char*>(data));
+		}
+		file.close();
+		data = NULL;
+		size = 0;
+		header = NULL;
+		index = NULL;
+	}
+
+	/**
+	 * i番目のレコードを展開する。
+	 *
+	 * @param i				レコードの番号
+	 * @param patch [OUT]	パッチ (patchSize x patchSize、8bit x 1ch、0か255)
+	 * @param params [OUT]	パラメータ (量子化したものを[0, 1]に戻した値)
+	 * @return				番号が範囲外、またはレコードが壊れていればfalse
+	 */
+	bool SampleReader::read(int i, cv::Mat& patch, std::vector<float>& params) const {
+		if (header == NULL || i < 0 || i >= header->numRecords) return false;
+
+		// レコードはヘッダとインデックスの間にある。壊れたoffsetで足し算がオーバーフローしないよう、引き算で確認する
+		const SampleIndexEntry& entry = index[i];
+		unsigned long long end = (const unsigned char*)index - data;
+		if (entry.offset < sizeof(SampleHeader) || entry.offset > end || entry.size > end - entry.offset || entry.size < header->numParams) return false;
+
+		const unsigned char* record = data + entry.offset;
+		params.resize(header->numParams);
+		for (int k = 0; k < header->numParams; ++k) {
+			params[k] = record[k] / 255.0f;
+		}
+
+		const unsigned char* mask = record + header->numParams;
+		size_t maskSize = entry.size - header->numParams;
+		if (entry.encoding == ENCODING_RLE) {
+			return decodeRLE(mask, maskSize, header->patchSize, patch);
+		}
+		else {
+			return unpackMask(mask, maskSize, header->patchSize, patch);
+		}
+	}
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QFile>
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * PMTree2Dの学習データ（2値のパッチ画像 + 正規化されたパラメータ）を詰めて保存する形式。
+ *
+ * シャードファイル (<directory>/shard_00000.bin, ...) の構成（リトルエンディアン）:
+ *   Header
+ *   レコード[numRecords]			可変長。uint8_t[numParams] (量子化したパラメータ) + パッチ
+ *   IndexEntry[numRecords]		各レコードの位置、サイズ、パッチの符号化方法
+ *   Footer						ファイルの末尾。インデックスの位置
+ *
+ * パッチは閾値処理済みの2値画像なので、1画素1bitに詰める (ENCODING_BITS) か、
+ * 白黒の連続長をvarintで並べる (ENCODING_RLE) かの、小さい方で保存する。
+ * パラメータは[0, 1]に正規化されている前提で、uint8_tに量子化する (誤差は1/510以下)。
+ *
+ * SampleReaderはファイルをメモリマップして、インデックスで任意のレコードを直接読むので、
+ * メモリに収まらない大きさのデータセットでもシャッフルして読める。
+ */
+namespace pmtree {
+
+	const uint32_t SAMPLE_MAGIC = 0x53544d50;		// "PMTS"
+	const uint32_t SAMPLE_VERSION = 2;
+
+	enum { ENCODING_BITS = 0, ENCODING_RLE };
+
+	struct SampleHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t patchSize;
+		uint32_t numParams;
+		uint32_t numRecords;
+		uint32_t reserved;
+	};
+
+	struct SampleIndexEntry {
+		uint64_t offset;		// ファイルの先頭からのレコードの位置
+		uint32_t size;			// レコードのサイズ [byte]
+		uint32_t encoding;
+	};
+
+	struct SampleFooter {
+		uint64_t indexOffset;
+		uint32_t numRecords;
+		uint32_t magic;
+	};
+
+	void packMask(const cv::Mat& patch, std::vector<unsigned char>& data);
+	bool unpackMask(const unsigned char* data, size_t size, int patchSize, cv::Mat& patch);
+	void encodeRLE(const cv::Mat& patch, std::vector<unsigned char>& data);
+	bool decodeRLE(const unsigned char* data, size_t size, int patchSize, cv::Mat& patch);
+
+	/**
+	 * サンプルをシャードファイルに順に書き出す。
+	 * 1つのシャードに最大samplesPerShard個まで書き、いっぱいになったら次のシャードを作る。
+	 */
+	class SampleWriter {
+	private:
+		std::string directory;
+		int samplesPerShard;
+		std::ofstream out;
+		SampleHeader header;
+		std::vector<SampleIndexEntry> index;
+		uint64_t offset;
+		std::vector<unsigned char> bits;
+		std::vector<unsigned char> rle;
+		int numShards;
+		long long numSamples;
+		long long numBytes;
+
+	public:
+		SampleWriter(const std::string& directory, int samplesPerShard);
+		~SampleWriter();
+
+		bool write(const cv::Mat& patch, const std::vector<float>& params);
+		void close();
+		int shards() const { return numShards; }
+		long long samples() const { return numSamples; }
+		long long bytes() const { return numBytes; }
+
+	private:
+		bool openShard(int patchSize, int numParams);
+		void closeShard();
+	};
+
+	/**
+	 * シャードファイルをメモリマップして、任意のレコードを読む。
+	 * 読み込みはconstで内部状態を変えないので、複数のスレッドから同時にread()してよい。
+	 */
+	class SampleReader {
+	private:
+		QFile file;
+		const unsigned char* data;
+		size_t size;
+		const SampleHeader* header;
+		const SampleIndexEntry* index;
+
+	public:
+		SampleReader();
+		~SampleReader();
+
+		bool open(const QString& filename);
+		void close();
+		int numRecords() const { return header != NULL ? header->numRecords : 0; }
+		int patchSize() const { return header != NULL ? header->patchSize : 0; }
+		int numParams() const { return header != NULL ? header->numParams : 0; }
+		bool read(int i, cv::Mat& patch, std::vector<float>& params) const;
+	};
+
+}
@@ -0,0 +1,489 @@
+#include "Serialization.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <map>
+#include <algorithm>
+
+namespace mcts {
+namespace serialization {
+
+	namespace {
+
+		/**
+		 * derivation treeを前順にたどって、レコードの配列にする。
+		 *
+		 * @param root				derivation treeのルート
+		 * @param records [OUT]		各ノードのレコード
+		 * @param indices [OUT]		ノードから、前順でのindexへのマップ
+		 */
+		void flatten(const boost::shared_ptr<Nonterminal>& root, std::vector<NonterminalRecord>& records, std::map<const Nonterminal*, uint32_t>& indices) {
+			if (root == NULL) return;
+
+			std::vector<boost::shared_ptr<Nonterminal> > stack;
+			stack.push_back(root);
+			while (!stack.empty()) {
+				boost::shared_ptr<Nonterminal> node = stack.back();
+				stack.pop_back();
+
+				NonterminalRecord record;
+				memset(&record, 0, sizeof(record));
+				record.symbol = node->symbol;
+				record.level = node->level;
+				record.dist = node->dist;
+				record.segmentLength = node->segmentLength;
+				record.segmentWidth = node->segmentWidth;
+				record.angle = node->angle;
+				record.flags = node->terminal ? NonterminalRecord::FLAG_TERMINAL : 0;
+				record.numChildren = node->children.size();
+
+				indices[node.get()] = records.size();
+				records.push_back(record);
+
+				for (int i = (int)node->children.size() - 1; i >= 0; --i) {
+					stack.push_back(node->children[i]);
+				}
+			}
+		}
+
+		void flatten(const State& state, std::vector<NonterminalRecord>& records, std::vector<uint32_t>& queue) {
+			std::map<const Nonterminal*, uint32_t> indices;
+			flatten(state.derivationTree.root, records, indices);
+
+			for (auto it = state.queue.begin(); it != state.queue.end(); ++it) {
+				queue.push_back(indices[it->get()]);
+			}
+		}
+
+		template<typename T>
+		void append(std::vector<char>& buffer, const std::vector<T>& items) {
+			if (items.empty()) return;
+
+			size_t offset = buffer.size();
+			buffer.resize(offset + sizeof(T) * items.size());
+			memcpy(&buffer[offset], &items[0], sizeof(T) * items.size());
+		}
+
+		/**
+		 * 現在のgrammarの記号名を、'\0'区切りで定義順に並べる（4byte境界まで'\0'で埋める）。
+		 */
+		void symbolTable(std::vector<char>& names) {
+			const Grammar& grammar = Grammar::current();
+			for (int i = 0; i < grammar.symbols.size(); ++i) {
+				names.insert(names.end(), grammar.symbols[i].name.begin(), grammar.symbols[i].name.end());
+				names.push_back('\0');
+			}
+			names.resize((names.size() + 3) / 4 * 4, '\0');
+		}
+
+		/**
+		 * ヘッダと各セクションを、1つのバッファにまとめる。
+		 */
+		void assemble(uint32_t type, const std::vector<NonterminalRecord>& nonterminals, const std::vector<uint32_t>& queue, const std::vector<SearchNodeRecord>& searchNodes, const std::vector<int32_t>& actions, const std::vector<float>& values, std::vector<char>& buffer) {
+			std::vector<char> names;
+			symbolTable(names);
+
+			Header header;
+			memset(&header, 0, sizeof(header));
+			header.magic = MAGIC;
+			header.version = VERSION;
+			header.type = type;
+			header.headerSize = sizeof(Header);
+			header.numNonterminals = nonterminals.size();
+			header.numQueue = queue.size();
+			header.numSearchNodes = searchNodes.size();
+			header.numActions = actions.size();
+			header.numValues = values.size();
+			header.initialSegmentLength = INITIAL_SEGMENT_LENGTH;
+			header.initialSegmentWidth = INITIAL_SEGMENT_WIDTH;
+			header.maxLevel = MAX_LEVEL;
+			header.maxDist = MAX_DIST;
+			header.numSymbols = Grammar::current().symbols.size();
+			header.symbolNamesSize = names.size();
+
+			buffer.resize(sizeof(Header));
+			memcpy(&buffer[0], &header, sizeof(Header));
+			append(buffer, names);
+			append(buffer, nonterminals);
+			append(buffer, queue);
+			append(buffer, searchNodes);
+			append(buffer, actions);
+			append(buffer, values);
+		}
+
+		/**
+		 * 前順のレコードから、derivation treeを復元する。
+		 * 記号のindexは、Reader::validate()で記号名の表が現在のgrammarと一致することを確認しているので、そのまま使える。
+		 *
+		 * @param records		各ノードのレコード
+		 * @param num			レコード数
+		 * @param nodes [OUT]	復元した各ノード（前順）
+		 * @return				レコードが木として正しくない、記号のindexが範囲外、または子ノード数が残りのレコード数より多ければfalse
+		 */
+		bool unflatten(const NonterminalRecord* records, uint32_t num, std::vector<boost::shared_ptr<Nonterminal> >& nodes) {
+			nodes.clear();
+			nodes.reserve(num);
+
+			std::vector<std::pair<Nonterminal*, uint32_t> > stack;	// (ノード, 残りの子ノード数)
+			for (uint32_t i = 0; i < num; ++i) {
+				const NonterminalRecord& record = records[i];
+				if (record.symbol < -1 || record.symbol >= (int)Grammar::current().symbols.size()) return false;
+
+				// 子ノードは後ろのレコードなので、残りのレコード数より多ければ壊れている (reserveで巨大な確保をしないよう先に確認する)
+				if (record.numChildren > num - i - 1) return false;
+
+				boost::shared_ptr<Nonterminal> node = boost::shared_ptr<Nonterminal>(new Nonterminal(record.symbol, record.level, record.dist, record.segmentLength, record.angle, (record.flags & NonterminalRecord::FLAG_TERMINAL) != 0));
+				node->segmentWidth = record.segmentWidth;
+				node->children.reserve(record.numChildren);
+
+				if (i > 0) {
+					if (stack.empty()) return false;
+					stack.back().first->children.push_back(node);
+					if (--stack.back().second == 0) stack.pop_back();
+				}
+				if (record.numChildren > 0) {
+					stack.push_back(std::make_pair(node.get(), record.numChildren));
+				}
+
+				nodes.push_back(node);
+			}
+			if (!stack.empty()) return false;
+
+			if (num > 0) updateModelMatrices(nodes[0]);
+			return true;
+		}
+
+		/**
+		 * stateのqueueの先頭のnon-terminalに、actionを適用できるか。
+		 */
+		bool validAction(const State& state, int action) {
+			if (state.queue.empty()) return false;
+
+			const boost::shared_ptr<Nonterminal>& node = state.queue.front();
+			if (node->terminal || node->symbol < 0) return false;
+
+			std::vector<int> candidates = mcts::actions(node);
+			return std::find(candidates.begin(), candidates.end(), action) != candidates.end();
+		}
+
+		bool write(const std::string& filename, const std::vector<char>& buffer) {
+			std::ofstream out(filename.c_str(), std::ios::binary);
+			if (!out.is_open()) return false;
+
+			out.write(&buffer[0], buffer.size());
+			return out.good();
+		}
+
+	}
+
+	void serialize(const DerivationTree& derivationTree, std::vector<char>& buffer) {
+		std::vector<NonterminalRecord> nonterminals;
+		std::map<const Nonterminal*, uint32_t> indices;
+		flatten(derivationTree.root, nonterminals, indices);
+
+		assemble(TYPE_DERIVATION_TREE, nonterminals, std::vector<uint32_t>(), std::vector<SearchNodeRecord>(), std::vector<int32_t>(), std::vector<float>(), buffer);
+	}
+
+	void serialize(const State& state, std::vector<char>& buffer) {
+		std::vector<NonterminalRecord> nonterminals;
+		std::vector<uint32_t> queue;
+		flatten(state, nonterminals, queue);
+
+		assemble(TYPE_STATE, nonterminals, queue, std::vector<SearchNodeRecord>(), std::vector<int32_t>(), std::vector<float>(), buffer);
+	}
+
+	/**
+	 * 探索木を保存する。ルートのstateと、各ノードの統計量・未展開のactionを前順に格納する。
+	 */
+	void serialize(const boost::shared_ptr<MCTSTreeNode>& rootNode, std::vector<char>& buffer) {
+		std::vector<NonterminalRecord> nonterminals;
+		std::vector<uint32_t> queue;
+		flatten(rootNode->state, nonterminals, queue);
+
+		std::vector<SearchNodeRecord> searchNodes;
+		std::vector<int32_t> actions;
+		std::vector<float> values;
+
+		std::vector<MCTSTreeNode*> stack;
+		stack.push_back(rootNode.get());
+		while (!stack.empty()) {
+			MCTSTreeNode* node = stack.back();
+			stack.pop_back();
+
+			SearchNodeRecord record;
+			record.selectedAction = node == rootNode.get() ? -1 : node->selectedAction;
+			record.visits = node->visits;
+			record.bestValue = node->bestValue;
+			record.meanValue = node->meanValue;
+			record.varianceValues = node->varianceValues;
+			record.valueFixed = node->valueFixed ? 1 : 0;
+			record.numChildren = node->children.size();
+			record.firstAction = actions.size();
+			record.numActions = node->unexpandedActions.size();
+			record.firstValue = values.size();
+			record.numValues = node->values.size();
+			searchNodes.push_back(record);
+
+			actions.insert(actions.end(), node->unexpandedActions.begin(), node->unexpandedActions.end());
+			values.insert(values.end(), node->values.begin(), node->values.end());
+
+			for (int i = (int)node->children.size() - 1; i >= 0; --i) {
+				stack.push_back(node->children[i].get());
+			}
+		}
+
+		assemble(TYPE_SEARCH_TREE, nonterminals, queue, searchNodes, actions, values, buffer);
+	}
+
+	bool save(const std::string& filename, const DerivationTree& derivationTree) {
+		std::vector<char> buffer;
+		serialize(derivationTree, buffer);
+		return write(filename, buffer);
+	}
+
+	bool save(const std::string& filename, const State& state) {
+		std::vector<char> buffer;
+		serialize(state, buffer);
+		return write(filename, buffer);
+	}
+
+	bool save(const std::string& filename, const boost::shared_ptr<MCTSTreeNode>& rootNode) {
+		std::vector<char> buffer;
+		serialize(rootNode, buffer);
+		return write(filename, buffer);
+	}
+
+	Reader::Reader() {
+		data = NULL;
+		size = 0;
+	}
+
+	Reader::~Reader() {
+		close();
+	}
+
+	/**
+	 * ファイルをメモリマップする。内容はコピーしない。
+	 *
+	 * @param filename		ファイル名
+	 * @return				開けない、または形式が正しくなければfalse
+	 */
+	bool Reader::open(const QString& filename) {
+		close();
+
+		file.setFileName(filename);
+		if (!file.open(QIODevice::ReadOnly)) return false;
+
+		size = file.size();
+		data = file.map(0, size);
+		if (data == NULL) {
+			close();
+			return false;
+		}
+
+		if (!validate()) {
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * メモリ上のデータ（別プロセスから受け取ったものなど）を読む。内容はコピーしないので、
+	 * Readerを使い終わるまでdataを解放しないこと。dataは4byte境界に揃っていること。
+	 */
+	bool Reader::attach(const void* data, size_t size) {
+		close();
+
+		this->data = (const unsigned char*)data;
+		this->size = size;
+		if (!validate()) {
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Reader::close() {
+		if (file.isOpen()) {
+			if (data != NULL) file.unmap(const_cast<unsigned char*>(data));
+			file.close();
+		}
+		data = NULL;
+		size = 0;
+	}
+
+	const Header* Reader::header() const {
+		return (const Header*)data;
+	}
+
+	const char* Reader::symbolNames() const {
+		return (const char*)(data + header()->headerSize);
+	}
+
+	const NonterminalRecord* Reader::nonterminals() const {
+		return (const NonterminalRecord*)(symbolNames() + header()->symbolNamesSize);
+	}
+
+	const uint32_t* Reader::queue() const {
+		return (const uint32_t*)(nonterminals() + header()->numNonterminals);
+	}
+
+	const SearchNodeRecord* Reader::searchNodes() const {
+		return (const SearchNodeRecord*)(queue() + header()->numQueue);
+	}
+
+	const int32_t* Reader::actions() const {
+		return (const int32_t*)(searchNodes() + header()->numSearchNodes);
+	}
+
+	const float* Reader::values() const {
+		return (const float*)(actions() + header()->numActions);
+	}
+
+	bool Reader::read(DerivationTree& derivationTree) const {
+		std::vector<boost::shared_ptr<Nonterminal> > nodes;
+		if (!unflatten(nonterminals(), header()->numNonterminals, nodes)) return false;
+
+		derivationTree = nodes.empty() ? DerivationTree() : DerivationTree(nodes[0]);
+		return true;
+	}
+
+	bool Reader::read(State& state) const {
+		if (header()->type == TYPE_DERIVATION_TREE) return false;
+
+		std::vector<boost::shared_ptr<Nonterminal> > nodes;
+		if (!unflatten(nonterminals(), header()->numNonterminals, nodes)) return false;
+
+		state = State();
+		if (!nodes.empty()) state.derivationTree = DerivationTree(nodes[0]);
+
+		const uint32_t* indices = queue();
+		for (uint32_t i = 0; i < header()->numQueue; ++i) {
+			if (indices[i] >= nodes.size()) return false;
+			state.queue.push_back(nodes[indices[i]]);
+		}
+
+		return true;
+	}
+
+	/**
+	 * 探索木を復元する。各ノードのstateは、親のstateにselectedActionを適用して作り直す。
+	 * 適用できないaction（壊れたファイルなど）があればfalseを返す。
+	 */
+	bool Reader::read(boost::shared_ptr<MCTSTreeNode>& rootNode) const {
+		if (header()->type != TYPE_SEARCH_TREE || header()->numSearchNodes == 0) return false;
+
+		State rootState;
+		if (!read(rootState)) return false;
+
+		const SearchNodeRecord* records = searchNodes();
+		const int32_t* allActions = actions();
+		const float* allValues = values();
+
+		std::vector<std::pair<boost::shared_ptr<MCTSTreeNode>, uint32_t> > stack;	// (ノード, 残りの子ノード数)
+		for (uint32_t i = 0; i < header()->numSearchNodes; ++i) {
+			const SearchNodeRecord& record = records[i];
+			// uint32_tの足し算はオーバーフローしうるので、引き算で範囲を確認する
+			if (record.firstAction > header()->numActions || record.numActions > header()->numActions - record.firstAction) return false;
+			if (record.firstValue > header()->numValues || record.numValues > header()->numValues - record.firstValue) return false;
+			if (record.numChildren > header()->numSearchNodes - i - 1) return false;
+
+			boost::shared_ptr<MCTSTreeNode> node;
+			if (i == 0) {
+				node = boost::shared_ptr<MCTSTreeNode>(new MCTSTreeNode(rootState));
+				rootNode = node;
+			}
+			else {
+				if (stack.empty()) return false;
+				boost::shared_ptr<MCTSTreeNode> parent = stack.back().first;
+
+				// 親のstateで選べるactionでなければ、applyRuleが範囲外のruleを参照してしまう
+				if (!validAction(parent->state, record.selectedAction)) return false;
+
+				State state = parent->state.clone();
+				if (!state.applyAction(record.selectedAction)) return false;
+				node = boost::shared_ptr<MCTSTreeNode>(new MCTSTreeNode(state));
+				node->parent = parent;
+				parent->children.push_back(node);
+				if (--stack.back().second == 0) stack.pop_back();
+			}
+
+			node->selectedAction = record.selectedAction;
+			node->visits = record.visits;
+			node->bestValue = record.bestValue;
+			node->meanValue = record.meanValue;
+			node->varianceValues = record.varianceValues;
+			node->valueFixed = record.valueFixed != 0;
+			node->unexpandedActions.assign(allActions + record.firstAction, allActions + record.firstAction + record.numActions);
+			for (int k = 0; k < node->unexpandedActions.size(); ++k) {
+				if (!validAction(node->state, node->unexpandedActions[k])) return false;
+			}
+			node->values.assign(allValues + record.firstValue, allValues + record.firstValue + record.numValues);
+
+			if (record.numChildren > 0) {
+				stack.push_back(std::make_pair(node, record.numChildren));
+			}
+		}
+
+		return stack.empty();
+	}
+
+	/**
+	 * ヘッダと、各セクションがデータの範囲内に収まっていることを確認する。
+	 */
+	bool Reader::validate() {
+		if (data == NULL || size < sizeof(Header)) return false;
+
+		const Header* h = header();
+		if (h->magic != MAGIC || h->version != VERSION || h->headerSize < sizeof(Header) || h->headerSize % 4 != 0) {
+			std::cout << "Error: unsupported file format." << std::endl;
+			return false;
+		}
+
+		unsigned long long required = h->headerSize;
+		required += h->symbolNamesSize;
+		required += (unsigned long long)h->numNonterminals * sizeof(NonterminalRecord);
+		required += (unsigned long long)h->numQueue * sizeof(uint32_t);
+		required += (unsigned long long)h->numSearchNodes * sizeof(SearchNodeRecord);
+		required += (unsigned long long)h->numActions * sizeof(int32_t);
+		required += (unsigned long long)h->numValues * sizeof(float);
+		if (required > size) {
+			std::cout << "Error: the file is truncated." << std::endl;
+			return false;
+		}
+
+		if (h->symbolNamesSize % 4 != 0 || !matchesGrammar()) {
+			std::cout << "Error: the file was saved with a different grammar." << std::endl;
+			return false;
+		}
+
+		if (h->initialSegmentLength != INITIAL_SEGMENT_LENGTH || h->initialSegmentWidth != INITIAL_SEGMENT_WIDTH || h->maxLevel != MAX_LEVEL || h->maxDist != MAX_DIST) {
+			std::cout << "Warning: the file was saved with different grammar parameters." << std::endl;
+		}
+
+		return true;
+	}
+
+	/**
+	 * ファイルの記号名の表が、現在のgrammarの記号と（順番も含めて）一致するか。
+	 */
+	bool Reader::matchesGrammar() const {
+		const Grammar& grammar = Grammar::current();
+		if (header()->numSymbols != grammar.symbols.size()) return false;
+
+		const char* p = symbolNames();
+		const char* end = p + header()->symbolNamesSize;
+		for (int i = 0; i < grammar.symbols.size(); ++i) {
+			const char* name_end = std::find(p, end, '\0');
+			if (name_end == end || std::string(p, name_end) != grammar.symbols[i].name) return false;
+			p = name_end + 1;
+		}
+
+		return true;
+	}
+
+}
+}
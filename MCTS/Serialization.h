@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QFile>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "MCTS.h"
+
+/**
+ * DerivationTree、State、MCTSの探索木のバイナリ形式での保存・読み込み。
+ *
+ * ファイルの構成（全て4byte境界に揃えたPOD、リトルエンディアン）:
+ *   Header
+ *   char[symbolNamesSize]				保存時のgrammarの記号名 ('\0'区切りで定義順に並べ、4byte境界まで'\0'で埋める)
+ *   NonterminalRecord[numNonterminals]	derivation treeの各ノード（前順）
+ *   uint32_t[numQueue]					Stateのqueueに入っているノードの、前順でのindex
+ *   SearchNodeRecord[numSearchNodes]	探索木の各ノード（前順）
+ *   int32_t[numActions]				各探索ノードの未展開のaction
+ *   float[numValues]					各探索ノードのvalue
+ *
+ * 探索木の各ノードのstateは保存せず、ルートのstateに、各ノードのselectedActionを順に適用して復元する
+ * （MCTS::expandと同じ手順なので、同じstateになる）。
+ *
+ * 各ノードの記号はgrammarの記号のindexで保存するので、名前の長さに制限はない。
+ * 読み込み時には、記号名の表が現在のgrammar (Grammar::current()) と一致しなければエラーにする
+ * （actionの番号もgrammarのruleの順に依存するため）。
+ *
+ * Readerはファイルをメモリマップして、コピーせずにレコードを参照できる。
+ */
+namespace mcts {
+namespace serialization {
+
+	const uint32_t MAGIC = 0x5354434d;	// "MCTS"
+	const uint32_t VERSION = 2;
+
+	enum { TYPE_DERIVATION_TREE = 1, TYPE_STATE, TYPE_SEARCH_TREE };
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t type;
+		uint32_t headerSize;			// sizeof(Header)。将来フィールドを追加した時のため
+
+		uint32_t numNonterminals;
+		uint32_t numQueue;
+		uint32_t numSearchNodes;
+		uint32_t numActions;
+		uint32_t numValues;
+
+		// 保存時の文法パラメータ
+		float initialSegmentLength;
+		float initialSegmentWidth;
+		int32_t maxLevel;
+		int32_t maxDist;
+
+		uint32_t numSymbols;			// 保存時のgrammarの記号数
+		uint32_t symbolNamesSize;		// 記号名の表のbyte数 (4の倍数)
+		uint32_t reserved[1];
+	};
+
+	struct NonterminalRecord {
+		enum { FLAG_TERMINAL = 1 };
+
+		int32_t symbol;					// 記号のindex (-1 -- 記号なし)
+		int32_t level;
+		int32_t dist;
+		float segmentLength;
+		float segmentWidth;
+		float angle;
+		uint32_t flags;
+		uint32_t numChildren;
+	};
+
+	struct SearchNodeRecord {
+		int32_t selectedAction;
+		int32_t visits;
+		float bestValue;
+		float meanValue;
+		float varianceValues;
+		uint32_t valueFixed;
+		uint32_t numChildren;
+		uint32_t firstAction;			// actions[]の中での、このノードの未展開のactionの先頭
+		uint32_t numActions;
+		uint32_t firstValue;			// values[]の中での、このノードのvalueの先頭
+		uint32_t numValues;
+	};
+
+	/**
+	 * シリアライズしたデータを読むためのクラス。
+	 * open()ではファイルをメモリマップするだけで、各レコードはマップしたメモリを直接参照する。
+	 */
+	class Reader {
+	private:
+		QFile file;
+		const unsigned char* data;
+		size_t size;
+
+	public:
+		Reader();
+		~Reader();
+
+		bool open(const QString& filename);
+		bool attach(const void* data, size_t size);
+		void close();
+
+		const Header* header() const;
+		const char* symbolNames() const;
+		const NonterminalRecord* nonterminals() const;
+		const uint32_t* queue() const;
+		const SearchNodeRecord* searchNodes() const;
+		const int32_t* actions() const;
+		const float* values() const;
+
+		bool read(DerivationTree& derivationTree) const;
+		bool read(State& state) const;
+		bool read(boost::shared_ptr<MCTSTreeNode>& rootNode) const;
+
+	private:
+		bool validate();
+		bool matchesGrammar() const;
+	};
+
+	void serialize(const DerivationTree& derivationTree, std::vector<char>& buffer);
+	void serialize(const State& state, std::vector<char>& buffer);
+	void serialize(const boost::shared_ptr<MCTSTreeNode>& rootNode, std::vector<char>& buffer);
+
+	bool save(const std::string& filename, const DerivationTree& derivationTree);
+	bool save(const std::string& filename, const State& state);
+	bool save(const std::string& filename, const boost::shared_ptr<MCTSTreeNode>& rootNode);
+
+}
+}
@@ -40,15 +40,60 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 	loadTextFile(fragment_file, source);
 	GLuint fragment_shader = compileShader(source, GL_FRAGMENT_SHADER);
 
+	return linkProgram(vertex_shader, 0, fragment_shader, fragDataNamesP1);
+}
+
+/**
+ * 指定されたvertex shader、geometry shader、fragment shaderを読み込んでコンパイルし、
+ * プログラムにリンクする。
+ *
+ * @param vertex_file		vertex shader file
+ * @param geometry_file		geometry shader file
+ * @param fragment_file		frament shader file
+ * @return					program id
+ */
+uint Shader::createProgram(const string& vertex_file, const string& geometry_file, const string& fragment_file) {
+	std::cout << "Compiling " << vertex_file << std::endl;
+
+	std::string source;
+	loadTextFile(vertex_file, source);
+	GLuint vertex_shader = compileShader(source, GL_VERTEX_SHADER);
+
+	std::cout << "Compiling " << geometry_file << std::endl;
+
+	loadTextFile(geometry_file, source);
+	GLuint geometry_shader = compileShader(source, GL_GEOMETRY_SHADER);
+
+	std::cout << "Compiling " << fragment_file << std::endl;
+
+	loadTextFile(fragment_file, source);
+	GLuint fragment_shader = compileShader(source, GL_FRAGMENT_SHADER);
+
+	return linkProgram(vertex_shader, geometry_shader, fragment_shader, std::vector<QString>());
+}
+
+/**
+ * コンパイル済みのshaderをプログラムにリンクする。
+ *
+ * @param vertex_shader		vertex shader id
+ * @param geometry_shader	geometry shader id (0 -- geometry shaderなし)
+ * @param fragment_shader	fragment shader id
+ * @param fragDataNames		fragment shaderの出力変数名 (空の場合は"outputF")
+ * @return					program id
+ */
+GLuint Shader::linkProgram(GLuint vertex_shader, GLuint geometry_shader, GLuint fragment_shader, const std::vector<QString>& fragDataNames) {
 	// create program
 	GLuint program = glCreateProgram();
 	glAttachShader(program, vertex_shader);
+	if (geometry_shader > 0) {
+		glAttachShader(program, geometry_shader);
+	}
 	glAttachShader(program, fragment_shader);
-	if (fragDataNamesP1.size() == 0) {
+	if (fragDataNames.size() == 0) {
 		glBindFragDataLocation(program, 0, "outputF");
 	} else {
-		for (int i = 0; i < fragDataNamesP1.size(); ++i) {
-			glBindFragDataLocation(program, i, fragDataNamesP1[i].toUtf8().constData());
+		for (int i = 0; i < fragDataNames.size(); ++i) {
+			glBindFragDataLocation(program, i, fragDataNames[i].toUtf8().constData());
 		}
 	}
 	glLinkProgram(program);
@@ -71,8 +116,11 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 	
 	programs.push_back(program);
 	vertex_shaders.push_back(vertex_shader);
+	geometry_shaders.push_back(geometry_shader);
 	fragment_shaders.push_back(fragment_shader);
 
+	resolveUniforms(program);
+
 	return program;
 }
 
@@ -82,11 +130,70 @@ void Shader::cleanShaders() {
 		glDetachShader(programs[pN], fragment_shaders[pN]);
 		glDeleteShader(vertex_shaders[pN]);
 		glDeleteShader(fragment_shaders[pN]);
+		if (geometry_shaders[pN] > 0) {
+			glDetachShader(programs[pN], geometry_shaders[pN]);
+			glDeleteShader(geometry_shaders[pN]);
+		}
 		glDeleteProgram(programs[pN]);
 	}
 	programs.clear();
 	vertex_shaders.clear();
+	geometry_shaders.clear();
 	fragment_shaders.clear();
+	uniformLocations.clear();
+}
+
+/**
+ * リンク時に解決したuniform変数のlocationを返す。
+ * 毎フレームglGetUniformLocationを呼ばないよう、描画時にはこちらを使うこと。
+ *
+ * @param program		program id
+ * @param name			uniform変数名（配列の場合は"[0]"なしでも可）
+ * @return				location (見つからない、または最適化で削除された場合は-1)
+ */
+GLint Shader::uniformLocation(GLuint program, const string& name) const {
+	auto it = uniformLocations.find(program);
+	if (it == uniformLocations.end()) return -1;
+
+	auto it2 = it->second.find(name);
+	if (it2 == it->second.end()) return -1;
+
+	return it2->second;
+}
+
+/**
+ * リンク済みのprogramのactiveなuniform変数を列挙し、locationをキャッシュする。
+ * uniform block内の変数はlocationを持たないので、登録しない。
+ *
+ * @param program		program id
+ */
+void Shader::resolveUniforms(GLuint program) {
+	std::map<std::string, GLint>& locations = uniformLocations[program];
+	locations.clear();
+
+	GLint numUniforms = 0;
+	GLint maxNameLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> name(maxNameLength + 1);
+	for (GLint i = 0; i < numUniforms; ++i) {
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, i, name.size(), &length, &size, &type, name.data());
+
+		std::string uniformName(name.data(), length);
+		GLint location = glGetUniformLocation(program, uniformName.c_str());
+		if (location < 0) continue;
+
+		locations[uniformName] = location;
+
+		// 配列は"xxx[0]"として列挙されるので、"xxx"でも引けるようにする
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) {
+			locations[uniformName.substr(0, uniformName.size() - 3)] = location;
+		}
+	}
 }
 
 /**
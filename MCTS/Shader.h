@@ -2,6 +2,8 @@
 
 #include <QString>
 #include <vector>
+#include <map>
+#include <string>
 
 class Shader
 {
@@ -11,15 +13,21 @@ public:
 
 	uint createProgram(const std::string& vertex_file, const std::string& fragment_file);
 	uint createProgram(const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNamesP1);
+	uint createProgram(const std::string& vertex_file, const std::string& geometry_file, const std::string& fragment_file);
 	void cleanShaders();
+	GLint uniformLocation(GLuint program, const std::string& name) const;
 
 private:
+	GLuint linkProgram(GLuint vertex_shader, GLuint geometry_shader, GLuint fragment_shader, const std::vector<QString>& fragDataNames);
+	void resolveUniforms(GLuint program);
 	void loadTextFile(const std::string& filename, std::string& str);
 	GLuint compileShader(const std::string& source, GLuint mode);
 	
 private:
 	std::vector<GLuint> programs;
 	std::vector<GLuint> vertex_shaders;
+	std::vector<GLuint> geometry_shaders;	// 0 -- geometry shaderなし
 	std::vector<GLuint> fragment_shaders;
+	std::map<GLuint, std::map<std::string, GLint> > uniformLocations;
 };
 
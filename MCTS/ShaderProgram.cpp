@@ -0,0 +1,84 @@
+#include "ShaderProgram.h"
+
+namespace {
+
+	/**
+	 * samplerを指定したtexture unitに固定する。
+	 * texture unitは描画中に変わらないので、毎フレーム設定する必要はない。
+	 */
+	void bindSampler(const Shader& shader, GLuint program, const char* name, int unit) {
+		GLint location = shader.uniformLocation(program, name);
+		if (location >= 0) {
+			glProgramUniform1i(program, location, unit);
+		}
+	}
+
+}
+
+void Pass1Program::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	textureEnabled = shader.uniformLocation(id, "textureEnabled");
+	lighting = shader.uniformLocation(id, "lighting");
+	useShadow = shader.uniformLocation(id, "useShadow");
+	softShadow = shader.uniformLocation(id, "softShadow");
+
+	bindSampler(shader, id, "tex0", 0);
+	bindSampler(shader, id, "shadowMap", 6);
+}
+
+void SsaoProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	pixelSize = shader.uniformLocation(id, "pixelSize");
+	uKernelSize = shader.uniformLocation(id, "uKernelSize");
+	uRadius = shader.uniformLocation(id, "uRadius");
+	uPower = shader.uniformLocation(id, "uPower");
+
+	bindSampler(shader, id, "tex0", 1);
+	bindSampler(shader, id, "tex1", 2);
+	bindSampler(shader, id, "tex2", 3);
+	bindSampler(shader, id, "noiseTex", 7);
+	bindSampler(shader, id, "depthTex", 8);
+}
+
+void BlurProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	pixelSize = shader.uniformLocation(id, "pixelSize");
+	ssao_used = shader.uniformLocation(id, "ssao_used");
+
+	bindSampler(shader, id, "tex0", 1);
+	bindSampler(shader, id, "tex1", 2);
+	bindSampler(shader, id, "tex2", 3);
+	bindSampler(shader, id, "tex3", 4);
+	bindSampler(shader, id, "depthTex", 8);
+}
+
+void LineProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	pixelSize = shader.uniformLocation(id, "pixelSize");
+	useHatching = shader.uniformLocation(id, "useHatching");
+
+	bindSampler(shader, id, "tex0", 1);
+	bindSampler(shader, id, "tex1", 2);
+	bindSampler(shader, id, "tex2", 3);
+	bindSampler(shader, id, "tex3", 4);
+	bindSampler(shader, id, "hatchingTexture", 5);
+	bindSampler(shader, id, "depthTex", 8);
+}
+
+void LayeredProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	mvpMatrix = shader.uniformLocation(id, "mvpMatrix");
+}
+
+void SegmentProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	mvpMatrix = shader.uniformLocation(id, "mvpMatrix");
+
+	bindSampler(shader, id, "segments", SEGMENTS_UNIT);
+	bindSampler(shader, id, "links", LINKS_UNIT);
+}
+
+void ShadowProgram::resolve(const Shader& shader, GLuint id) {
+	this->id = id;
+	light_mvpMatrix = shader.uniformLocation(id, "light_mvpMatrix");
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "glew.h"
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+/**
+ * 全programで共有する毎フレームの定数。
+ * シェーダ側の "layout(std140, binding = 0) uniform FrameUniforms" と同じレイアウトにすること。
+ */
+struct FrameUniforms {
+	enum { BINDING = 0 };
+
+	glm::mat4 mvpMatrix;
+	glm::mat4 pMatrix;
+	glm::mat4 light_mvpMatrix;
+	glm::vec4 lightDir;		// xyzのみ使用
+};
+
+/**
+ * SSAOのカーネル。
+ * シェーダ側の "layout(std140, binding = 1) uniform SsaoKernel" と同じレイアウトにすること。
+ */
+struct SsaoKernelUniforms {
+	enum { BINDING = 1, MAX_KERNEL_SIZE = 128 };
+
+	glm::vec4 offsets[MAX_KERNEL_SIZE];	// std140では配列要素はvec4単位
+};
+
+/**
+ * 1st pass (geometry) のprogram。
+ * 各uniformのlocationはinit時に一度だけ解決し、samplerのtexture unitもその時に設定する。
+ */
+class Pass1Program {
+public:
+	GLuint id;
+	GLint textureEnabled;
+	GLint lighting;
+	GLint useShadow;
+	GLint softShadow;
+
+public:
+	Pass1Program() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+class SsaoProgram {
+public:
+	GLuint id;
+	GLint pixelSize;
+	GLint uKernelSize;
+	GLint uRadius;
+	GLint uPower;
+
+public:
+	SsaoProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+class BlurProgram {
+public:
+	GLuint id;
+	GLint pixelSize;
+	GLint ssao_used;
+
+public:
+	BlurProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+class LineProgram {
+public:
+	GLuint id;
+	GLint pixelSize;
+	GLint useHatching;
+
+public:
+	LineProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+/**
+ * 複数の候補をtexture arrayの各レイヤーに描画するprogram。
+ * FrameUniformsは使わず、mvpMatrixを直接指定する。
+ */
+class LayeredProgram {
+public:
+	GLuint id;
+	GLint mvpMatrix;
+
+public:
+	LayeredProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+/**
+ * 枝のセグメントのパラメータ (texture buffer) から、geometry shaderで四角形を生成して
+ * texture arrayの各レイヤーに描画するprogram。
+ */
+class SegmentProgram {
+public:
+	enum { SEGMENTS_UNIT = 10, LINKS_UNIT = 11 };
+
+	GLuint id;
+	GLint mvpMatrix;
+
+public:
+	SegmentProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
+
+class ShadowProgram {
+public:
+	GLuint id;
+	GLint light_mvpMatrix;
+
+public:
+	ShadowProgram() : id(0) {}
+	void resolve(const Shader& shader, GLuint id);
+};
@@ -1,5 +1,5 @@
 ﻿#include "ShadowMapping.h"
-#include "GLWidget3D.h"
+#include "RenderManager.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
 
@@ -14,12 +14,13 @@ ShadowMapping::ShadowMapping() {
  * シャドウマッピングの初期化。
  * 本関数は、GLWidget3D::initializeGL()内で呼び出すこと。
  *
- * @param programId		シェイダーのprogram id
+ * @param program		シャドウマップ用のprogram
  * @param width			シャドウマッピングの幅
  * @param height		シャドウマッピングの高さ
  */
-void ShadowMapping::init(int programId, int width, int height) {
-	this->programId = programId;
+void ShadowMapping::init(const ShadowProgram& program, int width, int height) {
+	this->programId = program.id;
+	this->light_mvpMatrixLocation = program.light_mvpMatrix;
 	this->width = width;
 	this->height = height;
 
@@ -56,15 +57,33 @@ void ShadowMapping::init(int programId, int width, int height) {
 	glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
 
+/**
+ * シャドウマップのテクスチャを、指定されたサイズで確保し直す。
+ *
+ * @param width			シャドウマッピングの幅
+ * @param height		シャドウマッピングの高さ
+ */
+void ShadowMapping::resize(int width, int height) {
+	if (this->width == width && this->height == height) return;
+
+	this->width = width;
+	this->height = height;
+
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, textureDepth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
 /**
  * シャドウマップを作成し、GL_TEXTURE6にテクスチャとして保存する。
  *
- * @param glWidget3D		GLWidget3Dクラス。このクラスのdrawScene(1)を呼び出してシーンを描画し、シャドウマップを生成する。
+ * @param renderManager	RenderManagerクラス。このクラスのrenderAll(false)を呼び出してシーンを描画し、シャドウマップを生成する。
  * @param light_dir			光の進行方向
  */
-void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix) {
-	int origWidth = glWidget3D->width();
-	int origHeigh = glWidget3D->height();
+void ShadowMapping::update(RenderManager* renderManager, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix) {
+	GLint origViewport[4];
+	glGetIntegerv(GL_VIEWPORT, origViewport);
 				
 	glUseProgram(programId);
 
@@ -80,7 +99,7 @@ void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, c
 	glPolygonOffset(1.1f, 4.0f);
 
 	// シャドウマップ用のmodel/view/projection行列を設定
-	glUniformMatrix4fv(glGetUniformLocation(programId, "light_mvpMatrix"), 1, GL_FALSE, &light_mvpMatrix[0][0]);
+	glUniformMatrix4fv(light_mvpMatrixLocation, 1, GL_FALSE, &light_mvpMatrix[0][0]);
 
 	// 光の方向を設定
 	//glUniform3f(glGetUniformLocation(programId, "lightDir"), light_dir.x, light_dir.y, light_dir.z);
@@ -94,7 +113,8 @@ void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, c
 	glDepthFunc(GL_LEQUAL);
 
 	//RENDER
-	glWidget3D->drawScene();
+	glDepthMask(true);
+	renderManager->renderAll(false);
 	
 	// この時点で、textureDepthにデプス情報が格納されている
 	
@@ -104,5 +124,5 @@ void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, c
 	glDrawBuffer(GL_BACK);
 
 	// ビューポートを戻す
-	glViewport(0, 0, origWidth, origHeigh);
+	glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
 }
@@ -3,8 +3,9 @@
 #include <glew.h>
 #include <QGLWidget>
 #include <glm/glm.hpp>
+#include "ShaderProgram.h"
 
-class GLWidget3D;
+class RenderManager;
 
 class ShadowMapping {
 public:
@@ -12,6 +13,7 @@ public:
 	int height;
 
 	int programId;
+	int light_mvpMatrixLocation;
 
 	uint fboDepth;
 	uint textureDepth;
@@ -19,8 +21,9 @@ public:
 public:
 	ShadowMapping();
 
-	void init(int programId, int width, int height);
-	void update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix);
+	void init(const ShadowProgram& program, int width, int height);
+	void resize(int width, int height);
+	void update(RenderManager* renderManager, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix);
 };
 
 
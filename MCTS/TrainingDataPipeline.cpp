@@ -0,0 +1,237 @@
+#include "TrainingDataPipeline.h"
+#include "EvaluationContext.h"
+#include <QThread>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <iostream>
+
+// 生成できなかった（地面より下に伸びた）木を作り直す回数の上限
+const int MAX_GENERATION_TRIALS = 100;
+
+TrainingDataPipeline::Options::Options() {
+	numTrees = 1000;
+	numThreads = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+	width = 512;
+	height = 512;
+	renderBatchSize = 32;
+	samplesPerShard = 100000;
+	seed = 0;
+	fixedWidth = true;
+	gpuGeometry = true;
+	outDir = "training_data";
+}
+
+/**
+ * 専用のOpenGL contextで描画段を実行するスレッド。
+ */
+class TrainingDataPipeline::RenderThread : public QThread {
+private:
+	TrainingDataPipeline* pipeline;
+	EvaluationContext* context;
+
+public:
+	RenderThread(TrainingDataPipeline* pipeline, EvaluationContext* context) : pipeline(pipeline), context(context) {}
+
+protected:
+	void run() {
+		pipeline->render(context);
+	}
+};
+
+TrainingDataPipeline::TrainingDataPipeline(const Options& options) : options(options), nextTree(0), treesWritten(0), treesDropped(0), treeQueue(options.renderBatchSize * 4), imageQueue(options.renderBatchSize * 2), sampleQueue(options.numThreads * 4), writer(options.outDir, options.samplesPerShard) {
+}
+
+/**
+ * パイプラインを実行し、全ての木のサンプルを書き出し終えるまで待つ。
+ * 描画用のOffscreen surfaceを作成するので、GUIスレッドから呼び出すこと。
+ *
+ * @return		OpenGL contextが作成できなければfalse
+ */
+bool TrainingDataPipeline::run() {
+	EvaluationContext context;
+	if (!context.create()) return false;
+
+	// 切り出しスレッドは、描画スレッドと同じカメラで各ノードの位置を画像に投影する
+	context.resetCamera(options.width, options.height);
+	camera = context.camera;
+
+	RenderThread renderThread(this, &context);
+	context.moveToThread(&renderThread);
+
+	std::vector<std::thread> generators;
+	std::vector<std::thread> extractors;
+	for (int i = 0; i < options.numThreads; ++i) {
+		generators.push_back(std::thread(&TrainingDataPipeline::generate, this));
+		extractors.push_back(std::thread(&TrainingDataPipeline::extract, this));
+	}
+	renderThread.start();
+	std::thread writerThread(&TrainingDataPipeline::write, this);
+
+	// 前の段が全て終わったら、次の段への入力キューを閉じる
+	for (int i = 0; i < generators.size(); ++i) generators[i].join();
+	treeQueue.close();
+	renderThread.wait();
+	for (int i = 0; i < extractors.size(); ++i) extractors[i].join();
+	sampleQueue.close();
+	writerThread.join();
+
+	return true;
+}
+
+/**
+ * 生成段。ランダムな木を生成し、頂点を作って描画段に渡す。
+ * 木ごとに乱数生成器をseed + indexで初期化するので、どのスレッドで生成しても同じ木になる。
+ */
+void TrainingDataPipeline::generate() {
+	utils::BatchRandom random(0);
+	while (true) {
+		int index = nextTree++;
+		if (index >= options.numTrees) break;
+
+		random.seed(options.seed + index);
+
+		TreeItem item;
+		item.index = index;
+		item.tree = boost::shared_ptr<pmtree::PMTree2D>(new pmtree::PMTree2D());
+
+		// 地面より下に伸びた木は作り直す
+		bool generated = false;
+		for (int trial = 0; trial < MAX_GENERATION_TRIALS && !generated; ++trial) {
+			item.tree->generateRandom(random);
+			if (options.gpuGeometry) {
+				generated = !item.tree->generateSegments(options.fixedWidth, item.segments);
+			}
+			else {
+				item.vertices.clear();
+				generated = !item.tree->generateGeometry(options.fixedWidth, item.vertices);
+			}
+		}
+		if (!generated) {
+			// 書き出し段がこの番号を待ち続けないよう、捨てたことを知らせる
+			treesDropped++;
+			SampleItem skipped;
+			skipped.index = index;
+			skipped.skipped = true;
+			if (!sampleQueue.push(skipped)) break;
+			continue;
+		}
+
+		if (!treeQueue.push(item)) break;
+	}
+}
+
+/**
+ * 描画段。木をrenderBatchSize個ずつまとめてrenderLayered (gpuGeometryならrenderSegmentsLayered) で描画し、切り出し段に渡す。
+ * GPU上で四角形を生成するprogramが使えない場合は、ここでセグメントの代わりに頂点を作って描画する。
+ * 描画スレッドで実行する。
+ */
+void TrainingDataPipeline::render(EvaluationContext* context) {
+	context->initGL(options.width, options.height);
+	bool useSegments = options.gpuGeometry && context->renderManager.segmentProgram.id > 0;
+
+	std::vector<TreeItem> batch;
+	std::vector<std::vector<Vertex> > geometries;
+	std::vector<std::vector<BranchSegment> > trees;
+	std::vector<unsigned char> pixels;
+	TreeItem item;
+	while (treeQueue.pop(item)) {
+		batch.clear();
+		batch.push_back(item);
+		while (batch.size() < options.renderBatchSize && treeQueue.tryPop(item)) {
+			batch.push_back(item);
+		}
+
+		if (useSegments) {
+			trees.resize(batch.size());
+			for (int i = 0; i < batch.size(); ++i) {
+				trees[i].swap(batch[i].segments);
+			}
+			context->renderManager.renderSegmentsLayered(trees, context->camera.mvpMatrix, options.width, options.height, pixels);
+		}
+		else {
+			geometries.resize(batch.size());
+			for (int i = 0; i < batch.size(); ++i) {
+				if (options.gpuGeometry) {
+					batch[i].vertices.clear();
+					batch[i].tree->generateGeometry(options.fixedWidth, batch[i].vertices);
+				}
+				geometries[i].swap(batch[i].vertices);
+			}
+			context->renderManager.renderLayered(geometries, context->camera.mvpMatrix, options.width, options.height, pixels);
+		}
+
+		for (int i = 0; i < batch.size(); ++i) {
+			ImageItem image;
+			image.index = batch[i].index;
+			image.tree = batch[i].tree;
+			image.image = cv::Mat(options.height, options.width, CV_8U, pixels.data() + (size_t)i * options.width * options.height).clone();
+			imageQueue.push(image);
+		}
+	}
+	imageQueue.close();
+
+	// contextをGUIスレッドに戻して、run()の最後に破棄できるようにする
+	context->release();
+}
+
+/**
+ * 切り出し段。描画結果から各ノードのパッチを切り出し、書き出し段に渡す。
+ */
+void TrainingDataPipeline::extract() {
+	ImageItem item;
+	while (imageQueue.pop(item)) {
+		SampleItem samples;
+		samples.index = item.index;
+		samples.skipped = false;
+		item.tree->generateTrainingData(item.image, &camera, options.width, options.height, samples.patches, samples.parameters);
+		if (!sampleQueue.push(samples)) break;
+	}
+}
+
+/**
+ * 書き出し段。サンプルを木の番号順にシャードファイルに書き出す。書き出しは1スレッドだけで行う。
+ * 切り出し段は複数スレッドなので、順番が前後して届いたサンプルは、次に書き出す番号が届くまでpendingに置いておく。
+ * pendingに溜まるのは、パイプライン中の木の数（各キューの容量程度）までである。
+ */
+void TrainingDataPipeline::write() {
+	std::map<int, SampleItem> pending;
+	int nextIndex = 0;
+
+	SampleItem item;
+	while (sampleQueue.pop(item)) {
+		pending[item.index] = item;
+
+		while (!pending.empty() && pending.begin()->first == nextIndex) {
+			writeSamples(pending.begin()->second);
+			pending.erase(pending.begin());
+			nextIndex++;
+		}
+	}
+
+	// 途中で止まった場合は、届いた分だけを番号順に書き出す
+	for (std::map<int, SampleItem>::iterator it = pending.begin(); it != pending.end(); ++it) {
+		writeSamples(it->second);
+	}
+	writer.close();
+
+	if (treesDropped > 0) {
+		std::cout << treesDropped << " trees were dropped (could not be generated in " << MAX_GENERATION_TRIALS << " trials)" << std::endl;
+	}
+}
+
+/**
+ * 1本の木のサンプルを書き出す。捨てた木なら何もしない。
+ */
+void TrainingDataPipeline::writeSamples(const SampleItem& item) {
+	if (item.skipped) return;
+
+	for (int i = 0; i < item.patches.size(); ++i) {
+		writer.write(item.patches[i], item.parameters[i]);
+	}
+
+	int trees = ++treesWritten;
+	if (trees % 1000 == 0) {
+		std::cout << trees << " trees, " << writer.samples() << " samples" << std::endl;
+	}
+}
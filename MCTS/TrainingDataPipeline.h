@@ -0,0 +1,92 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "BoundedQueue.h"
+#include "PMTree2D.h"
+#include "Camera.h"
+#include "Vertex.h"
+#include "SampleFormat.h"
+
+class EvaluationContext;
+
+/**
+ * PMTree2Dのランダムな木から、学習データ（各ノードの局所パッチ画像と、その位置での枝のパラメータ）を
+ * 並列に生成してディスクに書き出すパイプライン。
+ *
+ *   生成スレッド (numThreads個)		ランダムな木を生成して、頂点（gpuGeometryならセグメントのパラメータ）を作る
+ *   描画スレッド (1個)				専用のOpenGL contextで、複数の木をrenderLayeredでまとめて描画する
+ *   切り出しスレッド (numThreads個)	描画結果から、各ノードのパッチを切り出す
+ *   書き出しスレッド (1個)			サンプルを木の番号順に並べ直して、シャードファイルに書き出す (形式はSampleFormat.hを参照)
+ *
+ * 各段の間は容量制限付きのキューでつなぐので、生成する木の数によらずメモリ使用量は一定である。
+ */
+class TrainingDataPipeline {
+public:
+	struct Options {
+		int numTrees;
+		int numThreads;			// 生成、切り出しのそれぞれのスレッド数
+		int width;				// 描画する画像のサイズ
+		int height;
+		int renderBatchSize;	// 1回のrenderLayeredで描画する木の数
+		int samplesPerShard;
+		unsigned int seed;		// 木iはseed + iで生成する
+		bool fixedWidth;		// trueなら、枝を一定の太さの線で描画する
+		bool gpuGeometry;		// trueなら、頂点を作らずにセグメントのパラメータだけを渡し、GPU上で四角形を生成する
+		std::string outDir;
+
+		Options();
+	};
+
+private:
+	class RenderThread;
+
+	struct TreeItem {
+		int index;
+		boost::shared_ptr<pmtree::PMTree2D> tree;
+		std::vector<Vertex> vertices;
+		std::vector<BranchSegment> segments;
+	};
+
+	struct ImageItem {
+		int index;
+		boost::shared_ptr<pmtree::PMTree2D> tree;
+		cv::Mat image;
+	};
+
+	struct SampleItem {
+		int index;
+		bool skipped;		// trueなら、生成できずに捨てた木 (書き出し段で番号を飛ばすためだけに使う)
+		std::vector<cv::Mat> patches;
+		std::vector<std::vector<float> > parameters;
+	};
+
+	Options options;
+	Camera camera;
+	std::atomic<int> nextTree;
+	std::atomic<int> treesWritten;
+	std::atomic<int> treesDropped;
+	BoundedQueue<TreeItem> treeQueue;
+	BoundedQueue<ImageItem> imageQueue;
+	BoundedQueue<SampleItem> sampleQueue;
+	pmtree::SampleWriter writer;
+
+public:
+	TrainingDataPipeline(const Options& options);
+
+	bool run();
+	long long samples() const { return writer.samples(); }
+	int shards() const { return writer.shards(); }
+	long long bytes() const { return writer.bytes(); }
+	int dropped() const { return treesDropped; }
+
+private:
+	void generate();
+	void render(EvaluationContext* context);
+	void extract();
+	void write();
+	void writeSamples(const SampleItem& item);
+};
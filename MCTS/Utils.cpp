@@ -0,0 +1,91 @@
+#include "Utils.h"
+#include <cstdlib>
+#include <algorithm>
+
+namespace utils {
+
+	/**
+	 * [0, 1]の一様乱数を返す。
+	 */
+	float genRand() {
+		return rand() / (float(RAND_MAX) + 1);
+	}
+
+	/**
+	 * [a, b]の一様乱数を返す。
+	 *
+	 * @param a		最小値
+	 * @param b		最大値
+	 * @return		乱数
+	 */
+	float uniform(float a, float b) {
+		return a + genRand() * (b - a);
+	}
+
+	BatchRandom::BatchRandom(uint32_t seed) {
+		this->seed(seed);
+	}
+
+	/**
+	 * 各レーンの状態を、seedからsplitmix32で初期化する（全て0の状態にはならない）。
+	 */
+	void BatchRandom::seed(uint32_t seed) {
+		uint32_t s = seed;
+		uint32_t* states[4] = { x, y, z, w };
+		for (int k = 0; k < 4; ++k) {
+			for (int l = 0; l < LANES; ++l) {
+				s += 0x9e3779b9;
+				uint32_t v = s;
+				v = (v ^ (v >> 16)) * 0x85ebca6b;
+				v = (v ^ (v >> 13)) * 0xc2b2ae35;
+				v ^= v >> 16;
+				states[k][l] = v != 0 ? v : 1;
+			}
+		}
+
+		next = BUFFER_SIZE;
+	}
+
+	/**
+	 * [a, b)の一様乱数をn個まとめて生成する。
+	 *
+	 * @param a				最小値
+	 * @param b				最大値
+	 * @param values [OUT]	乱数 (n個)
+	 * @param n				個数
+	 */
+	void BatchRandom::fill(float a, float b, float* values, int n) {
+		while (n > 0) {
+			if (next >= BUFFER_SIZE) refill();
+
+			int count = std::min(n, BUFFER_SIZE - next);
+			for (int i = 0; i < count; ++i) {
+				values[i] = a + buffer[next + i] * (b - a);
+			}
+			next += count;
+			values += count;
+			n -= count;
+		}
+	}
+
+	/**
+	 * 全てのレーンをBUFFER_SIZE / LANES回進めて、バッファを補充する。
+	 */
+	void BatchRandom::refill() {
+		for (int i = 0; i < BUFFER_SIZE; i += LANES) {
+			for (int l = 0; l < LANES; ++l) {
+				uint32_t t = x[l] ^ (x[l] << 11);
+				x[l] = y[l];
+				y[l] = z[l];
+				z[l] = w[l];
+				w[l] = w[l] ^ (w[l] >> 19) ^ t ^ (t >> 8);
+
+				// 上位24bitを[0, 1)のfloatにする
+				buffer[i + l] = (w[l] >> 8) * (1.0f / 16777216.0f);
+			}
+		}
+
+		next = 0;
+	}
+
+}
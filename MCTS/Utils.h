@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+namespace utils {
+
+	float genRand();
+	float uniform(float a, float b);
+
+	/**
+	 * LANES本のxorshift128を並べて同時に進め、一様乱数をまとめて生成する乱数生成器。
+	 * 各レーンの計算は互いに独立なので、refill()のループはコンパイラによってSIMD命令にベクトル化される。
+	 * rand()と違って状態をインスタンスごとに持つので、スレッドごとに作れば、どのスレッドでも同じseedから同じ乱数列になる。
+	 */
+	class BatchRandom {
+	public:
+		static const int LANES = 8;
+		static const int BUFFER_SIZE = LANES * 32;
+
+	private:
+		uint32_t x[LANES];
+		uint32_t y[LANES];
+		uint32_t z[LANES];
+		uint32_t w[LANES];
+		float buffer[BUFFER_SIZE];	// [0, 1)の一様乱数
+		int next;
+
+	public:
+		BatchRandom(uint32_t seed);
+
+		void seed(uint32_t seed);
+		void fill(float a, float b, float* values, int n);
+
+		/**
+		 * [a, b)の一様乱数を返す。
+		 */
+		float uniform(float a, float b) {
+			if (next >= BUFFER_SIZE) refill();
+			return a + buffer[next++] * (b - a);
+		}
+
+		/**
+		 * [0, n)の整数の一様乱数を返す。
+		 */
+		int uniformInt(int n) {
+			int value = (int)uniform(0.0f, (float)n);
+			return value < n ? value : n - 1;
+		}
+
+	private:
+		void refill();
+	};
+
+}
@@ -35,3 +35,19 @@ struct Vertex {
 		this->drawEdge = drawEdge;
 	}
 };
+
+/**
+ * GPU上で四角形を生成する、枝の1セグメント（RenderManager::renderSegmentsLayered）。
+ * 座標は持たず、親のセグメントに対する回転角度と、長さ、太さだけを持つ。
+ */
+struct BranchSegment {
+	float angle;	// 親のセグメントに対する回転角度 [rad]
+	float length;
+	float width0;	// 根元の太さ
+	float width1;	// 上端の太さ
+	int parent;		// 親のセグメント (-1 -- ルート)
+	int connect;	// 1なら、根元を親のセグメントの上端の左右の点につなげる（枝の延長）
+
+	BranchSegment() {}
+	BranchSegment(float angle, float length, float width0, float width1, int parent, int connect) : angle(angle), length(length), width0(width0), width1(width1), parent(parent), connect(connect) {}
+};
@@ -0,0 +1,11 @@
+#version 420
+
+in vec4 outColor;
+
+layout(location = 0)out vec4 outputF;
+
+void main(){
+	// グレースケールで出力 (GL_R8のレイヤーにはrだけが保存される)
+	float gray = dot(outColor.rgb, vec3(0.299, 0.587, 0.114));
+	outputF = vec4(gray, gray, gray, 1.0);
+}
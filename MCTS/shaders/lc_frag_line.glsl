@@ -14,7 +14,12 @@ uniform sampler2D depthTex;
 uniform sampler3D hatchingTexture;
 
 uniform vec2 pixelSize;//in texture space
-uniform mat4 pMatrix;
+layout(std140, binding = 0) uniform FrameUniforms {
+	mat4 mvpMatrix;
+	mat4 pMatrix;
+	mat4 light_mvpMatrix;
+	vec4 lightDir;		// xyz only
+};
 
 uniform int useHatching;	// 1 -- use hatching / 0 -- use white color
 
@@ -17,11 +17,16 @@ uniform sampler2DArray tex_3D;
 uniform int useShadow;
 uniform int softShadow;
 uniform int lighting;
-uniform mat4 light_mvpMatrix;
-uniform vec3 lightDir;
 uniform sampler2D shadowMap;
 uniform int textureEnabled;
 
+layout(std140, binding = 0) uniform FrameUniforms {
+	mat4 mvpMatrix;
+	mat4 pMatrix;
+	mat4 light_mvpMatrix;
+	vec4 lightDir;		// xyz only
+};
+
 vec2 poissonDisk4[4] = vec2[](
 	vec2(-0.94201624, -0.39906216),
 	vec2(0.94558609, -0.76890725),
@@ -102,7 +107,7 @@ void main(){
 
 	// lighting
 	if (lighting == 1) {
-		intensity = ambient + (visibility * 0.95 + 0.05) * diffuse * max(0.0, dot(-lightDir, varyingNormal));
+		intensity = ambient + (visibility * 0.95 + 0.05) * diffuse * max(0.0, dot(-lightDir.xyz, varyingNormal));
 	}
 	else {
 		intensity = ambient + (visibility * 0.95 + 0.05) * diffuse;
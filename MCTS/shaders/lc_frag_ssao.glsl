@@ -17,8 +17,12 @@ uniform vec2 pixelSize;//in texture space
 
 //uniform mat4 uProjectionMatrix; // current projection matrix, for linearized depth
 //uniform mat4 uInvProjectionMatrix;
-uniform mat4 pMatrix;
-uniform mat4 mvpMatrix;
+layout(std140, binding = 0) uniform FrameUniforms {
+	mat4 mvpMatrix;
+	mat4 pMatrix;
+	mat4 light_mvpMatrix;
+	vec4 lightDir;		// xyz only
+};
 
 float LinearizeDepth(float z){
 		const float zNear = 5.0; // camera z near
@@ -31,7 +35,9 @@ float LinearizeDepth(float z){
 //	ssao uniforms:
 const int MAX_KERNEL_SIZE = 128;
 uniform int uKernelSize=16;//16
-uniform vec3 uKernelOffsets[MAX_KERNEL_SIZE];
+layout(std140, binding = 1) uniform SsaoKernel {
+	vec4 uKernelOffsets[MAX_KERNEL_SIZE];	// xyz only
+};
 uniform float uRadius = 20.0;//1.5
 uniform float uPower = 1.0;//2.0
 
@@ -50,7 +56,7 @@ float ssao(in mat3 kernelBasis, in vec3 originPos, in float radius) {
 
 	for (int i = 0; i < uKernelSize; ++i) {
 		//	get sample position:
-		vec3 samplePos = kernelBasis * uKernelOffsets[i];
+		vec3 samplePos = kernelBasis * uKernelOffsets[i].xyz;
 		samplePos = samplePos * radius + originPos;
 		
 		//samplePos = originPos + uKernelOffsets[i];
@@ -0,0 +1,20 @@
+#version 420
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec4 geomColor[];
+flat in int geomLayer[];
+
+out vec4 outColor;
+
+void main(){
+	// 各候補は、texture arrayの自分のレイヤーに描画する
+	for (int i = 0; i < 3; ++i) {
+		gl_Layer = geomLayer[0];
+		outColor = geomColor[i];
+		gl_Position = gl_in[i].gl_Position;
+		EmitVertex();
+	}
+	EndPrimitive();
+}
@@ -0,0 +1,42 @@
+#version 420
+
+layout(points) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+in vec4 geomFrame[];
+in vec4 geomSegment[];
+flat in ivec4 geomLink[];
+
+out vec4 outColor;
+
+uniform mat4 mvpMatrix;
+
+// セグメントの座標系の点を、clip座標に変換する
+vec4 toClip(vec2 p) {
+	vec4 frame = geomFrame[0];
+	vec2 world = vec2(frame.x * p.x - frame.y * p.y, frame.y * p.x + frame.x * p.y) + frame.zw;
+	return mvpMatrix * vec4(world, 0.0, 1.0);
+}
+
+void main(){
+	vec4 segment = geomSegment[0];
+
+	// 根元の左右の点。枝の延長は、親のセグメントの上端（回転前の座標系）につなげる
+	vec2 left = vec2(-segment.z * 0.5, 0.0);
+	vec2 right = vec2(segment.z * 0.5, 0.0);
+	if (geomLink[0].y != 0) {
+		float c = cos(segment.x);
+		float s = sin(segment.x);
+		left = vec2(c * left.x, -s * left.x);
+		right = vec2(c * right.x, -s * right.x);
+	}
+
+	vec2 points[4] = vec2[4](left, right, vec2(-segment.w * 0.5, segment.y), vec2(segment.w * 0.5, segment.y));
+	for (int i = 0; i < 4; ++i) {
+		gl_Layer = geomLink[0].z;
+		outColor = vec4(0.0, 0.0, 0.0, 1.0);
+		gl_Position = toClip(points[i]);
+		EmitVertex();
+	}
+	EndPrimitive();
+}
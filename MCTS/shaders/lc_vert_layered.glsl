@@ -0,0 +1,17 @@
+#version 420
+
+layout(location = 0)in vec3 vertex;
+layout(location = 2)in vec4 color;
+layout(location = 5)in int layer;
+
+out vec4 geomColor;
+flat out int geomLayer;
+
+uniform mat4 mvpMatrix;
+
+void main(){
+	geomColor = color;
+	geomLayer = layer;
+
+	gl_Position = mvpMatrix * vec4(vertex, 1.0);
+}
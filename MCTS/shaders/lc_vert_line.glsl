@@ -7,8 +7,6 @@ layout(location = 3)in vec2 uv;
 
 out vec2 outUV;
 
-uniform mat4 pMatrix;
-
 void main(){
 	outUV=uv;
 	
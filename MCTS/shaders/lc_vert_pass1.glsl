@@ -10,7 +10,12 @@ out vec2 outUV;
 out vec3 origVertex;
 out vec3 varyingNormal;
 
-uniform mat4 mvpMatrix;
+layout(std140, binding = 0) uniform FrameUniforms {
+	mat4 mvpMatrix;
+	mat4 pMatrix;
+	mat4 light_mvpMatrix;
+	vec4 lightDir;		// xyz only
+};
 
 void main(){
 	outColor=color;
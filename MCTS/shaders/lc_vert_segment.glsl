@@ -0,0 +1,35 @@
+#version 420
+
+// 各枝のセグメント (curveV [rad], length, width0, width1)
+uniform samplerBuffer segments;
+// 各枝のセグメントの親 (parent, connect, layer, 0)。parent < 0はルート
+uniform isamplerBuffer links;
+
+out vec4 geomFrame;
+out vec4 geomSegment;
+flat out ivec4 geomLink;
+
+void main(){
+	vec4 segment = texelFetch(segments, gl_VertexID);
+	ivec4 link = texelFetch(links, gl_VertexID);
+
+	// 親をルートまでたどり、座標系 (回転角度と原点) を合成する
+	// 各セグメントの座標系は、親の座標系を親のセグメントの長さだけ上に移動し、curveVだけ回転したもの
+	float angle = segment.x;
+	vec2 origin = vec2(0.0, 0.0);
+	for (int parent = link.x; parent >= 0; parent = texelFetch(links, parent).x) {
+		vec4 parentSegment = texelFetch(segments, parent);
+		origin.y += parentSegment.y;
+
+		float c = cos(parentSegment.x);
+		float s = sin(parentSegment.x);
+		origin = vec2(c * origin.x - s * origin.y, s * origin.x + c * origin.y);
+		angle += parentSegment.x;
+	}
+
+	geomFrame = vec4(cos(angle), sin(angle), origin);
+	geomSegment = segment;
+	geomLink = link;
+
+	gl_Position = vec4(origin, 0.0, 1.0);
+}
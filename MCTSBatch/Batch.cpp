@@ -0,0 +1,433 @@
+/**
+ * 多数のスケッチに対して、MCTSによるinverse proceduralを並列に実行するバッチ処理。
+ *
+ * 使い方:
+ *   MCTSBatch [--threads N] [--steps N] [--iterations N] [--refine N] [--grammar file] [--seed N] [--out directory] <directory|manifest.txt>
+ *
+ * 入力は、スケッチ画像のディレクトリ、または画像のパスを1行に1つ書いたマニフェストファイル。
+ * 出力ディレクトリには、スケッチごとに
+ *   <name>.txt	derivation tree (DerivationTree::to_string()の形式)
+ *   <name>.bin	derivation tree (serialization::saveのバイナリ形式)
+ *   <name>.png	derivation treeを評価時と同じ条件で描画した画像
+ * を書き出し、summary.csvに1行ずつ結果を追記する。
+ * <name>は、入力のディレクトリ（マニフェストならそのディレクトリ）からのスケッチの相対パスから拡張子を除いたもので、
+ * サブディレクトリは出力ディレクトリの下にも作る。名前が重複する場合（1.pngと1.jpgなど）はエラーにする。
+ * 処理を終えたスケッチはcheckpoint.txtに記録するので、中断しても同じコマンドで続きから再開できる。
+ *
+ * --grammarを指定すると、組み込みのgrammarの代わりに、そのファイルのgrammar（書式はGrammar.hを参照）で探索する。
+ *
+ * 各スレッドは専用のOpenGL context (EvaluationContext) を持ち、未処理のスケッチを順に取って処理する。
+ */
+
+#include "EvaluationContext.h"
+#include "MCTS.h"
+#include "ResultSink.h"
+#include "Serialization.h"
+#include <QGuiApplication>
+#include <QThread>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QSet>
+#include <QMap>
+#include <QElapsedTimer>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+
+namespace {
+
+	/**
+	 * 全スレッドで共有する、処理対象のリストと出力先。
+	 */
+	class BatchJob {
+	public:
+		QStringList sketches;
+		QStringList names;				// 各スケッチの出力ファイル名 (outDirからの相対パス、拡張子なし)
+		std::vector<int> sketchIds;		// checkpointで除く前のリストでの各スケッチの番号 (乱数のseedに使う)
+		QString outDir;
+		unsigned int seed;
+		int maxDerivationSteps;
+		int maxMCTSIterations;
+		int maxRefineIterations;
+		std::atomic<int> next;
+		std::atomic<int> succeeded;
+		std::atomic<int> failed;
+
+	private:
+		std::mutex mutex;
+		std::ofstream summary;
+		std::ofstream checkpoint;
+
+	public:
+		BatchJob() : next(0), succeeded(0), failed(0) {}
+
+		bool open();
+		bool take(int& index);
+		void report(const QString& sketch, double wallTime, long long iterations, long long evaluations, float similarity, bool ok);
+	};
+
+	bool BatchJob::open() {
+		QString summaryFile = outDir + "/summary.csv";
+		bool exists = QFileInfo(summaryFile).exists();
+		summary.open(summaryFile.toUtf8().constData(), std::ios::app);
+		if (!summary.is_open()) return false;
+		if (!exists) {
+			summary << "sketch,status,wall_time,iterations,evaluations,similarity" << std::endl;
+		}
+		summary << std::setprecision(6);
+
+		checkpoint.open((outDir + "/checkpoint.txt").toUtf8().constData(), std::ios::app);
+		return checkpoint.is_open();
+	}
+
+	/**
+	 * 次に処理するスケッチのindexを取得する。全て取得済みならfalseを返す。
+	 */
+	bool BatchJob::take(int& index) {
+		index = next++;
+		return index < sketches.size();
+	}
+
+	/**
+	 * 1枚の処理結果をsummary.csvに追記し、checkpoint.txtに記録する。
+	 * 失敗したスケッチもcheckpointに記録するので、再開時には再実行しない。
+	 */
+	void BatchJob::report(const QString& sketch, double wallTime, long long iterations, long long evaluations, float similarity, bool ok) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		summary << sketch.toUtf8().constData() << "," << (ok ? "ok" : "failed") << "," << wallTime << "," << iterations << "," << evaluations << "," << similarity << std::endl;
+		checkpoint << sketch.toUtf8().constData() << std::endl;
+
+		if (ok) succeeded++;
+		else failed++;
+
+		int done = succeeded + failed;
+		std::cout << "[" << done << "/" << sketches.size() << "] " << QFileInfo(sketch).fileName().toUtf8().constData() << (ok ? "" : " (failed)") << std::endl;
+	}
+
+	/**
+	 * 専用のOpenGL contextで、未処理のスケッチを順に取って処理するスレッド。
+	 */
+	class BatchWorker : public QThread {
+	private:
+		BatchJob* job;
+		EvaluationContext context;
+
+	public:
+		BatchWorker(BatchJob* job) : job(job) {}
+
+		/**
+		 * contextを作成してこのスレッドに移す。GUIスレッドから呼び出すこと。
+		 */
+		bool prepare() {
+			if (!context.create()) return false;
+			context.moveToThread(this);
+			return true;
+		}
+
+		/**
+		 * run()の最後にcontextはGUIスレッドに戻されるので、GUIスレッドで破棄できる。
+		 */
+		~BatchWorker() {
+			wait();
+		}
+
+	protected:
+		void run() {
+			// カメラの射影行列はスケッチのサイズに合わせて、スケッチごとに設定し直す
+			context.initGL(1, 1);
+
+			int index;
+			while (job->take(index)) {
+				QString sketch = job->sketches[index];
+				QString name = job->names[index];
+				cv::Mat image = cv::imread(sketch.toUtf8().constData());
+				if (image.empty()) {
+					job->report(sketch, 0, 0, 0, 0, false);
+					continue;
+				}
+
+				context.camera.updatePMatrix(image.cols, image.rows);
+
+				mcts::MCTS mcts(image, &context.renderManager, context.camera.mvpMatrix);
+
+				// 同じスケッチは、スレッド数や処理順、再開したかどうかによらず同じ結果になるようにする
+				mcts.setSeed(job->seed + job->sketchIds[index]);
+				mcts.setResultSink(boost::shared_ptr<ResultSink>(new NullResultSink()));
+				mcts.setProfileOutput(false);
+				mcts.setRefineIterations(job->maxRefineIterations);
+				mcts::State state = mcts.inverse(job->maxDerivationSteps, job->maxMCTSIterations);
+				float similarity = mcts.evaluate(state.derivationTree);
+
+				// 結果を保存
+				QString base = job->outDir + "/" + name;
+				bool ok = QDir().mkpath(QFileInfo(base).absolutePath());
+				{
+					QFile file(base + ".txt");
+					if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+						QTextStream out(&file);
+						out << QString::fromStdString(state.derivationTree.to_string()) << "\n";
+					}
+					else {
+						ok = false;
+					}
+				}
+
+				if (!mcts::serialization::save((base + ".bin").toUtf8().constData(), state.derivationTree)) ok = false;
+
+				cv::Mat result;
+				mcts.render(state.derivationTree, result);
+				if (!cv::imwrite((base + ".png").toUtf8().constData(), result)) ok = false;
+
+				const Profiler& profiler = mcts.getProfiler();
+				job->report(sketch, profiler.elapsed(), profiler.count("iterations"), profiler.count("evaluations"), similarity, ok);
+			}
+
+			context.release();
+		}
+	};
+
+	/**
+	 * 入力（ディレクトリまたはマニフェストファイル）から、スケッチのパスのリストを作成する。
+	 */
+	QStringList listSketches(const QString& input) {
+		QStringList sketches;
+
+		QFileInfo info(input);
+		if (info.isDir()) {
+			QDir dir(info.absoluteFilePath());
+			QStringList files = dir.entryList(QStringList() << "*.png" << "*.jpg", QDir::Files, QDir::Name);
+			for (int i = 0; i < files.size(); ++i) {
+				sketches << dir.absoluteFilePath(files[i]);
+			}
+		}
+		else {
+			// マニフェストの相対パスは、マニフェストのディレクトリからの相対パスとする
+			QFile file(info.absoluteFilePath());
+			if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return sketches;
+
+			QTextStream in(&file);
+			while (!in.atEnd()) {
+				QString line = in.readLine().trimmed();
+				if (line.isEmpty() || line.startsWith("#")) continue;
+				sketches << QFileInfo(info.absoluteDir(), line).absoluteFilePath();
+			}
+		}
+
+		return sketches;
+	}
+
+	/**
+	 * 入力のルートディレクトリ（ディレクトリならそのもの、マニフェストならそのディレクトリ）を返す。
+	 */
+	QString inputRoot(const QString& input) {
+		QFileInfo info(input);
+		return info.isDir() ? info.absoluteFilePath() : info.absolutePath();
+	}
+
+	/**
+	 * 各スケッチの出力ファイル名を、rootからの相対パスから拡張子を除いたものにする（a/1.png → a/1）。
+	 * rootの外にあるスケッチや、出力ファイル名が重複するスケッチがあれば、エラーを表示してfalseを返す。
+	 *
+	 * @param root			入力のルートディレクトリ
+	 * @param sketches		スケッチの絶対パス
+	 * @param names [OUT]	各スケッチの出力ファイル名
+	 * @return				全てのスケッチに、重複しない名前を付けられればtrue
+	 */
+	bool outputNames(const QString& root, const QStringList& sketches, QStringList& names) {
+		names.clear();
+
+		QDir dir(root);
+		QMap<QString, QString> used;	// 出力ファイル名 (小文字) -> スケッチ
+		for (int i = 0; i < sketches.size(); ++i) {
+			QString relative = dir.relativeFilePath(sketches[i]);
+			if (QDir::isAbsolutePath(relative) || relative == ".." || relative.startsWith("../")) {
+				std::cout << "Error: " << sketches[i].toUtf8().constData() << " is outside of " << root.toUtf8().constData() << std::endl;
+				return false;
+			}
+
+			QFileInfo info(relative);
+			QString name = info.path() == "." ? info.completeBaseName() : info.path() + "/" + info.completeBaseName();
+
+			// Windowsではファイル名の大文字と小文字を区別しないので、小文字で比較する
+			QString key = name.toLower();
+			if (used.contains(key)) {
+				std::cout << "Error: " << used[key].toUtf8().constData() << " and " << sketches[i].toUtf8().constData() << " would be written to the same output files." << std::endl;
+				return false;
+			}
+			used[key] = sketches[i];
+			names << name;
+		}
+
+		return true;
+	}
+
+	/**
+	 * checkpoint.txtから、処理済みのスケッチの集合を読み込む。
+	 */
+	QSet<QString> loadCheckpoint(const QString& filename) {
+		QSet<QString> done;
+
+		QFile file(filename);
+		if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return done;
+
+		QTextStream in(&file);
+		while (!in.atEnd()) {
+			QString line = in.readLine().trimmed();
+			if (!line.isEmpty()) done.insert(line);
+		}
+
+		return done;
+	}
+
+	/**
+	 * shaders/ディレクトリがある場所をカレントディレクトリにする。
+	 * RenderManagerは相対パスでシェーダを読み込むため。
+	 */
+	bool setupWorkingDirectory(const QString& appDir) {
+		QStringList candidates;
+		candidates << QDir::currentPath() << QDir::currentPath() + "/../MCTS" << appDir + "/../../MCTS" << appDir + "/../MCTS";
+		for (int i = 0; i < candidates.size(); ++i) {
+			if (QDir(candidates[i] + "/shaders").exists()) {
+				QDir::setCurrent(candidates[i]);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void usage() {
+		std::cout << "Usage: MCTSBatch [--threads N] [--steps N] [--iterations N] [--refine N] [--grammar file] [--seed N] [--out directory] <directory|manifest.txt>" << std::endl;
+	}
+
+}
+
+int main(int argc, char* argv[]) {
+	QGuiApplication app(argc, argv);
+
+	BatchJob job;
+	job.seed = 0;
+	job.maxDerivationSteps = 10;
+	job.maxMCTSIterations = 100;
+	job.maxRefineIterations = 0;
+	int numThreads = QThread::idealThreadCount();
+	QString outDir = "batch_results";
+	QString grammarFile;
+	QString input;
+
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.size(); ++i) {
+		if (args[i] == "--threads" && i + 1 < args.size()) {
+			numThreads = args[++i].toInt();
+		}
+		else if (args[i] == "--steps" && i + 1 < args.size()) {
+			job.maxDerivationSteps = args[++i].toInt();
+		}
+		else if (args[i] == "--iterations" && i + 1 < args.size()) {
+			job.maxMCTSIterations = args[++i].toInt();
+		}
+		else if (args[i] == "--refine" && i + 1 < args.size()) {
+			job.maxRefineIterations = args[++i].toInt();
+		}
+		else if (args[i] == "--grammar" && i + 1 < args.size()) {
+			grammarFile = args[++i];
+		}
+		else if (args[i] == "--seed" && i + 1 < args.size()) {
+			job.seed = args[++i].toUInt();
+		}
+		else if (args[i] == "--out" && i + 1 < args.size()) {
+			outDir = args[++i];
+		}
+		else if (args[i] == "--help" || args[i] == "-h") {
+			usage();
+			return 0;
+		}
+		else if (args[i].startsWith("--") || !input.isEmpty()) {
+			usage();
+			return 1;
+		}
+		else {
+			input = args[i];
+		}
+	}
+	if (input.isEmpty()) {
+		usage();
+		return 1;
+	}
+	if (numThreads < 1) numThreads = 1;
+
+	// grammarは全スレッドで共有するので、スレッドを開始する前に読み込む
+	if (!grammarFile.isEmpty()) {
+		boost::shared_ptr<mcts::Grammar> grammar = boost::shared_ptr<mcts::Grammar>(new mcts::Grammar());
+		std::string error;
+		if (!grammar->load(grammarFile.toUtf8().constData(), &error)) {
+			std::cout << "Error: " << error << std::endl;
+			return 1;
+		}
+		mcts::Grammar::setCurrent(grammar);
+	}
+
+	// 作業ディレクトリを変更する前に、パスを絶対パスにしておく
+	QStringList sketches = listSketches(input);
+	QStringList names;
+	if (!outputNames(inputRoot(input), sketches, names)) return 1;
+	job.outDir = QFileInfo(outDir).absoluteFilePath();
+	QDir().mkpath(job.outDir);
+
+	// checkpointに記録されたスケッチは処理済みなので除く
+	QSet<QString> done = loadCheckpoint(job.outDir + "/checkpoint.txt");
+	for (int i = 0; i < sketches.size(); ++i) {
+		if (done.contains(sketches[i])) continue;
+		job.sketches << sketches[i];
+		job.names << names[i];
+		job.sketchIds.push_back(i);
+	}
+	std::cout << sketches.size() << " sketches, " << sketches.size() - job.sketches.size() << " already done, " << numThreads << " threads" << std::endl;
+	if (job.sketches.empty()) return 0;
+
+	if (!setupWorkingDirectory(app.applicationDirPath())) {
+		std::cout << "Error: shaders directory was not found." << std::endl;
+		return 1;
+	}
+	if (!job.open()) {
+		std::cout << "Error: failed to open the output files in " << job.outDir.toUtf8().constData() << std::endl;
+		return 1;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	std::vector<BatchWorker*> workers;
+	for (int i = 0; i < numThreads && i < job.sketches.size(); ++i) {
+		BatchWorker* worker = new BatchWorker(&job);
+		if (!worker->prepare()) {
+			std::cout << "Error: failed to create an OpenGL context." << std::endl;
+			delete worker;
+			break;
+		}
+		workers.push_back(worker);
+	}
+	if (workers.empty()) {
+		std::cout << "Error: no worker could be started, so no sketch was processed." << std::endl;
+		return 1;
+	}
+	for (int i = 0; i < workers.size(); ++i) {
+		workers[i]->start();
+	}
+	for (int i = 0; i < workers.size(); ++i) {
+		workers[i]->wait();
+		delete workers[i];
+	}
+
+	double elapsed = timer.nsecsElapsed() * 1e-9;
+	std::cout << job.succeeded << " succeeded, " << job.failed << " failed, " << elapsed << " sec (" << (elapsed > 0.0 ? (job.succeeded + job.failed) / elapsed : 0.0) << " sketches/sec)" << std::endl;
+
+	return job.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/**
+ * GUIなしでMCTSによるinverse proceduralを実行し、処理時間を計測するベンチマーク。
+ *
+ * 使い方:
+ *   MCTSBenchmark [--seed N] [--steps N] [--iterations N] [--refine N] [--grammar file] [--out result.csv] [--results] [sketch.png|directory ...]
+ *
+ * スケッチを指定しなければ、MCTS/sketch_1.png 〜 sketch_4.png を使う。
+ * 各スケッチについて、実行時間、iterations/sec、evaluations/sec、その時点までのプロセスのピークメモリ、最終的な類似度を出力する。
+ * ピークメモリはプロセス起動からの最大値なので、スケッチごとの値ではない（前のスケッチより小さくはならない）。
+ * --outを指定すると、結果をCSVファイルに追記する（ファイルがなければヘッダを付けて作成）。
+ * 既存のファイルのヘッダが現在の列と異なる（古いビルドで作った）場合は、列がずれないよう追記せずにエラーにする。
+ * デバッグ出力（results/の画像など）は、--resultsを指定した場合のみ書き出す。
+ * --grammarを指定すると、組み込みのgrammarの代わりに、そのファイルのgrammar（書式はGrammar.hを参照）で探索する。
+ * --refineを指定すると、MCTSの後に角度と長さを最大N反復だけ連続値で調整する（評価回数も出力するので、MCTSのiterationsを増やす場合と比較できる）。
+ */
+
+#include "EvaluationContext.h"
+#include "MCTS.h"
+#include <QGuiApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDateTime>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+	/**
+	 * プロセス起動から現在までの、ピークメモリ使用量 [MB] を返す。
+	 */
+	double peakMemoryMB() {
+	#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+			return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+		}
+		return 0.0;
+	#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+	#ifdef __APPLE__
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+	#else
+		return usage.ru_maxrss / 1024.0;
+	#endif
+	#endif
+	}
+
+	/**
+	 * shaders/ディレクトリがある場所をカレントディレクトリにする。
+	 * RenderManagerは相対パスでシェーダを読み込むため。
+	 */
+	bool setupWorkingDirectory(const QString& appDir) {
+		QStringList candidates;
+		candidates << QDir::currentPath() << QDir::currentPath() + "/../MCTS" << appDir + "/../../MCTS" << appDir + "/../MCTS";
+		for (int i = 0; i < candidates.size(); ++i) {
+			if (QDir(candidates[i] + "/shaders").exists()) {
+				QDir::setCurrent(candidates[i]);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void usage() {
+		std::cout << "Usage: MCTSBenchmark [--seed N] [--steps N] [--iterations N] [--refine N] [--grammar file] [--out result.csv] [--results] [sketch.png|directory ...]" << std::endl;
+	}
+
+}
+
+int main(int argc, char* argv[]) {
+	QGuiApplication app(argc, argv);
+
+	unsigned int seed = 0;
+	int maxDerivationSteps = 10;
+	int maxMCTSIterations = 100;
+	int maxRefineIterations = 0;
+	QString outFile;
+	QString grammarFile;
+	bool writeResults = false;
+	QStringList inputs;
+
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.size(); ++i) {
+		if (args[i] == "--seed" && i + 1 < args.size()) {
+			seed = args[++i].toUInt();
+		}
+		else if (args[i] == "--steps" && i + 1 < args.size()) {
+			maxDerivationSteps = args[++i].toInt();
+		}
+		else if (args[i] == "--iterations" && i + 1 < args.size()) {
+			maxMCTSIterations = args[++i].toInt();
+		}
+		else if (args[i] == "--refine" && i + 1 < args.size()) {
+			maxRefineIterations = args[++i].toInt();
+		}
+		else if (args[i] == "--grammar" && i + 1 < args.size()) {
+			grammarFile = QFileInfo(args[++i]).absoluteFilePath();
+		}
+		else if (args[i] == "--out" && i + 1 < args.size()) {
+			outFile = QFileInfo(args[++i]).absoluteFilePath();
+		}
+		else if (args[i] == "--results") {
+			writeResults = true;
+		}
+		else if (args[i] == "--help" || args[i] == "-h") {
+			usage();
+			return 0;
+		}
+		else if (args[i].startsWith("--")) {
+			std::cout << "Unknown option: " << args[i].toUtf8().constData() << std::endl;
+			usage();
+			return 1;
+		}
+		else {
+			inputs << args[i];
+		}
+	}
+
+	if (!grammarFile.isEmpty()) {
+		boost::shared_ptr<mcts::Grammar> grammar = boost::shared_ptr<mcts::Grammar>(new mcts::Grammar());
+		std::string error;
+		if (!grammar->load(grammarFile.toUtf8().constData(), &error)) {
+			std::cout << "Error: " << error << std::endl;
+			return 1;
+		}
+		mcts::Grammar::setCurrent(grammar);
+	}
+
+	// 入力ファイルを列挙する（作業ディレクトリを変更する前に絶対パスにしておく）
+	QStringList sketches;
+	for (int i = 0; i < inputs.size(); ++i) {
+		QFileInfo info(inputs[i]);
+		if (info.isDir()) {
+			QStringList files = QDir(info.absoluteFilePath()).entryList(QStringList() << "*.png" << "*.jpg", QDir::Files, QDir::Name);
+			for (int k = 0; k < files.size(); ++k) {
+				sketches << QDir(info.absoluteFilePath()).absoluteFilePath(files[k]);
+			}
+		}
+		else {
+			sketches << info.absoluteFilePath();
+		}
+	}
+
+	if (!setupWorkingDirectory(app.applicationDirPath())) {
+		std::cout << "Error: shaders directory was not found." << std::endl;
+		return 1;
+	}
+
+	if (inputs.empty()) {
+		for (int i = 1; i <= 4; ++i) {
+			sketches << QDir::current().absoluteFilePath(QString("sketch_%1.png").arg(i));
+		}
+	}
+
+	// 最初のスケッチのサイズでcontextを作成する
+	cv::Mat firstImage = cv::imread(sketches.empty() ? "" : sketches[0].toUtf8().constData());
+	if (firstImage.empty()) {
+		std::cout << "Error: no sketch could be loaded." << std::endl;
+		return 1;
+	}
+
+	EvaluationContext context;
+	if (!context.init(firstImage.cols, firstImage.rows)) return 1;
+
+	std::ofstream csv;
+	if (!outFile.isEmpty()) {
+		const std::string csvHeader = "date,sketch,seed,steps,iterations,wall_time,iterations_per_sec,evaluations_per_sec,process_peak_memory_mb,similarity,refine,evaluations";
+
+		bool exists = QFileInfo(outFile).exists();
+		if (exists) {
+			std::ifstream in(outFile.toUtf8().constData());
+			std::string line;
+			std::getline(in, line);
+			if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+			if (line != csvHeader) {
+				std::cout << "Error: the columns of " << outFile.toUtf8().constData() << " differ from this version (" << csvHeader << "). Use another --out file." << std::endl;
+				return 1;
+			}
+		}
+
+		csv.open(outFile.toUtf8().constData(), std::ios::app);
+		if (!exists) {
+			csv << csvHeader << std::endl;
+		}
+	}
+
+	QString date = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+	std::cout << std::setprecision(6);
+	for (int i = 0; i < sketches.size(); ++i) {
+		cv::Mat image = cv::imread(sketches[i].toUtf8().constData());
+		if (image.empty()) {
+			std::cout << "Skip " << sketches[i].toUtf8().constData() << " (could not be loaded)" << std::endl;
+			continue;
+		}
+		context.camera.updatePMatrix(image.cols, image.rows);
+
+		mcts::MCTS mcts(image, &context.renderManager, context.camera.mvpMatrix);
+		mcts.setSeed(seed);
+		if (!writeResults) {
+			mcts.setResultSink(boost::shared_ptr<ResultSink>(new NullResultSink()));
+		}
+		mcts.setRefineIterations(maxRefineIterations);
+		mcts::State state = mcts.inverse(maxDerivationSteps, maxMCTSIterations);
+		float similarity = mcts.evaluate(state.derivationTree);
+
+		const Profiler& profiler = mcts.getProfiler();
+		double wallTime = profiler.elapsed();
+		double iterationsPerSec = wallTime > 0.0 ? profiler.count("iterations") / wallTime : 0.0;
+		double evaluationsPerSec = wallTime > 0.0 ? profiler.count("evaluations") / wallTime : 0.0;
+		double peakMemory = peakMemoryMB();
+		long long evaluations = profiler.count("evaluations");
+
+		QString name = QFileInfo(sketches[i]).fileName();
+		std::cout << name.toUtf8().constData() << ": " << wallTime << " sec, " << iterationsPerSec << " iterations/sec, " << evaluationsPerSec << " evaluations/sec, process peak so far " << peakMemory << " MB, similarity " << similarity << " (" << evaluations << " evaluations)" << std::endl;
+
+		if (csv.is_open()) {
+			csv << date.toUtf8().constData() << "," << name.toUtf8().constData() << "," << seed << "," << maxDerivationSteps << "," << maxMCTSIterations << "," << wallTime << "," << iterationsPerSec << "," << evaluationsPerSec << "," << peakMemory << "," << similarity << "," << maxRefineIterations << "," << evaluations << std::endl;
+		}
+	}
+
+	return 0;
+}
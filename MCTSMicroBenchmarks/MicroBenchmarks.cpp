@@ -0,0 +1,381 @@
+﻿/**
+ * MCTS.cpp、GLUtils.cpp、PMTree2D.cppのホットな関数のマイクロベンチマーク (Google Benchmark)。
+ * 探索全体ではなく関数単位で計測するので、高速化や性能劣化がどの関数によるものか特定できる。
+ *
+ * 使い方:
+ *   MCTSMicroBenchmarks [--benchmark_filter=<regex>] [--benchmark_format=json] ...
+ *
+ * 木構造を扱うベンチマークは、引数でderivationのステップ数（木の大きさ）を変えて計測する。
+ * 乱数のシードは固定しているので、同じ引数なら同じ木で計測される。
+ */
+
+#include <benchmark/benchmark.h>
+#include "MCTS.h"
+#include "GLUtils.h"
+#include "PMTree2D.h"
+#include <cstdlib>
+
+namespace {
+
+	/**
+	 * 指定したステップ数だけランダムにruleを適用したstateを作成する。
+	 * 途中でqueueが空になったら、そこで終了する。
+	 *
+	 * @param steps		ruleを適用する回数
+	 * @return			作成したstate
+	 */
+	mcts::State createState(int steps) {
+		srand(0);
+
+		mcts::State state(mcts::createAxiom());
+		for (int i = 0; i < steps && !state.queue.empty(); ++i) {
+			std::vector<int> act = mcts::actions(state.queue.front());
+			if (act.empty()) {
+				state.queue.pop_front();
+				continue;
+			}
+			state.applyAction(act[rand() % act.size()]);
+		}
+
+		return state;
+	}
+
+	int countNodes(const boost::shared_ptr<mcts::Nonterminal>& node) {
+		int count = 1;
+		for (int i = 0; i < node->children.size(); ++i) {
+			count += countNodes(node->children[i]);
+		}
+		return count;
+	}
+
+	/**
+	 * similarityの計測用に、直線を描いた画像の距離マップを作成する。
+	 *
+	 * @param size		画像のサイズ
+	 * @param seed		直線を決める乱数のシード
+	 * @return			距離マップ (float)
+	 */
+	cv::Mat createDistMap(int size, int seed) {
+		cv::RNG rng(seed);
+		cv::Mat image(size, size, CV_8U, cv::Scalar(255));
+		for (int i = 0; i < 20; ++i) {
+			cv::line(image, cv::Point(rng.uniform(0, size), rng.uniform(0, size)), cv::Point(rng.uniform(0, size), rng.uniform(0, size)), cv::Scalar(0), 3);
+		}
+
+		cv::Mat distMap;
+		cv::distanceTransform(image, distMap, CV_DIST_L2, 3);
+		distMap.convertTo(distMap, CV_32F);
+		return distMap;
+	}
+
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// State
+
+static void BM_StateClone(benchmark::State& state) {
+	mcts::State s = createState(state.range(0));
+	int nodes = countNodes(s.derivationTree.root);
+
+	while (state.KeepRunning()) {
+		mcts::State cloned = s.clone();
+		benchmark::DoNotOptimize(cloned.derivationTree.root.get());
+	}
+	state.SetItemsProcessed(state.iterations() * nodes);
+}
+BENCHMARK(BM_StateClone)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_StateApplyAction(benchmark::State& state) {
+	mcts::State s = createState(state.range(0));
+	if (s.queue.empty()) {
+		state.SkipWithError("the derivation has already finished");
+		return;
+	}
+
+	while (state.KeepRunning()) {
+		// applyActionはstateを変更するので、毎回cloneしたものに適用する（cloneの時間は除く）
+		state.PauseTiming();
+		mcts::State cloned = s.clone();
+		std::vector<int> act = mcts::actions(cloned.queue.front());
+		state.ResumeTiming();
+
+		benchmark::DoNotOptimize(cloned.applyAction(act.empty() ? 0 : act[0]));
+	}
+}
+BENCHMARK(BM_StateApplyAction)->RangeMultiplier(4)->Range(1, 256);
+
+static void BM_RandomDerivation(benchmark::State& state) {
+	mcts::State s = createState(state.range(0));
+	if (s.queue.empty()) {
+		state.SkipWithError("the derivation has already finished");
+		return;
+	}
+
+	utils::BatchRandom random(0);
+	while (state.KeepRunning()) {
+		state.PauseTiming();
+		mcts::State cloned = s.clone();
+		state.ResumeTiming();
+
+		mcts::randomDerivation(cloned.derivationTree, cloned.queue, random);
+		benchmark::DoNotOptimize(cloned.derivationTree.root.get());
+	}
+}
+BENCHMARK(BM_RandomDerivation)->RangeMultiplier(4)->Range(1, 256);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// MCTSTreeNode
+
+static void BM_UCTSelectChild(benchmark::State& state) {
+	srand(0);
+
+	boost::shared_ptr<mcts::MCTSTreeNode> node(new mcts::MCTSTreeNode(createState(0)));
+	node->visits = 0;
+	for (int i = 0; i < state.range(0); ++i) {
+		boost::shared_ptr<mcts::MCTSTreeNode> child(new mcts::MCTSTreeNode(mcts::State()));
+		child->visits = 1 + rand() % 100;
+		child->bestValue = rand() / (float)RAND_MAX;
+		node->children.push_back(child);
+		node->visits += child->visits;
+	}
+
+	utils::BatchRandom random(0);
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(node->UCTSelectChild(random).get());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UCTSelectChild)->RangeMultiplier(2)->Range(2, 64);
+
+static void BM_AddValue(benchmark::State& state) {
+	// 既にrange(0)個の値を持つノードに、1個の値を追加する時間を計測する
+	mcts::MCTSTreeNode node((mcts::State()));
+	for (int i = 0; i < state.range(0); ++i) {
+		node.addValue(i / (float)state.range(0));
+	}
+
+	while (state.KeepRunning()) {
+		node.addValue(0.5f);
+
+		state.PauseTiming();
+		node.values.pop_back();
+		state.ResumeTiming();
+	}
+}
+BENCHMARK(BM_AddValue)->RangeMultiplier(8)->Range(1, 4096);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// similarity
+
+static void BM_Similarity(benchmark::State& state) {
+	cv::Mat distMap = createDistMap(state.range(0), 1);
+	cv::Mat targetDistMap = createDistMap(state.range(0), 2);
+
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(mcts::similarity(distMap, targetDistMap, 10000.0f, 5000.0f));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(0));
+}
+BENCHMARK(BM_Similarity)->Arg(512)->Arg(1024);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// geometry
+
+static void BM_GenerateGeometry(benchmark::State& state) {
+	// generateGeometryはrenderManagerを使わないので、描画環境なしで計測できる
+	mcts::MCTS mcts(cv::Mat(8, 8, CV_8UC3, cv::Scalar(255, 255, 255)), NULL, glm::mat4());
+	mcts::State s = createState(state.range(0));
+	int nodes = countNodes(s.derivationTree.root);
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		mcts.generateGeometry(NULL, glm::mat4(), s.derivationTree.root, vertices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * nodes);
+}
+BENCHMARK(BM_GenerateGeometry)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_DrawQuad(benchmark::State& state) {
+	glm::mat4 mat = glm::translate(glm::mat4(), glm::vec3(0, 0.25f, 0));
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		for (int i = 0; i < state.range(0); ++i) {
+			glutils::drawQuad(0.3f, 0.5f, glm::vec4(0, 0, 0, 1), mat, vertices);
+		}
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DrawQuad)->RangeMultiplier(8)->Range(1, 512);
+
+// BM_DrawQuadと同じ四角形を、先に確保した領域にemitQuadで書き込む
+static void BM_EmitQuad(benchmark::State& state) {
+	glm::mat4 mat = glm::translate(glm::mat4(), glm::vec3(0, 0.25f, 0));
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		Vertex* out = glutils::appendSpan(vertices, state.range(0) * glutils::QUAD_VERTICES);
+		for (int i = 0; i < state.range(0); ++i) {
+			out = glutils::emitQuad(0.3f, 0.5f, glm::vec4(0, 0, 0, 1), mat, out);
+		}
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EmitQuad)->RangeMultiplier(8)->Range(1, 512);
+
+// BM_EmitQuadと同じ四角形を、Rigid2Dの座標系でまとめてemitQuads2Dで書き込む
+static void BM_EmitQuads2D(benchmark::State& state) {
+	glutils::Quads2D quads;
+	for (int i = 0; i < state.range(0); ++i) {
+		quads.push_back(glutils::Rigid2D(0.0f, glm::vec2(0, 0.25f)), 0.3f, 0.5f, glm::vec4(0, 0, 0, 1));
+	}
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		glutils::emitQuads2D(quads, glutils::appendSpan(vertices, quads.size() * glutils::QUAD_VERTICES));
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EmitQuads2D)->RangeMultiplier(8)->Range(1, 512);
+
+static void BM_DrawPolygon(benchmark::State& state) {
+	// 頂点数range(0)の凸多角形
+	std::vector<glm::vec3> points(state.range(0));
+	for (int i = 0; i < points.size(); ++i) {
+		float theta = 2.0f * 3.1415926535f * i / points.size();
+		points[i] = glm::vec3(cosf(theta), sinf(theta), 0);
+	}
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		glutils::drawPolygon(points, glm::vec4(0, 0, 0, 1), vertices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+}
+BENCHMARK(BM_DrawPolygon)->RangeMultiplier(2)->Range(4, 64);
+
+// 点数range(0)の、らせん状の折れ線
+static void createHelix(int numPoints, std::vector<glm::vec3>& points) {
+	points.resize(numPoints);
+	for (int i = 0; i < points.size(); ++i) {
+		points[i] = glm::vec3(cosf(i * 0.5f), i * 0.2f, sinf(i * 0.5f));
+	}
+}
+
+static void BM_DrawTube(benchmark::State& state) {
+	std::vector<glm::vec3> points;
+	createHelix(state.range(0), points);
+
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		glutils::drawTube(points, 0.1f, glm::vec4(0, 0, 0, 1), vertices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * (state.range(0) - 1));
+}
+BENCHMARK(BM_DrawTube)->RangeMultiplier(4)->Range(4, 256);
+
+static void BM_DrawTubeIndexed(benchmark::State& state) {
+	std::vector<glm::vec3> points;
+	createHelix(state.range(0), points);
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		indices.clear();
+		glutils::drawTube(points, 0.1f, glm::vec4(0, 0, 0, 1), vertices, indices);
+		benchmark::DoNotOptimize(vertices.data());
+		benchmark::DoNotOptimize(indices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * (state.range(0) - 1));
+}
+BENCHMARK(BM_DrawTubeIndexed)->RangeMultiplier(4)->Range(4, 256);
+
+static void BM_DrawSphere(benchmark::State& state) {
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		glutils::drawSphere(1.0f, glm::vec4(0, 0, 0, 1), glm::mat4(), vertices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DrawSphere);
+
+static void BM_DrawSphereIndexed(benchmark::State& state) {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		indices.clear();
+		glutils::drawSphere(1.0f, glm::vec4(0, 0, 0, 1), glm::mat4(), vertices, indices);
+		benchmark::DoNotOptimize(vertices.data());
+		benchmark::DoNotOptimize(indices.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DrawSphereIndexed);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// PMTree2D
+
+static void BM_PMTree2DGenerateRandom(benchmark::State& state) {
+	srand(0);
+
+	pmtree::PMTree2D tree;
+	while (state.KeepRunning()) {
+		tree.generateRandom();
+		benchmark::DoNotOptimize(tree.curveV.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PMTree2DGenerateRandom);
+
+// items/sec = 1秒あたりに生成できる木の数
+static void BM_PMTree2DGenerateRandomBatch(benchmark::State& state) {
+	std::vector<pmtree::PMTree2D> trees;
+	uint32_t seed = 0;
+	while (state.KeepRunning()) {
+		pmtree::PMTree2D::generateRandom(state.range(0), seed++, trees);
+		benchmark::DoNotOptimize(trees.data());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PMTree2DGenerateRandomBatch)->RangeMultiplier(8)->Range(1, 512);
+
+static void BM_PMTree2DShapeRatio(benchmark::State& state) {
+	float ratio = 0.0f;
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(pmtree::shapeRatio(state.range(0), ratio));
+		ratio = ratio < 1.0f ? ratio + 0.001f : 0.0f;
+	}
+}
+BENCHMARK(BM_PMTree2DShapeRatio)->DenseRange(0, 7);
+
+static void BM_PMTree2DGenerateGeometry(benchmark::State& state) {
+	srand(0);
+
+	pmtree::PMTree2D tree;
+	tree.generateRandom();
+	std::vector<Vertex> vertices;
+	while (state.KeepRunning()) {
+		vertices.clear();
+		tree.generateGeometry(true, vertices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+	state.SetItemsProcessed(state.iterations() * tree.size());
+}
+BENCHMARK(BM_PMTree2DGenerateGeometry);
+
+BENCHMARK_MAIN();